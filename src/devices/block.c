@@ -145,6 +145,57 @@ block_write (struct block *block, block_sector_t sector, const void *buffer)
   lock_release (&block->lock);
 }
 
+/* Reads CNT consecutive sectors starting at SECTOR from BLOCK
+   into BUFFER, which must have room for CNT * BLOCK_SECTOR_SIZE
+   bytes.  Drivers that support it do this with a single
+   command. */
+void
+block_read_multiple (struct block *block, block_sector_t sector,
+                     void *buffer, size_t cnt)
+{
+  size_t i;
+
+  if (cnt == 0)
+    return;
+  check_sector (block, sector);
+  check_sector (block, sector + cnt - 1);
+  if (block->ops->read_multiple != NULL)
+    block->ops->read_multiple (block->aux, sector, buffer, cnt);
+  else
+    for (i = 0; i < cnt; i++)
+      block->ops->read (block->aux, sector + i,
+                        (uint8_t *) buffer + i * BLOCK_SECTOR_SIZE);
+  lock_acquire (&block->lock);
+  block->read_cnt += cnt;
+  lock_release (&block->lock);
+}
+
+/* Writes CNT consecutive sectors starting at SECTOR to BLOCK
+   from BUFFER, which must contain CNT * BLOCK_SECTOR_SIZE
+   bytes.  Drivers that support it do this with a single
+   command. */
+void
+block_write_multiple (struct block *block, block_sector_t sector,
+                      const void *buffer, size_t cnt)
+{
+  size_t i;
+
+  if (cnt == 0)
+    return;
+  check_sector (block, sector);
+  check_sector (block, sector + cnt - 1);
+  ASSERT (block->type != BLOCK_FOREIGN);
+  if (block->ops->write_multiple != NULL)
+    block->ops->write_multiple (block->aux, sector, buffer, cnt);
+  else
+    for (i = 0; i < cnt; i++)
+      block->ops->write (block->aux, sector + i,
+                         (const uint8_t *) buffer + i * BLOCK_SECTOR_SIZE);
+  lock_acquire (&block->lock);
+  block->write_cnt += cnt;
+  lock_release (&block->lock);
+}
+
 /* Returns the number of sectors in BLOCK. */
 block_sector_t
 block_size (struct block *block)
@@ -7,15 +7,25 @@
 #include "devices/lapic.h"
 #include "devices/timer.h"
 #include "threads/io.h"
+#include "threads/palloc.h"
+#include "threads/memstat.h"
 #include "threads/thread.h"
 #include "threads/cpu.h"
 #ifdef USERPROG
 #include "userprog/exception.h"
+#include "userprog/pagedir.h"
 #endif
 #ifdef FILESYS
 #include "devices/block.h"
 #include "filesys/filesys.h"
 #endif
+#ifdef VM
+#include "vm/frame.h"
+#include "vm/swap.h"
+#include "vm/pagecache.h"
+#include "vm/prepage.h"
+#include "vm/mappedfile.h"
+#endif
 
 /* Keyboard control register port. */
 #define CONTROL_REG 0x64
@@ -108,6 +118,9 @@ shutdown_power_off (void)
   const char *p;
 
 #ifdef FILESYS
+#ifdef VM
+  prepage_save ();
+#endif
   filesys_done ();
 #endif
   
@@ -147,6 +160,8 @@ print_stats (void)
 {
   timer_print_stats ();
   thread_print_stats ();
+  palloc_print_stats ();
+  memstat_print ();
 #ifdef FILESYS
   block_print_stats ();
 #endif
@@ -154,5 +169,14 @@ print_stats (void)
   kbd_print_stats ();
 #ifdef USERPROG
   exception_print_stats ();
+  pagedir_print_stats ();
+#endif
+#ifdef VM
+  ft_print_stats ();
+  pagecache_print_stats ();
+  prepage_print_stats ();
+  mmap_print_stats ();
+  wset_print_stats ();
+  st_print_stats ();
 #endif
 }
@@ -279,6 +279,8 @@ static struct block_operations msc_operations =
   {
     msc_read,
     msc_write,
+    NULL,
+    NULL
   };
 
 static void
@@ -6,6 +6,9 @@
 #include "filesys/filesys.h"
 #include "filesys/free-map.h"
 #include "threads/malloc.h"
+#ifdef VM
+#include "vm/pagecache.h"
+#endif
 
 /* Identifies an inode. */
 #define INODE_MAGIC 0x494e4f44
@@ -127,7 +130,7 @@ inode_open (block_sector_t sector)
     }
 
   /* Allocate memory. */
-  inode = malloc (sizeof *inode);
+  inode = malloc_tagged (sizeof *inode, MEM_INODE);
   if (inode == NULL)
     return NULL;
 
@@ -179,6 +182,10 @@ inode_close (struct inode *inode)
           free_map_release (inode->sector, 1);
           free_map_release (inode->data.start,
                             bytes_to_sectors (inode->data.length)); 
+#ifdef VM
+          /* The sector may name another inode from now on. */
+          pagecache_drop (inode->sector);
+#endif
         }
 
       free (inode); 
@@ -231,7 +238,7 @@ inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset)
              into caller's buffer. */
           if (bounce == NULL) 
             {
-              bounce = malloc (BLOCK_SECTOR_SIZE);
+              bounce = malloc_tagged (BLOCK_SECTOR_SIZE, MEM_BUFFER);
               if (bounce == NULL)
                 break;
             }
@@ -291,7 +298,7 @@ inode_write_at (struct inode *inode, const void *buffer_, off_t size,
           /* We need a bounce buffer. */
           if (bounce == NULL) 
             {
-              bounce = malloc (BLOCK_SECTOR_SIZE);
+              bounce = malloc_tagged (BLOCK_SECTOR_SIZE, MEM_BUFFER);
               if (bounce == NULL)
                 break;
             }
@@ -314,6 +321,13 @@ inode_write_at (struct inode *inode, const void *buffer_, off_t size,
     }
   free (bounce);
 
+#ifdef VM
+  /* Keep cached copies of the file's pages up to date. */
+  if (bytes_written > 0)
+    pagecache_write (inode->sector, offset - bytes_written, buffer_,
+                     bytes_written);
+#endif
+
   return bytes_written;
 }
 
@@ -120,11 +120,58 @@ lcr3 (uint32_t val)
   asm volatile("movl %0,%%cr3" : : "r" (val) : "memory");
 }
 
+/* CR4 bits. */
+#define CR4_PSE (1 << 4)        /* 4 MB pages in PDEs with PTE_PS. */
+#define CR4_PGE (1 << 7)        /* Global pages survive CR3 loads. */
+
+static inline uint32_t
+rcr4 (void)
+{
+  uint32_t val;
+  asm volatile("movl %%cr4,%0" : "=r" (val));
+  return val;
+}
+
+static inline void
+lcr4 (uint32_t val)
+{
+  asm volatile("movl %0,%%cr4" : : "r" (val) : "memory");
+}
+
+/* Flushes the whole TLB of the current CPU.  Global (kernel)
+   entries survive a CR3 load once CR4_PGE is set, toggling the
+   bit drops them too.  See [IA32-v3a] 4.10.4.1 "Operations that
+   Invalidate TLBs and Paging-Structure Caches". */
 static inline void
 flushtlb (void)
 {
-  asm volatile("movl %%cr3,%%eax"::: "memory");
-  asm volatile("movl %%eax,%%cr3"::: "memory");
+  uint32_t cr4 = rcr4 ();
+
+  if (cr4 & CR4_PGE)
+    {
+      lcr4 (cr4 & ~CR4_PGE);
+      lcr4 (cr4);
+    }
+  else
+    {
+      asm volatile("movl %%cr3,%%eax; movl %%eax,%%cr3" ::: "memory", "eax");
+    }
+}
+
+/* Invalidates any TLB entry for the page containing VA on the
+   current CPU. */
+static inline void
+invlpg (const void *va)
+{
+  asm volatile("invlpg (%0)" : : "r" (va) : "memory");
+}
+
+static inline uint64_t
+rdtsc (void)
+{
+  uint32_t lo, hi;
+  asm volatile("rdtsc" : "=a" (lo), "=d" (hi));
+  return ((uint64_t) hi << 32) | lo;
 }
 
 #endif /* LIB_KERNEL_X86_H_ */
@@ -23,6 +23,7 @@ typedef int mapid_t;
 void halt (void) NO_RETURN;
 void exit (int status) NO_RETURN;
 pid_t exec (const char *file);
+pid_t fork (void);
 int wait (pid_t);
 bool create (const char *file, unsigned initial_size);
 bool remove (const char *file);
@@ -37,6 +38,7 @@ void close (int fd);
 /* Project 3 and optionally project 4. */
 mapid_t mmap (int fd, void *addr);
 void munmap (mapid_t);
+int msync (mapid_t);
 
 /* Project 4 only. */
 bool chdir (const char *dir);
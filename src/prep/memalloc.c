@@ -0,0 +1,531 @@
+/*
+ * A scalable implementation of the memory allocator interface
+ * described in memalloc.h.
+ *
+ * The heap is a single region of memory divided into blocks.  Every
+ * block starts with a size_t header holding its length, including
+ * the header.  Lengths are multiples of sizeof (size_t), so the two
+ * low bits of the header are free to hold flags: B_USED is set if
+ * the block is not in the shared pool, and B_PREV_FREE is set if
+ * the block just below it is.  A block in the shared pool also
+ * stores its length in a footer, its last size_t, so that the block
+ * above it can find its start.  These boundary tags let mem_free()
+ * coalesce a block with both neighbors in constant time.
+ *
+ * The shared pool keeps free blocks on segregated free lists, one
+ * per power of two of block length.  A request looks in the list
+ * for its own power of two first (first fit), then takes the first
+ * block of the next nonempty larger list.  As in the original
+ * first-fit design, the allocated block is cut from the end of the
+ * free block, so the remainder keeps its position in memory.
+ *
+ * Small requests, up to SMALL_MAX bytes including the header, are
+ * rounded up to one of NCLASSES size classes and served from a
+ * cache owned by the calling thread, which needs no contended lock.
+ * Blocks in a cache are "used" as far as the pool is concerned.
+ * An empty cache is refilled, and an overfull cache is trimmed, by
+ * moving half its capacity at a time to or from the pool under a
+ * single acquisition of the pool lock.  A thread's cache is handed
+ * back to the pool when the thread exits.
+ *
+ * Memory held in caches is not available to other threads.  When
+ * the pool cannot satisfy a request, all caches are drained back
+ * into it, which coalesces their blocks, and the request is retried
+ * once before mem_alloc() gives up and returns NULL.
+ */
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <list.h>
+#include <debug.h>
+#include <round.h>
+#include "memalloc.h"
+
+/* Flags kept in the low bits of a block header. */
+#define B_USED          0x1     /* Allocated or cached. */
+#define B_PREV_FREE     0x2     /* Block below is in the pool. */
+#define B_FLAGS         (B_USED | B_PREV_FREE)
+
+/* Smallest block that can be put on a free list: header, list
+   element and footer. */
+#define MIN_BLOCK       (sizeof (struct free_block) + sizeof (size_t))
+
+/* Size classes.  Block lengths up to 256 bytes are rounded up to a
+   multiple of 16, lengths up to SMALL_MAX to a multiple of 64. */
+#define SMALL_MAX       1024
+#define NCLASSES        (256 / 16 + (SMALL_MAX - 256) / 64)
+
+/* A cache holds at most CACHE_BYTES per size class, and at most
+   CACHE_BLOCKS blocks.  It moves half of that at a time to or from
+   the pool. */
+#define CACHE_BYTES     4096
+#define CACHE_BLOCKS    32
+
+/* Maximum number of threads with a cache of their own.  Further
+   threads use the pool directly. */
+#define MAX_CACHES      64
+
+/* Number of segregated free lists in the pool. */
+#define NBINS           32
+
+/* A cached block.  Blocks in a cache are linked through their
+   data area. */
+struct cached_block
+  {
+    size_t              length;         /* Header, as in used_block. */
+    struct cached_block *next;          /* Next block in cache. */
+  };
+
+/* A per-thread cache of small blocks. */
+struct cache
+  {
+    pthread_mutex_t     lock;           /* Owner vs. mem_drain_caches(). */
+    bool                in_use;         /* Owned by a live thread. */
+    struct cached_block *blocks[NCLASSES]; /* Cached blocks by class. */
+    size_t              count[NCLASSES];   /* Length of each list. */
+  };
+
+/* The shared pool. */
+static pthread_mutex_t pool_lock = PTHREAD_MUTEX_INITIALIZER;
+static uint8_t *heap_start;             /* First block. */
+static uint8_t *heap_end;               /* End of last block. */
+static struct list bins[NBINS];         /* Free lists by log2 (length). */
+
+/* Per-thread caches. */
+static struct cache caches[MAX_CACHES];
+static __thread struct cache *my_cache;
+static pthread_key_t cache_key;
+static pthread_once_t cache_once = PTHREAD_ONCE_INIT;
+
+static void *pool_alloc (size_t length);
+static void pool_free (struct used_block *);
+static void drain_caches (void);
+static void cache_key_init (void);
+
+/* Returns the length of block B without its flags.
+   The pool may update B_PREV_FREE in the header of a block that
+   another thread is freeing, so headers are accessed atomically. */
+static inline size_t
+block_length (const void *b)
+{
+  return __atomic_load_n ((const size_t *) b, __ATOMIC_RELAXED)
+         & ~(size_t) B_FLAGS;
+}
+
+/* Returns the block following B, or NULL if B is the last one. */
+static inline struct used_block *
+next_block (const void *b)
+{
+  uint8_t *next = (uint8_t *) b + block_length (b);
+  return next < heap_end ? (struct used_block *) next : NULL;
+}
+
+/* Sets or clears FLAG in the header of block B, if B is not NULL. */
+static inline void
+set_flag (struct used_block *b, size_t flag, bool value)
+{
+  if (b == NULL)
+    return;
+  if (value)
+    __atomic_fetch_or (&b->length, flag, __ATOMIC_RELAXED);
+  else
+    __atomic_fetch_and (&b->length, ~flag, __ATOMIC_RELAXED);
+}
+
+/* Returns the length of the block needed to hold LENGTH bytes. */
+static size_t
+request_length (size_t length)
+{
+  size_t n = ROUND_UP (length + sizeof (struct used_block), sizeof (size_t));
+  return n < MIN_BLOCK ? MIN_BLOCK : n;
+}
+
+/* Returns the size class of a block of LENGTH <= SMALL_MAX bytes. */
+static int
+size_class (size_t length)
+{
+  if (length <= 256)
+    return (length - 1) / 16;
+  return 256 / 16 + (length - 256 - 1) / 64;
+}
+
+/* Returns the block length of size class CLS. */
+static size_t
+class_length (int cls)
+{
+  if (cls < 256 / 16)
+    return (cls + 1) * 16;
+  return 256 + (cls - 256 / 16 + 1) * 64;
+}
+
+/* Returns the number of blocks of class CLS a cache may hold. */
+static size_t
+class_capacity (int cls)
+{
+  size_t cap = CACHE_BYTES / class_length (cls);
+  if (cap > CACHE_BLOCKS)
+    cap = CACHE_BLOCKS;
+  return cap < 2 ? 2 : cap;
+}
+
+/* Returns the free list for a block of LENGTH bytes. */
+static int
+bin_index (size_t length)
+{
+  int idx = 0;
+  while (length >>= 1)
+    idx++;
+  return idx < NBINS ? idx : NBINS - 1;
+}
+
+/* Puts free block B of LENGTH bytes into the pool and writes its
+   boundary tags. */
+static void
+bin_insert (struct free_block *b, size_t length)
+{
+  b->length = length;
+  *(size_t *) ((uint8_t *) b + length - sizeof (size_t)) = length;
+  list_push_front (&bins[bin_index (length)], &b->elem);
+}
+
+/* Initialize memory allocator to use 'length'
+   bytes of memory at 'base'. */
+void
+mem_init (uint8_t *base, size_t length)
+{
+  int i;
+
+  pthread_once (&cache_once, cache_key_init);
+  for (i = 0; i < NBINS; i++)
+    list_init (&bins[i]);
+
+  /* Forget any blocks cached from a previous heap. */
+  for (i = 0; i < MAX_CACHES; i++)
+    {
+      memset (caches[i].blocks, 0, sizeof caches[i].blocks);
+      memset (caches[i].count, 0, sizeof caches[i].count);
+    }
+
+  length = ROUND_DOWN (length, sizeof (size_t));
+  heap_start = base;
+  heap_end = base + length;
+  bin_insert ((struct free_block *) base, length);
+}
+
+/* Finds a free block of at least LENGTH bytes, takes LENGTH bytes
+   off its end, and returns them as a used block.  Returns NULL if
+   there is no such block.  The pool lock must be held. */
+static void *
+pool_alloc (size_t length)
+{
+  struct free_block *fb = NULL;
+  int idx;
+
+  for (idx = bin_index (length); idx < NBINS && fb == NULL; idx++)
+    {
+      struct list_elem *e;
+      for (e = list_begin (&bins[idx]); e != list_end (&bins[idx]);
+           e = list_next (e))
+        {
+          struct free_block *b = list_entry (e, struct free_block, elem);
+          if (block_length (b) >= length)
+            {
+              fb = b;
+              break;
+            }
+        }
+    }
+  if (fb == NULL)
+    return NULL;
+
+  list_remove (&fb->elem);
+  size_t total = block_length (fb);
+  struct used_block *ub;
+  if (total - length >= MIN_BLOCK)
+    {
+      /* Split: the remainder stays free below the new block. */
+      bin_insert (fb, total - length);
+      ub = (struct used_block *) ((uint8_t *) fb + total - length);
+      ub->length = length | B_USED | B_PREV_FREE;
+    }
+  else
+    {
+      ub = (struct used_block *) fb;
+      ub->length = total | B_USED;
+    }
+  set_flag (next_block (ub), B_PREV_FREE, false);
+  return ub;
+}
+
+/* Returns used block B to the pool, merging it with free
+   neighbors.  The pool lock must be held. */
+static void
+pool_free (struct used_block *b)
+{
+  size_t length = block_length (b);
+  struct used_block *next = next_block (b);
+
+  if (next != NULL && !(next->length & B_USED))
+    {
+      struct free_block *nb = (struct free_block *) next;
+      list_remove (&nb->elem);
+      length += block_length (nb);
+    }
+
+  if (b->length & B_PREV_FREE)
+    {
+      size_t prev_length = ((size_t *) b)[-1];
+      struct free_block *pb =
+        (struct free_block *) ((uint8_t *) b - prev_length);
+      list_remove (&pb->elem);
+      length += prev_length;
+      b = (struct used_block *) pb;
+    }
+
+  bin_insert ((struct free_block *) b, length);
+  set_flag (next_block (b), B_PREV_FREE, true);
+}
+
+/* Allocates a block of LENGTH bytes from the pool.  If the pool
+   cannot satisfy the request, drains all caches and tries again. */
+static void *
+pool_alloc_or_drain (size_t length)
+{
+  struct used_block *b;
+
+  pthread_mutex_lock (&pool_lock);
+  b = pool_alloc (length);
+  pthread_mutex_unlock (&pool_lock);
+  if (b == NULL)
+    {
+      drain_caches ();
+      pthread_mutex_lock (&pool_lock);
+      b = pool_alloc (length);
+      pthread_mutex_unlock (&pool_lock);
+    }
+  return b;
+}
+
+/* Returns cache C's blocks of class CLS, down to KEEP of them, to
+   the pool.  C's lock must be held, the pool lock must not be. */
+static void
+cache_trim (struct cache *c, int cls, size_t keep)
+{
+  pthread_mutex_lock (&pool_lock);
+  while (c->count[cls] > keep)
+    {
+      struct cached_block *cb = c->blocks[cls];
+      c->blocks[cls] = cb->next;
+      c->count[cls]--;
+      pool_free ((struct used_block *) cb);
+    }
+  pthread_mutex_unlock (&pool_lock);
+}
+
+/* Moves up to half of class CLS's capacity from the pool into
+   cache C.  C's lock must be held, the pool lock must not be. */
+static void
+cache_refill (struct cache *c, int cls)
+{
+  size_t length = class_length (cls);
+  size_t n = class_capacity (cls) / 2;
+
+  pthread_mutex_lock (&pool_lock);
+  while (n-- > 0)
+    {
+      struct cached_block *cb = pool_alloc (length);
+      if (cb == NULL)
+        break;
+      cb->next = c->blocks[cls];
+      c->blocks[cls] = cb;
+      c->count[cls]++;
+    }
+  pthread_mutex_unlock (&pool_lock);
+}
+
+/* Returns all blocks in every cache to the pool. */
+static void
+drain_caches (void)
+{
+  int i, cls;
+
+  for (i = 0; i < MAX_CACHES; i++)
+    {
+      struct cache *c = &caches[i];
+      pthread_mutex_lock (&c->lock);
+      for (cls = 0; cls < NCLASSES; cls++)
+        if (c->count[cls] > 0)
+          cache_trim (c, cls, 0);
+      pthread_mutex_unlock (&c->lock);
+    }
+}
+
+/* Called when a thread that owns cache C exits. */
+static void
+cache_release (void *c_)
+{
+  struct cache *c = c_;
+  int cls;
+
+  pthread_mutex_lock (&c->lock);
+  for (cls = 0; cls < NCLASSES; cls++)
+    if (c->count[cls] > 0)
+      cache_trim (c, cls, 0);
+  c->in_use = false;
+  pthread_mutex_unlock (&c->lock);
+  my_cache = NULL;
+}
+
+/* Creates the key whose destructor releases a thread's cache. */
+static void
+cache_key_init (void)
+{
+  int i;
+
+  pthread_key_create (&cache_key, cache_release);
+  for (i = 0; i < MAX_CACHES; i++)
+    pthread_mutex_init (&caches[i].lock, NULL);
+}
+
+/* Returns the calling thread's cache, claiming one if needed, or
+   NULL if all caches are taken. */
+static struct cache *
+get_cache (void)
+{
+  int i;
+
+  if (my_cache != NULL)
+    return my_cache;
+
+  pthread_mutex_lock (&pool_lock);
+  for (i = 0; i < MAX_CACHES; i++)
+    if (!caches[i].in_use)
+      {
+        caches[i].in_use = true;
+        my_cache = &caches[i];
+        break;
+      }
+  pthread_mutex_unlock (&pool_lock);
+
+  if (my_cache != NULL)
+    pthread_setspecific (cache_key, my_cache);
+  return my_cache;
+}
+
+/* Allocate 'length' bytes of memory. */
+void *
+mem_alloc (size_t length)
+{
+  size_t need = request_length (length);
+  struct used_block *b = NULL;
+  struct cache *c;
+
+  if (need <= SMALL_MAX && (c = get_cache ()) != NULL)
+    {
+      int cls = size_class (need);
+
+      pthread_mutex_lock (&c->lock);
+      if (c->blocks[cls] == NULL)
+        cache_refill (c, cls);
+      if (c->blocks[cls] != NULL)
+        {
+          struct cached_block *cb = c->blocks[cls];
+          c->blocks[cls] = cb->next;
+          c->count[cls]--;
+          b = (struct used_block *) cb;
+        }
+      pthread_mutex_unlock (&c->lock);
+      need = class_length (cls);
+    }
+
+  if (b == NULL)
+    b = pool_alloc_or_drain (need);
+  return b != NULL ? b->data : NULL;
+}
+
+/* Free memory pointed to by 'ptr'. */
+void
+mem_free (void *ptr)
+{
+  struct used_block *b;
+  size_t length;
+  struct cache *c;
+
+  if (ptr == NULL)
+    return;
+
+  b = (struct used_block *) ((uint8_t *) ptr - offsetof (struct used_block,
+                                                         data));
+  ASSERT (__atomic_load_n (&b->length, __ATOMIC_RELAXED) & B_USED);
+  length = block_length (b);
+
+  /* Only blocks of exactly a class length can be cached; others
+     absorbed a remainder too small to split off. */
+  if (length <= SMALL_MAX && length == class_length (size_class (length))
+      && (c = get_cache ()) != NULL)
+    {
+      int cls = size_class (length);
+      struct cached_block *cb = (struct cached_block *) b;
+
+      pthread_mutex_lock (&c->lock);
+      cb->next = c->blocks[cls];
+      c->blocks[cls] = cb;
+      if (++c->count[cls] > class_capacity (cls))
+        cache_trim (c, cls, class_capacity (cls) / 2);
+      pthread_mutex_unlock (&c->lock);
+      return;
+    }
+
+  pthread_mutex_lock (&pool_lock);
+  pool_free (b);
+  pthread_mutex_unlock (&pool_lock);
+}
+
+/* Return the number of elements in the free list.
+   Blocks held in thread caches are returned to the pool first, so
+   the result reflects how well the heap has been coalesced. */
+size_t
+mem_sizeof_free_list (void)
+{
+  size_t n = 0;
+  int i;
+
+  drain_caches ();
+  pthread_mutex_lock (&pool_lock);
+  for (i = 0; i < NBINS; i++)
+    n += list_size (&bins[i]);
+  pthread_mutex_unlock (&pool_lock);
+  return n;
+}
+
+/* Dump the free lists and the contents of the thread caches. */
+void
+mem_dump_free_list (void)
+{
+  int i, cls;
+
+  pthread_mutex_lock (&pool_lock);
+  for (i = 0; i < NBINS; i++)
+    {
+      struct list_elem *e;
+      for (e = list_begin (&bins[i]); e != list_end (&bins[i]);
+           e = list_next (e))
+        {
+          struct free_block *b = list_entry (e, struct free_block, elem);
+          printf ("bin %2d: %p-%p (%zu bytes)\n", i, (void *) b,
+                  (void *) ((uint8_t *) b + block_length (b)),
+                  block_length (b));
+        }
+    }
+  pthread_mutex_unlock (&pool_lock);
+
+  for (i = 0; i < MAX_CACHES; i++)
+    for (cls = 0; cls < NCLASSES; cls++)
+      if (caches[i].count[cls] > 0)
+        printf ("cache %2d: %zu blocks of %zu bytes\n", i,
+                caches[i].count[cls], class_length (cls));
+}
+
+// vim: sw=2
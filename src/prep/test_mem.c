@@ -14,6 +14,7 @@
 #include <stdlib.h>
 #include <unistd.h>
 #include <string.h>
+#include <time.h>
 #include <list.h>
 #include <debug.h>
 #include "memalloc.h"
@@ -28,6 +29,30 @@ static long long leftfence;
 static uint8_t memory[MEMSIZE]; /* Area of memory on which allocator works. 2^16 = 64KB */
 static long long rightfence;
 
+/* Benchmark parameters.  With -b, the benchmark runs after the
+   tests, on a larger heap, with BENCH_THREADS[] threads in turn. */
+#define BENCH_MEMSIZE   (1<<24) /* 16 MB heap. */
+#define BENCH_OPS       200000  /* Allocations and frees per thread. */
+#define BENCH_SLOTS     1024    /* Live objects per thread. */
+#define BENCH_SAMPLE    16      /* Time every BENCH_SAMPLE'th operation. */
+#define BENCH_MAXTHREADS 16
+static const int BENCH_THREADS[] = { 1, 2, 4, 8, 16 };
+static uint8_t bench_memory[BENCH_MEMSIZE];
+
+/* State of one benchmark thread. */
+struct bench_thread
+  {
+    pthread_t thread;
+    unsigned seed;
+    uint8_t *ptrs[BENCH_SLOTS];         /* Live objects. */
+    size_t sizes[BENCH_SLOTS];          /* Their sizes. */
+    long failed;                        /* Failed allocations. */
+    long nsamples;
+    long samples[BENCH_OPS / BENCH_SAMPLE]; /* Sampled latencies, in ns. */
+  };
+static struct bench_thread bench[BENCH_MAXTHREADS];
+static long bench_samples[BENCH_MAXTHREADS * (BENCH_OPS / BENCH_SAMPLE)];
+
 /* These declarations are duplicated because we're including Pintos's 
    (a non-standard) stdlib.h above which does not declare those functions. */
 extern void exit(int);        
@@ -192,11 +217,170 @@ basic_tests()
   return 0;
 }
 
+/* Returns the current time in nanoseconds. */
+static long long
+now_ns(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/* Returns a random object size: mostly small objects, some medium
+   and a few large ones. */
+static size_t
+bench_size(unsigned *seed)
+{
+  int r = rand_r(seed) % 100;
+  if (r < 80)
+    return (rand_r(seed) % 64 + 1) * 4;         /* 4 B - 256 B */
+  if (r < 95)
+    return (rand_r(seed) % 448 + 65) * 4;       /* 260 B - 2 kB */
+  return (rand_r(seed) % 3584 + 513) * 4;       /* 2 kB - 16 kB */
+}
+
+/*
+ * Benchmark thread.  Repeatedly picks a random slot, frees its
+ * object if it has one and allocates a new one otherwise.  Leaves
+ * its live objects allocated so that main() can measure
+ * fragmentation and free them from a different thread.
+ */
+static void *
+bench_thread(void *arg)
+{
+  struct bench_thread *bt = arg;
+  int i;
+
+  for (i = 0; i < BENCH_OPS; i++)
+    {
+      int slot = rand_r(&bt->seed) % BENCH_SLOTS;
+      bool timed = i % BENCH_SAMPLE == 0;
+      long long start = timed ? now_ns() : 0;
+
+      if (bt->ptrs[slot] == NULL)
+        {
+          bt->sizes[slot] = bench_size(&bt->seed);
+          bt->ptrs[slot] = mem_alloc(bt->sizes[slot]);
+          if (bt->ptrs[slot] == NULL)
+            bt->failed++;
+          else
+            bt->ptrs[slot][0] = bt->ptrs[slot][bt->sizes[slot] - 1] = 1;
+        }
+      else
+        {
+          mem_free(bt->ptrs[slot]);
+          bt->ptrs[slot] = NULL;
+        }
+
+      if (timed)
+        bt->samples[bt->nsamples++] = now_ns() - start;
+    }
+  return NULL;
+}
+
+static int
+compare_long(const void *a_, const void *b_)
+{
+  const long *a = a_, *b = b_;
+  return *a < *b ? -1 : *a > *b;
+}
+
+/* Returns the size of the largest object that can be allocated
+   right now. */
+static size_t
+largest_allocation(void)
+{
+  size_t lo = 0, hi = BENCH_MEMSIZE / 4;
+  while (lo < hi)
+    {
+      size_t mid = (lo + hi + 1) / 2;
+      void *p = mem_alloc(mid * 4);
+      if (p != NULL)
+        {
+          mem_free(p);
+          lo = mid;
+        }
+      else
+        hi = mid - 1;
+    }
+  return lo * 4;
+}
+
+/*
+ * Benchmark.  For each thread count, reports throughput in
+ * operations per second, the latency distribution of individual
+ * mem_alloc()/mem_free() calls, and fragmentation: the share of the
+ * free memory that cannot be handed out as a single object once
+ * the threads are done.
+ */
+static void
+benchmark(void)
+{
+  int t, i, j;
+
+  for (t = 0; t < sizeof BENCH_THREADS / sizeof *BENCH_THREADS; t++)
+    {
+      int nthreads = BENCH_THREADS[t];
+      long failed = 0, nsamples = 0;
+      size_t live = 0;
+
+      mem_init(bench_memory, sizeof bench_memory);
+      memset(bench, 0, sizeof bench);
+
+      long long start = now_ns();
+      for (i = 0; i < nthreads; i++)
+        {
+          bench[i].seed = i + 1;
+          if (pthread_create(&bench[i].thread, NULL, bench_thread,
+                             &bench[i]) != 0)
+            {
+              printf("error creating pthread\n");
+              exit(-1);
+            }
+        }
+      for (i = 0; i < nthreads; i++)
+        pthread_join(bench[i].thread, NULL);
+      long long elapsed = now_ns() - start;
+
+      for (i = 0; i < nthreads; i++)
+        {
+          failed += bench[i].failed;
+          for (j = 0; j < bench[i].nsamples; j++)
+            bench_samples[nsamples++] = bench[i].samples[j];
+          for (j = 0; j < BENCH_SLOTS; j++)
+            if (bench[i].ptrs[j] != NULL)
+              live += bench[i].sizes[j];
+        }
+      qsort(bench_samples, nsamples, sizeof *bench_samples, compare_long);
+
+      size_t largest = largest_allocation();
+      size_t free_bytes = BENCH_MEMSIZE - live;
+
+      printf("Benchmark: %2d threads: %7.2f Mops/s, "
+             "latency p50 %4ld ns, p99 %6ld ns, max %8ld ns, "
+             "%ld failed, fragmentation %4.1f%%\n",
+             nthreads,
+             (double) nthreads * BENCH_OPS / elapsed * 1000.0,
+             bench_samples[nsamples / 2], bench_samples[nsamples * 99 / 100],
+             bench_samples[nsamples - 1], failed,
+             100.0 - 100.0 * largest / free_bytes);
+
+      /* Free everything from this thread, then check that the heap
+         coalesced back into a single block. */
+      for (i = 0; i < nthreads; i++)
+        for (j = 0; j < BENCH_SLOTS; j++)
+          if (bench[i].ptrs[j] != NULL)
+            mem_free(bench[i].ptrs[j]);
+      check_free_list_size();
+    }
+}
+
 /*
  * Main program.
  *
  * Initialize the memory allocator, then perform a single-threaded
- * and a multi-thread test.
+ * and a multi-thread test.  If invoked as "test_mem -b", then also
+ * run the benchmark.
  */
 int
 main(int ac, char *av[])
@@ -237,6 +421,9 @@ main(int ac, char *av[])
   ASSERT (leftfence == magic || !!!"Memory corruption");
   ASSERT (rightfence == magic || !!!"Memory corruption");
   printf("Test 4 (basic functionality) passed.\n");
+
+  if (ac > 1 && !strcmp(av[1], "-b"))
+    benchmark();
   return 0;
 }
 
@@ -0,0 +1,42 @@
+/* Child process of page-scan-mix.
+   Sweeps a 256 kB working set over and over until child-stream
+   has created "stream-done", checking that every page keeps the
+   value it was given, then sweeps it once more. */
+
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define PAGE_SIZE 4096
+#define PAGE_CNT 64
+static char buf[PAGE_CNT * PAGE_SIZE];
+
+static void
+sweep (int round)
+{
+  size_t i;
+
+  for (i = 0; i < PAGE_CNT; i++)
+    if (buf[i * PAGE_SIZE] != (char) i)
+      fail ("page %zu changed in round %d", i, round);
+}
+
+int
+main (void)
+{
+  size_t i;
+  int round = 0;
+  int fd;
+
+  test_name = "child-hot";
+
+  for (i = 0; i < PAGE_CNT; i++)
+    buf[i * PAGE_SIZE] = i;
+
+  while ((fd = open ("stream-done")) == -1)
+    sweep (round++);
+  close (fd);
+  sweep (round);
+
+  return 0x42;
+}
@@ -0,0 +1,32 @@
+/* Child process of page-scan-mix.
+   Writes each page of a 4 MB buffer once, front to back, then
+   reads them all back in the same order, then creates
+   "stream-done" to tell child-hot it is through.  At the default
+   4 MB of RAM the user pool is at most half of that. */
+
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define PAGE_SIZE 4096
+#define SIZE (4 * 1024 * 1024)
+static char buf[SIZE];
+
+int
+main (void)
+{
+  size_t i;
+
+  test_name = "child-stream";
+
+  for (i = 0; i < SIZE; i += PAGE_SIZE)
+    buf[i] = i / PAGE_SIZE;
+
+  for (i = 0; i < SIZE; i += PAGE_SIZE)
+    if (buf[i] != (char) (i / PAGE_SIZE))
+      fail ("page %zu lost its value", i / PAGE_SIZE);
+
+  if (!create ("stream-done", 0))
+    fail ("create \"stream-done\"");
+  return 0x42;
+}
@@ -0,0 +1,39 @@
+/* Forks a child that checks it sees the parent's data and then
+   overwrites all of it.  The array is shared copy-on-write, so
+   the child's writes must not show up in the parent's copy. */
+
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define SIZE (128 * 1024)
+
+static char buf[SIZE];
+
+void
+test_main (void)
+{
+  pid_t child;
+  size_t i;
+
+  for (i = 0; i < SIZE; i++)
+    buf[i] = i % 251;
+
+  child = fork ();
+  if (child == 0)
+    {
+      for (i = 0; i < SIZE; i++)
+        if (buf[i] != (char) (i % 251))
+          exit (1);
+      memset (buf, 0x5a, SIZE);
+      exit (0x42);
+    }
+  CHECK (child != -1, "fork");
+  CHECK (wait (child) == 0x42, "wait for child");
+
+  for (i = 0; i < SIZE; i++)
+    if (buf[i] != (char) (i % 251))
+      fail ("byte %zu changed to %d after child wrote it", i, buf[i]);
+  msg ("parent's copy intact");
+}
@@ -0,0 +1,23 @@
+/* Runs a process that keeps looping over a small working set
+   next to one that streams once through a buffer twice as big
+   as the largest user pool at the default 4 MB of RAM.  With the
+   default scan-resistant replacement policy the hot loop keeps
+   its pages resident: page-scan-mix.ck checks in the page fault
+   statistics printed at shutdown that child-hot took few more
+   faults than its first touch of each page. */
+
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+void
+test_main (void)
+{
+  pid_t hot, stream;
+
+  CHECK ((hot = exec ("child-hot")) != -1, "exec \"child-hot\"");
+  CHECK ((stream = exec ("child-stream")) != -1, "exec \"child-stream\"");
+
+  CHECK (wait (stream) == 0x42, "wait for child-stream");
+  CHECK (wait (hot) == 0x42, "wait for child-hot");
+}
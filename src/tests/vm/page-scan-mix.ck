@@ -0,0 +1,35 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+
+our ($test);
+my (@output) = read_text_file ("$test.output");
+
+common_checks ("run", @output);
+
+# The 4096 kB stream must be well above the user pool, which is at
+# most half of RAM.
+my ($ram_kb) = map (/booting with ([\d,]+) kB RAM/, @output);
+fail "RAM size not found in output\n" if !defined $ram_kb;
+$ram_kb =~ s/,//g;
+fail "child-stream doesn't outsize the user pool with $ram_kb kB RAM\n"
+  if $ram_kb > 4096;
+
+# child-hot touches its 64 hot pages once, plus a few code, data
+# and stack pages.  Each time the stream pushed the hot set out it
+# would fault on all 64 of them again.
+my ($faults) = map (/Exception: child-hot \(\d+\): (\d+) faults/, @output);
+fail "child-hot's page faults not found in output\n" if !defined $faults;
+fail "child-hot took $faults page faults, the stream evicted its hot set\n"
+  if $faults > 96;
+
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(page-scan-mix) begin
+(page-scan-mix) exec "child-hot"
+(page-scan-mix) exec "child-stream"
+(page-scan-mix) wait for child-stream
+(page-scan-mix) wait for child-hot
+(page-scan-mix) end
+EOF
+pass;
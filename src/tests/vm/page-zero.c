@@ -0,0 +1,31 @@
+/* Reads through a large BSS array that is never written, so its
+   pages can all map the shared zero page, then writes every
+   other page and checks that only those changed. */
+
+#include <string.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define SIZE (1024 * 1024)
+#define PAGE 4096
+
+static char buf[SIZE];
+
+void
+test_main (void)
+{
+  size_t i;
+
+  for (i = 0; i < SIZE; i++)
+    if (buf[i] != 0)
+      fail ("byte %zu is %d before any write", i, buf[i]);
+  msg ("read zeros");
+
+  for (i = 0; i < SIZE; i += 2 * PAGE)
+    memset (buf + i, 0x5a, PAGE);
+
+  for (i = 0; i < SIZE; i++)
+    if (buf[i] != ((i / PAGE) % 2 == 0 ? 0x5a : 0))
+      fail ("byte %zu is %d after writing", i, buf[i]);
+  msg ("written pages changed, others still zero");
+}
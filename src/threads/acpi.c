@@ -324,5 +324,5 @@ unmap_acpi_table (void *vaddr)
   uint32_t *pt = pde_get_pt (pd[pde_idx]);
   palloc_free_page (pt);
   pd[pde_idx] = 0;
-  lcr3 (vtop (init_page_dir));    /* Flush TLB */
+  flushtlb ();                    /* Flush TLB, global entries too */
 }
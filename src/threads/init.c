@@ -26,6 +26,7 @@
 #include "threads/loader.h"
 #include "threads/malloc.h"
 #include "threads/palloc.h"
+#include "threads/vmalloc.h"
 #include "threads/pte.h"
 #include "threads/thread.h"
 #include "threads/gdt.h"
@@ -38,6 +39,7 @@
 #include "userprog/exception.h"
 #include "userprog/syscall.h"
 #include "userprog/pagedir.h"
+#include "userprog/csbench.h"
 #include "vm/page.h"
 #else
 #include "tests/threads/tests.h"
@@ -55,6 +57,8 @@
 #include "lib/atomic-ops.h"
 #include "vm/frame.h"
 #include "vm/swap.h"
+#include "vm/zswap.h"
+#include "vm/prepage.h"
 /* Page directory with kernel mappings only. */
 uint32_t *init_page_dir;
 #ifdef FILESYS
@@ -122,10 +126,6 @@ main (void)
   /* Initialize threading system so we can use locks. */
   thread_init ();
 
-  #ifdef VM
-  init_spt();
-  #endif
-
   /* Initialize segmentation hardware. */
   gdt_init ();
   tss_init ();
@@ -186,6 +186,9 @@ main (void)
 
   init_ft();
   init_st();
+  ft_start_cleaner();
+  mmap_start_writeback();
+  wset_start();
 
   #endif
 
@@ -216,7 +219,9 @@ bss_init (void)
 /* Populates the base page directory and page table with the
    kernel virtual mapping, and then sets up the CPU to use the
    new page directory.  Points init_page_dir to the page
-   directory it creates. */
+   directory it creates.  RAM is mapped with 4 MB pages, except
+   for the 4 MB holding the kernel text, which is mapped
+   read-only with 4 kB pages, and a partial last 4 MB. */
 static void
 paging_init (void)
 {
@@ -236,6 +241,14 @@ paging_init (void)
 
       if (pd[pde_idx] == 0)
         {
+          char *end = vaddr + PTSPAN;
+          if (pte_idx == 0 && page + PTSPAN / PGSIZE <= init_ram_pages
+              && (end <= &_start || vaddr >= &_end_kernel_text))
+            {
+              pd[pde_idx] = pde_create_kernel_large (vaddr);
+              page += PTSPAN / PGSIZE - 1;
+              continue;
+            }
           pt = palloc_get_page (PAL_ASSERT | PAL_ZERO);
           pd[pde_idx] = pde_create_kernel (pt);
         }
@@ -244,8 +257,14 @@ paging_init (void)
     }
 
   pci_zone_init ();
+  vmalloc_init ();
   lapic_zone_init ();
+  lcr4 (rcr4 () | CR4_PSE);
   lcr3 (vtop (init_page_dir));
+
+  /* Kernel PTEs are global: keep them in the TLB across CR3
+     loads. */
+  lcr4 (rcr4 () | CR4_PGE);
 }
 
 /* initialize PCI zone at PCI_ADDR_ZONE_BEGIN - PCI_ADDR_ZONE_END*/
@@ -294,7 +313,9 @@ static void
 ap_main (void)
 {
   /* Initialize kernel page directory (shared among CPUs). */
+  lcr4 (rcr4 () | CR4_PSE);
   lcr3 (vtop (init_page_dir));
+  lcr4 (rcr4 () | CR4_PGE);
 
   /* Initialize this CPU's LAPIC. */
   lapic_init ();
@@ -475,7 +496,29 @@ parse_options (char **argv)
 #ifdef VM
       else if (!strcmp (name, "-swap"))
         swap_bdev_name = value;
+      else if (!strcmp (name, "-swappri"))
+        {
+          char *prio = value != NULL ? strchr (value, ':') : NULL;
+          if (prio == NULL)
+            PANIC ("-swappri needs BDEV:PRIORITY");
+          *prio++ = '\0';
+          if (!st_set_priority (value, atoi (prio)))
+            PANIC ("too many -swappri options");
+        }
+#endif
 #endif
+#ifdef VM
+      else if (!strcmp (name, "-vmpolicy"))
+        {
+          if (value == NULL || !ft_select_policy (value))
+            PANIC ("unknown replacement policy `%s'", value ? value : "");
+        }
+      else if (!strcmp (name, "-zswap"))
+        zswap_set_pool_pages (value != NULL ? atoi (value) : 0);
+      else if (!strcmp (name, "-faultaround"))
+        page_set_fault_around (value != NULL ? atoi (value) : 0);
+      else if (!strcmp (name, "-prepage"))
+        prepage_set_save (true);
 #endif
       else if (!strcmp (name, "-rs"))
         {
@@ -540,6 +583,9 @@ run_actions (char **argv)
   static const struct action actions[] = 
     {
       {"run", 2, run_task},
+#ifdef USERPROG
+      {"csbench", 1, csbench_run},
+#endif
 #ifdef FILESYS
       {"ls", 1, fsutil_ls},
       {"cat", 2, fsutil_cat},
@@ -585,6 +631,7 @@ usage (void)
           "\nAvailable actions:\n"
 #ifdef USERPROG
           "  run 'PROG [ARG...]' Run PROG and wait for it to complete.\n"
+          "  csbench            Measure kernel thread context switches.\n"
 #else
           "  run TEST           Run TEST.\n"
 #endif
@@ -606,7 +653,14 @@ usage (void)
           "  -scratch=BDEV      Use BDEV for scratch instead of default.\n"
 #ifdef VM
           "  -swap=BDEV         Use BDEV for swap instead of default.\n"
+          "  -swappri=BDEV:PRIO Swap to BDEV before lower priorities.\n"
+#endif
 #endif
+#ifdef VM
+          "  -vmpolicy=POLICY   Page replacement: 2q (default) or clock.\n"
+          "  -zswap=PAGES       Compressed swap cache size, 0 disables it.\n"
+          "  -faultaround=PAGES Fault-around window for code/mmap, 0 disables it.\n"
+          "  -prepage           Keep exec traces in .prepage across boots.\n"
 #endif
           "  -rs=SEED           Set random number seed to SEED.\n"
           "  -ul=COUNT          Limit user memory to COUNT pages.\n"
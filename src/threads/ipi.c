@@ -9,6 +9,7 @@
 #include "threads/synch.h"
 #include "lib/atomic-ops.h"
 #include "devices/shutdown.h"
+#include "threads/vmalloc.h"
 #ifdef USERPROG
 #include "userprog/pagedir.h"
 #endif
@@ -16,6 +17,7 @@
 static void ipi_debug (struct intr_frame *f UNUSED);
 static void ipi_schedule (struct intr_frame *f UNUSED);
 static void ipi_tlbflush (struct intr_frame *f UNUSED);
+static void ipi_tlbflush_all (struct intr_frame *f UNUSED);
 static void ipi_shutdown (struct intr_frame *f UNUSED);
 
 /* Register interrupt handlers for the inter-processor
@@ -27,6 +29,8 @@ ipi_init ()
                      "#IPI SHUTDOWN");
   intr_register_ipi (T_IPI + IPI_TLB, ipi_tlbflush,
                      "#IPI TLB");
+  intr_register_ipi (T_IPI + IPI_TLB_ALL, ipi_tlbflush_all,
+                     "#IPI TLB ALL");
   intr_register_ipi (T_IPI + IPI_DEBUG, ipi_debug,
                      "#IPI DEBUG");
   intr_register_ipi (T_IPI + IPI_SCHEDULE, ipi_schedule,
@@ -49,6 +53,13 @@ ipi_tlbflush (struct intr_frame *f UNUSED)
 #endif
 }
 
+/* Received a request to flush all kernel TLB entries. */
+static void
+ipi_tlbflush_all (struct intr_frame *f UNUSED)
+{
+  vmalloc_handle_tlbflush_request ();
+}
+
 /* Preempt the currently running thread */
 static void
 ipi_schedule (struct intr_frame *f UNUSED)
@@ -6,6 +6,8 @@
 #include <stdio.h>
 #include <string.h>
 #include "threads/palloc.h"
+#include "threads/vmalloc.h"
+#include "threads/memstat.h"
 #include "threads/synch.h"
 #include "threads/vaddr.h"
 
@@ -32,7 +34,14 @@
    because they're too big to fit in a single page with a
    descriptor.  We handle those by allocating contiguous pages
    with the page allocator and sticking the allocation size at
-   the beginning of the allocated block's arena header. */
+   the beginning of the allocated block's arena header.
+
+   malloc() always returns physically contiguous memory, so that
+   vtop() on a block gives a usable DMA address.  Callers that
+   never hand their block to a device can use malloc_virtual()
+   instead: if the kernel pool is too fragmented to supply that
+   many physically contiguous pages, such a block is obtained from
+   vmalloc(), which only needs them to be virtually contiguous. */
 
 /* Descriptor. */
 struct desc
@@ -41,6 +50,10 @@ struct desc
     size_t blocks_per_arena;    /* Number of blocks in an arena. */
     struct list free_list;      /* List of free blocks. */
     struct lock lock;           /* Lock. */
+#ifdef MEMSTAT
+    size_t arena_cnt;           /* Number of arenas. */
+    size_t free_cnt;            /* Number of blocks in FREE_LIST. */
+#endif
   };
 
 /* Magic number for detecting arena corruption. */
@@ -60,12 +73,25 @@ struct block
     struct list_elem free_elem; /* Free list element. */
   };
 
+#ifdef MEMSTAT
+/* With MEMSTAT, each block starts with a header that records
+   which subsystem allocated it, so that free() can credit it. */
+struct tag_header
+  {
+    size_t size;                /* Requested size in bytes. */
+    enum mem_tag tag;           /* Owner. */
+  };
+#endif
+
 /* Our set of descriptors. */
 static struct desc descs[10];   /* Descriptors. */
 static size_t desc_cnt;         /* Number of descriptors. */
 
 static struct arena *block_to_arena (struct block *);
 static struct block *arena_to_block (struct arena *, size_t idx);
+static void *alloc_block (size_t size, bool virtual);
+static void free_block (void *p);
+static size_t raw_block_size (void *block) UNUSED;
 
 /* Initializes the malloc() descriptors. */
 void
@@ -88,6 +114,80 @@ malloc_init (void)
    Returns a null pointer if memory is not available. */
 void *
 malloc (size_t size) 
+{
+#ifdef MEMSTAT
+  return malloc_tagged (size, MEM_MISC);
+#else
+  return alloc_block (size, false);
+#endif
+}
+
+#ifdef MEMSTAT
+/* Obtains a block of SIZE bytes charged to TAG, from vmalloc()
+   if VIRTUAL and physically contiguous pages are not available. */
+static void *
+alloc_tagged (size_t size, enum mem_tag tag, bool virtual)
+{
+  struct tag_header *h;
+
+  if (size == 0)
+    return NULL;
+
+  h = alloc_block (sizeof *h + size, virtual);
+  if (h == NULL)
+    return NULL;
+  h->size = size;
+  h->tag = tag;
+  memstat_block_alloc (tag, size);
+  return h + 1;
+}
+
+/* Like malloc(), but charges the block to TAG. */
+void *
+malloc_tagged (size_t size, enum mem_tag tag)
+{
+  return alloc_tagged (size, tag, false);
+}
+
+/* Like calloc(), but charges the block to TAG. */
+void *
+calloc_tagged (size_t a, size_t b, enum mem_tag tag)
+{
+  void *p;
+  size_t size;
+
+  /* Calculate block size and make sure it fits in size_t. */
+  size = a * b;
+  if (size < a || size < b)
+    return NULL;
+
+  /* Allocate and zero memory. */
+  p = malloc_tagged (size, tag);
+  if (p != NULL)
+    memset (p, 0, size);
+
+  return p;
+}
+#endif
+
+/* Like malloc(), but a block of more than one page may be only
+   virtually contiguous.  With MEMSTAT, charges the block to
+   TAG. */
+void *
+malloc_virtual (size_t size, enum mem_tag tag UNUSED)
+{
+#ifdef MEMSTAT
+  return alloc_tagged (size, tag, true);
+#else
+  return alloc_block (size, true);
+#endif
+}
+
+/* Obtains a block of at least SIZE bytes from the smallest
+   descriptor that fits, or from the page allocator.  If VIRTUAL,
+   a multi-page block may come from vmalloc() instead. */
+static void *
+alloc_block (size_t size, bool virtual)
 {
   struct desc *d;
   struct block *b;
@@ -107,7 +207,10 @@ malloc (size_t size)
       /* SIZE is too big for any descriptor.
          Allocate enough pages to hold SIZE plus an arena. */
       size_t page_cnt = DIV_ROUND_UP (size + sizeof *a, PGSIZE);
-      a = palloc_get_multiple (0, page_cnt);
+      a = page_cnt <= PALLOC_MAX_PAGES
+          ? palloc_get_multiple (PAL_TAG (MEM_MALLOC), page_cnt) : NULL;
+      if (a == NULL && page_cnt > 1 && virtual)
+        a = vmalloc (page_cnt);
       if (a == NULL)
         return NULL;
 
@@ -127,7 +230,7 @@ malloc (size_t size)
       size_t i;
 
       /* Allocate a page. */
-      a = palloc_get_page (0);
+      a = palloc_get_page (PAL_TAG (MEM_MALLOC));
       if (a == NULL) 
         {
           lock_release (&d->lock);
@@ -143,12 +246,19 @@ malloc (size_t size)
           struct block *b = arena_to_block (a, i);
           list_push_back (&d->free_list, &b->free_elem);
         }
+#ifdef MEMSTAT
+      d->arena_cnt++;
+      d->free_cnt += d->blocks_per_arena;
+#endif
     }
 
   /* Get a block from free list and return it. */
   b = list_entry (list_pop_front (&d->free_list), struct block, free_elem);
   a = block_to_arena (b);
   a->free_cnt--;
+#ifdef MEMSTAT
+  d->free_cnt--;
+#endif
   lock_release (&d->lock);
   return b;
 }
@@ -177,6 +287,17 @@ calloc (size_t a, size_t b)
 /* Returns the number of bytes allocated for BLOCK. */
 static size_t
 block_size (void *block) 
+{
+#ifdef MEMSTAT
+  return ((struct tag_header *) block)[-1].size;
+#else
+  return raw_block_size (block);
+#endif
+}
+
+/* Returns the number of bytes in the underlying block BLOCK. */
+static size_t
+raw_block_size (void *block) 
 {
   struct block *b = block;
   struct arena *a = block_to_arena (b);
@@ -217,6 +338,21 @@ realloc (void *old_block, size_t new_size)
    malloc(), calloc(), or realloc(). */
 void
 free (void *p) 
+{
+#ifdef MEMSTAT
+  if (p != NULL)
+    {
+      struct tag_header *h = (struct tag_header *) p - 1;
+      memstat_block_free (h->tag, h->size);
+      p = h;
+    }
+#endif
+  free_block (p);
+}
+
+/* Returns block P to its descriptor or to the page allocator. */
+static void
+free_block (void *p) 
 {
   if (p != NULL)
     {
@@ -237,6 +373,9 @@ free (void *p)
 
           /* Add block to free list. */
           list_push_front (&d->free_list, &b->free_elem);
+#ifdef MEMSTAT
+          d->free_cnt++;
+#endif
 
           /* If the arena is now entirely unused, free it. */
           if (++a->free_cnt >= d->blocks_per_arena) 
@@ -250,6 +389,10 @@ free (void *p)
                   list_remove (&b->free_elem);
                 }
               palloc_free_page (a);
+#ifdef MEMSTAT
+              d->arena_cnt--;
+              d->free_cnt -= d->blocks_per_arena;
+#endif
             }
 
           lock_release (&d->lock);
@@ -257,12 +400,42 @@ free (void *p)
       else
         {
           /* It's a big block.  Free its pages. */
-          palloc_free_multiple (a, a->free_cnt);
+          if (vmalloc_owns (a))
+            vfree (a);
+          else
+            palloc_free_multiple (a, a->free_cnt);
           return;
         }
     }
 }
 
+#ifdef MEMSTAT
+/* Prints, for each descriptor, how many arenas it holds and how
+   well their blocks are used. */
+void
+malloc_print_stats (void)
+{
+  struct desc *d;
+
+  for (d = descs; d < descs + desc_cnt; d++)
+    {
+      size_t total, used;
+
+      lock_acquire (&d->lock);
+      total = d->arena_cnt * d->blocks_per_arena;
+      used = total - d->free_cnt;
+      lock_release (&d->lock);
+
+      if (d->arena_cnt == 0)
+        continue;
+      printf ("Malloc: %4zu-byte blocks: %zu arenas, %zu/%zu blocks used "
+              "(%zu%% of arena space)\n",
+              d->block_size, d->arena_cnt, used, total,
+              used * d->block_size * 100 / (d->arena_cnt * PGSIZE));
+    }
+}
+#endif
+
 /* Returns the arena that block B is inside. */
 static struct arena *
 block_to_arena (struct block *b)
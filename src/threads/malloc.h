@@ -3,11 +3,32 @@
 
 #include <debug.h>
 #include <stddef.h>
+#include "threads/memstat.h"
 
 void malloc_init (void);
+
+/* malloc() and friends return physically contiguous memory, so
+   vtop() of a block is a valid DMA address for the whole block. */
 void *malloc (size_t) __attribute__ ((malloc));
 void *calloc (size_t, size_t) __attribute__ ((malloc));
 void *realloc (void *, size_t);
 void free (void *);
 
+/* Like malloc(), but a block larger than a page may be mapped
+   from scattered physical pages by vmalloc(), so it must never
+   be passed to a device.  With MEMSTAT, charges it to the given
+   tag. */
+void *malloc_virtual (size_t, enum mem_tag) __attribute__ ((malloc));
+
+/* Like malloc() and calloc(), but charge the block to a memory
+   accounting tag (see memstat.h). */
+#ifdef MEMSTAT
+void *malloc_tagged (size_t, enum mem_tag) __attribute__ ((malloc));
+void *calloc_tagged (size_t, size_t, enum mem_tag) __attribute__ ((malloc));
+void malloc_print_stats (void);
+#else
+#define malloc_tagged(SIZE, TAG) malloc (SIZE)
+#define calloc_tagged(A, B, TAG) calloc (A, B)
+#endif
+
 #endif /* threads/malloc.h */
@@ -0,0 +1,126 @@
+#include "threads/memstat.h"
+#include <debug.h>
+#include <stdio.h>
+#include "threads/cpu.h"
+#include "threads/malloc.h"
+#include "threads/palloc.h"
+#include "threads/spinlock.h"
+
+/* See memstat.h.  This file is only built into kernels compiled
+   with MEMSTAT defined. */
+#ifdef MEMSTAT
+
+/* Names of the tags, indexed by enum mem_tag. */
+static const char *tag_names[MEM_TAG_CNT] =
+  {
+    "misc", "thread", "pagetable", "malloc", "vmalloc", "user", "process",
+    "spt", "frame", "mmap", "swap", "inode", "file", "buffer",
+  };
+
+/* Per-tag counters, in pages and in bytes. */
+static struct memstat page_stats[MEM_TAG_CNT];
+static struct memstat byte_stats[MEM_TAG_CNT];
+static struct spinlock memstat_lock;
+
+/* Initializes memory accounting.  Called by palloc_init(), before
+   the first page is handed out. */
+void
+memstat_init (void)
+{
+  spinlock_init (&memstat_lock);
+}
+
+static void
+charge (struct memstat *s, size_t amount)
+{
+  if (cpu_can_acquire_spinlock)
+    spinlock_acquire (&memstat_lock);
+  s->cur += amount;
+  s->cnt++;
+  if (s->cur > s->peak)
+    s->peak = s->cur;
+  if (cpu_can_acquire_spinlock)
+    spinlock_release (&memstat_lock);
+}
+
+static void
+credit (struct memstat *s, size_t amount)
+{
+  if (cpu_can_acquire_spinlock)
+    spinlock_acquire (&memstat_lock);
+  ASSERT (s->cur >= amount);
+  s->cur -= amount;
+  if (cpu_can_acquire_spinlock)
+    spinlock_release (&memstat_lock);
+}
+
+/* Records that PAGE_CNT pages were allocated for TAG. */
+void
+memstat_page_alloc (enum mem_tag tag, size_t page_cnt)
+{
+  ASSERT (tag < MEM_TAG_CNT);
+  charge (&page_stats[tag], page_cnt);
+}
+
+/* Records that PAGE_CNT pages held by TAG were freed. */
+void
+memstat_page_free (enum mem_tag tag, size_t page_cnt)
+{
+  ASSERT (tag < MEM_TAG_CNT);
+  credit (&page_stats[tag], page_cnt);
+}
+
+/* Records that a BYTES-byte block was allocated for TAG. */
+void
+memstat_block_alloc (enum mem_tag tag, size_t bytes)
+{
+  ASSERT (tag < MEM_TAG_CNT);
+  charge (&byte_stats[tag], bytes);
+}
+
+/* Records that a BYTES-byte block held by TAG was freed. */
+void
+memstat_block_free (enum mem_tag tag, size_t bytes)
+{
+  ASSERT (tag < MEM_TAG_CNT);
+  credit (&byte_stats[tag], bytes);
+}
+
+/* Copies the current page and byte counters for TAG into *PAGES
+   and *BYTES.  Either may be null. */
+void
+memstat_get (enum mem_tag tag, struct memstat *pages, struct memstat *bytes)
+{
+  ASSERT (tag < MEM_TAG_CNT);
+  if (cpu_can_acquire_spinlock)
+    spinlock_acquire (&memstat_lock);
+  if (pages != NULL)
+    *pages = page_stats[tag];
+  if (bytes != NULL)
+    *bytes = byte_stats[tag];
+  if (cpu_can_acquire_spinlock)
+    spinlock_release (&memstat_lock);
+}
+
+/* Prints the per-tag counters, followed by malloc()'s
+   per-descriptor fragmentation statistics. */
+void
+memstat_print (void)
+{
+  enum mem_tag tag;
+
+  printf ("Memory: %-9s %8s %8s %10s %10s %10s %10s\n", "tag",
+          "pages", "peak", "palloc", "bytes", "peak", "malloc");
+  for (tag = 0; tag < MEM_TAG_CNT; tag++)
+    {
+      struct memstat pages, bytes;
+      memstat_get (tag, &pages, &bytes);
+      if (pages.cnt == 0 && bytes.cnt == 0)
+        continue;
+      printf ("Memory: %-9s %8zu %8zu %10llu %10zu %10zu %10llu\n",
+              tag_names[tag], pages.cur, pages.peak, pages.cnt,
+              bytes.cur, bytes.peak, bytes.cnt);
+    }
+  malloc_print_stats ();
+}
+#endif /* MEMSTAT */
@@ -0,0 +1,59 @@
+#ifndef THREADS_MEMSTAT_H
+#define THREADS_MEMSTAT_H
+
+#include <stddef.h>
+
+/* Kernel memory accounting.
+
+   Pages obtained from palloc and blocks obtained from malloc can
+   be tagged with the subsystem that owns them.  For each tag we
+   keep the amount currently allocated, its peak, and the number
+   of allocations made.  The totals are printed at shutdown and
+   can be read at any time with memstat_get() or memstat_print().
+
+   Accounting is compiled in only if MEMSTAT is defined, e.g. by
+   adding -DMEMSTAT to DEFINES in Make.vars.  Otherwise the tags
+   are accepted and ignored, and none of this costs anything. */
+
+/* Allocation tags. */
+enum mem_tag
+  {
+    MEM_MISC,                   /* Untagged allocations. */
+    MEM_THREAD,                 /* Thread structures and kernel stacks. */
+    MEM_PAGETABLE,              /* Page directories and page tables. */
+    MEM_MALLOC,                 /* malloc() arenas and big blocks. */
+    MEM_VMALLOC,                /* vmalloc() pages. */
+    MEM_USER,                   /* User pool frames. */
+    MEM_PROCESS,                /* Process bookkeeping, fd tables. */
+    MEM_SPT,                    /* Supplemental page table entries. */
+    MEM_FRAME,                  /* Frame table descriptors. */
+    MEM_MMAP,                   /* Memory-mapped file descriptors. */
+    MEM_SWAP,                   /* Swap table. */
+    MEM_INODE,                  /* In-memory inodes. */
+    MEM_FILE,                   /* Open files and directories. */
+    MEM_BUFFER,                 /* Temporary I/O buffers. */
+    MEM_TAG_CNT                 /* Number of tags. */
+  };
+
+/* Counters for one tag. */
+struct memstat
+  {
+    size_t cur;                 /* Currently allocated. */
+    size_t peak;                /* Largest value of CUR so far. */
+    unsigned long long cnt;     /* Number of allocations. */
+  };
+
+#ifdef MEMSTAT
+void memstat_init (void);
+void memstat_page_alloc (enum mem_tag, size_t page_cnt);
+void memstat_page_free (enum mem_tag, size_t page_cnt);
+void memstat_block_alloc (enum mem_tag, size_t bytes);
+void memstat_block_free (enum mem_tag, size_t bytes);
+void memstat_get (enum mem_tag, struct memstat *pages, struct memstat *bytes);
+void memstat_print (void);
+#else
+static inline void memstat_init (void) { }
+static inline void memstat_print (void) { }
+#endif
+
+#endif /* threads/memstat.h */
@@ -32,8 +32,19 @@
    2MB of physical memory.  A 512-bit (64 byte) bitmap represents each.
    The upper level consists of a root bitmap of size 512.
    This design supports up to 1 GB of memory, or 256k pages.
+
+   Each pool also keeps a small reserve of pages that have already
+   been allocated from its bitmap and filled with zeros.  The idle
+   thread tops this reserve up via palloc_prezero_page() whenever
+   its CPU has nothing better to do, so that single-page PAL_ZERO
+   requests (thread pages, page tables, ...) do not have to clear
+   4 kB inline.  Pages in the reserve remain available to any
+   request that cannot otherwise be satisfied.
  */
-#define L2_PAGES    512
+#define L2_PAGES    PALLOC_MAX_PAGES
+
+/* Number of pre-zeroed pages each pool tries to keep on hand. */
+#define ZERO_RESERVE_PAGES 32
 struct map_entry
   {
     /* space in which to allocate a struct bitmap, followed by the
@@ -50,6 +61,14 @@ struct pool
                  The second level bitmap array follows directly at used_map+1, +2, ...  */
     uint8_t *base;                      /* Base of pool - address of first usable page. */
     uint8_t *end;                       /* End of pool - address after last usable page. */
+
+    void *zeroed[ZERO_RESERVE_PAGES];   /* Pre-zeroed pages, already marked used. */
+    size_t zeroed_cnt;                  /* Number of pages in zeroed[]. */
+    unsigned long long zero_hits;       /* PAL_ZERO requests served from zeroed[]. */
+    unsigned long long zero_misses;     /* PAL_ZERO requests zeroed inline. */
+#ifdef MEMSTAT
+    uint8_t *tags;                      /* Tag of each allocated run, by page. */
+#endif
   };
 
 /* Two pools: one for kernel data, one for user pages. */
@@ -58,6 +77,9 @@ static struct pool kernel_pool, user_pool;
 static void init_pool (struct pool *, void *base, size_t page_cnt,
                        const char *name);
 static bool page_from_pool (const struct pool *, void *page);
+static void *scan_pool (struct pool *, size_t page_cnt);
+static void release_to_pool (struct pool *, void *pages, size_t page_cnt);
+static bool prezero_pool (struct pool *);
 
 /* Our current policy is as follows.
  * We devote a fraction of USER_PERCENT of the memory to the user pool,
@@ -103,10 +125,12 @@ palloc_init (size_t user_page_limit, size_t user_percent)
   size_t free_pages;
   size_t kernel_pages;
 
+  memstat_init ();
+
   free_end = ptov (init_ram_pages * PGSIZE);
-  /* Memory above this address is used for PCI. */
-  if (free_end > (uint8_t *)PCI_ADDR_ZONE_BEGIN)
-    free_end = (uint8_t *)PCI_ADDR_ZONE_BEGIN;
+  /* Memory above this address is used for vmalloc() and PCI. */
+  if (free_end > (uint8_t *)VMALLOC_ZONE_BEGIN)
+    free_end = (uint8_t *)VMALLOC_ZONE_BEGIN;
 
   free_pages = (free_end - free_start) / PGSIZE;
 
@@ -128,6 +152,9 @@ palloc_init (size_t user_page_limit, size_t user_percent)
    available, returns a null pointer, unless PAL_ASSERT is set in
    FLAGS, in which case the kernel panics.
 
+   Single-page PAL_ZERO requests are served from the pool's
+   reserve of pre-zeroed pages when it is not empty.
+
    Using a two-level design, we look through all 512-page blocks
    that have at least one page available until we find one that
    has a large enough number of contiguous pages.
@@ -143,7 +170,7 @@ palloc_get_multiple (enum palloc_flags flags, size_t page_cnt)
 {
   struct pool *pool = flags & PAL_USER ? &user_pool : &kernel_pool;
   void *pages = NULL;
-  size_t page_idx;
+  bool zeroed = false;
 
   if (page_cnt == 0)
     return NULL;
@@ -155,24 +182,25 @@ palloc_get_multiple (enum palloc_flags flags, size_t page_cnt)
   if (cpu_can_acquire_spinlock)
     spinlock_acquire (&pool->lock);
 
-  struct bitmap *root_map = AS_BITMAP (pool->used_map);
-  for (size_t start = 0;
-       start < bitmap_size(root_map);
-       start = page_idx + 1)
+  /* Single zeroed pages come from the reserve first. */
+  if (page_cnt == 1 && (flags & PAL_ZERO) && pool->zeroed_cnt > 0)
     {
-      page_idx = bitmap_scan (root_map, start, 1, false);
-      if (page_idx == BITMAP_ERROR)
-        break;
+      pages = pool->zeroed[--pool->zeroed_cnt];
+      zeroed = true;
+      pool->zero_hits++;
+    }
+  else
+    {
+      pages = scan_pool (pool, page_cnt);
 
-      struct bitmap *l2map = AS_BITMAP (&pool->used_map[1 + page_idx]);
-      size_t l2idx = bitmap_scan_and_flip (l2map, 0, page_cnt, false);
-      if (l2idx != BITMAP_ERROR)
+      /* Fall back on the reserve rather than failing. */
+      if (pages == NULL && page_cnt == 1 && pool->zeroed_cnt > 0)
         {
-          if (bitmap_all (l2map, 0, bitmap_size (l2map)))
-            bitmap_set (root_map, page_idx, true);
-          pages = pool->base + PGSIZE * (page_idx * L2_PAGES + l2idx);
-          break;
+          pages = pool->zeroed[--pool->zeroed_cnt];
+          zeroed = true;
         }
+      if (!zeroed && (flags & PAL_ZERO))
+        pool->zero_misses++;
     }
 
   if (cpu_can_acquire_spinlock)
@@ -180,8 +208,12 @@ palloc_get_multiple (enum palloc_flags flags, size_t page_cnt)
 
   if (pages != NULL) 
     {
-      if (flags & PAL_ZERO)
+      if ((flags & PAL_ZERO) && !zeroed)
         memset (pages, 0, PGSIZE * page_cnt);
+#ifdef MEMSTAT
+      pool->tags[pg_no (pages) - pg_no (pool->base)] = PAL_TAG_OF (flags);
+      memstat_page_alloc (PAL_TAG_OF (flags), page_cnt);
+#endif
     }
   else 
     {
@@ -210,7 +242,6 @@ void
 palloc_free_multiple (void *pages, size_t page_cnt) 
 {
   struct pool *pool;
-  size_t page_idx;
 
   ASSERT (pg_ofs (pages) == 0);
   if (pages == NULL || page_cnt == 0)
@@ -226,16 +257,13 @@ palloc_free_multiple (void *pages, size_t page_cnt)
 #ifndef NDEBUG
   memset (pages, 0xcc, PGSIZE * page_cnt);
 #endif
+#ifdef MEMSTAT
+  memstat_page_free (pool->tags[pg_no (pages) - pg_no (pool->base)], page_cnt);
+#endif
 
-  page_idx = pg_no (pages) - pg_no (pool->base);
-  struct bitmap *l2map = AS_BITMAP (&pool->used_map[1 + page_idx/L2_PAGES]);
   if (cpu_can_acquire_spinlock)
     spinlock_acquire (&pool->lock);
-
-  ASSERT (bitmap_all (l2map, page_idx % L2_PAGES, page_cnt));
-  bitmap_set_multiple (l2map, page_idx % L2_PAGES, page_cnt, false);
-  bitmap_reset (AS_BITMAP (pool->used_map), page_idx/L2_PAGES);
-
+  release_to_pool (pool, pages, page_cnt);
   if (cpu_can_acquire_spinlock)
     spinlock_release (&pool->lock);
 }
@@ -247,6 +275,98 @@ palloc_free_page (void *page)
   palloc_free_multiple (page, 1);
 }
 
+/* Zeroes one page ahead of demand for a pool whose reserve of
+   pre-zeroed pages is not full.  Called by the idle thread with
+   interrupts enabled.  Returns true if a page was zeroed, false
+   if every reserve is already full (or memory is exhausted). */
+bool
+palloc_prezero_page (void)
+{
+  if (!cpu_can_acquire_spinlock)
+    return false;
+
+  return prezero_pool (&kernel_pool) || prezero_pool (&user_pool);
+}
+
+/* Prints statistics about the pre-zeroed page reserves. */
+void
+palloc_print_stats (void)
+{
+  printf ("Zeroed pages: kernel %llu reserved, %llu inline; "
+          "user %llu reserved, %llu inline\n",
+          kernel_pool.zero_hits, kernel_pool.zero_misses,
+          user_pool.zero_hits, user_pool.zero_misses);
+}
+
+/* Adds one freshly zeroed page to POOL's reserve, if it has room
+   for it.  The page is taken from the bitmap and cleared outside
+   the pool lock, so that other CPUs can keep allocating. */
+static bool
+prezero_pool (struct pool *pool)
+{
+  void *page;
+
+  spinlock_acquire (&pool->lock);
+  page = pool->zeroed_cnt < ZERO_RESERVE_PAGES ? scan_pool (pool, 1) : NULL;
+  spinlock_release (&pool->lock);
+  if (page == NULL)
+    return false;
+
+  memset (page, 0, PGSIZE);
+
+  spinlock_acquire (&pool->lock);
+  if (pool->zeroed_cnt < ZERO_RESERVE_PAGES)
+    pool->zeroed[pool->zeroed_cnt++] = page;
+  else
+    release_to_pool (pool, page, 1);
+  spinlock_release (&pool->lock);
+  return true;
+}
+
+/* Finds PAGE_CNT contiguous free pages in POOL's bitmaps, marks
+   them used, and returns the first one, or a null pointer if
+   there is no such run.  POOL's lock must be held, if locking is
+   possible yet. */
+static void *
+scan_pool (struct pool *pool, size_t page_cnt)
+{
+  size_t page_idx;
+  struct bitmap *root_map = AS_BITMAP (pool->used_map);
+
+  for (size_t start = 0;
+       start < bitmap_size(root_map);
+       start = page_idx + 1)
+    {
+      page_idx = bitmap_scan (root_map, start, 1, false);
+      if (page_idx == BITMAP_ERROR)
+        break;
+
+      struct bitmap *l2map = AS_BITMAP (&pool->used_map[1 + page_idx]);
+      size_t l2idx = bitmap_scan_and_flip (l2map, 0, page_cnt, false);
+      if (l2idx != BITMAP_ERROR)
+        {
+          if (bitmap_all (l2map, 0, bitmap_size (l2map)))
+            bitmap_set (root_map, page_idx, true);
+          return pool->base + PGSIZE * (page_idx * L2_PAGES + l2idx);
+        }
+    }
+  return NULL;
+}
+
+/* Marks the PAGE_CNT pages starting at PAGES free in POOL's
+   bitmaps.  POOL's lock must be held, if locking is possible
+   yet. */
+static void
+release_to_pool (struct pool *pool, void *pages, size_t page_cnt)
+{
+  size_t page_idx = pg_no (pages) - pg_no (pool->base);
+  struct bitmap *l2map = AS_BITMAP (&pool->used_map[1 + page_idx/L2_PAGES]);
+
+  ASSERT (bitmap_all (l2map, page_idx % L2_PAGES, page_cnt));
+  bitmap_set_multiple (l2map, page_idx % L2_PAGES, page_cnt, false);
+  bitmap_reset (AS_BITMAP (pool->used_map), page_idx/L2_PAGES);
+}
+
 /* Initializes pool P as starting at START and comprising PAGE_CNT
    pages, naming it NAME for debugging purposes. */
 static void
@@ -257,12 +377,16 @@ init_pool (struct pool *p, void *base, size_t page_cnt, const char *name)
   /* Compute the amount of memory needed for the bitmaps.  This slightly
    * overallocates space since only needs bits for the remainder left. */
   size_t bm_space = (DIV_ROUND_UP (page_cnt, L2_PAGES) + 1) * sizeof (struct map_entry);
+#ifdef MEMSTAT
+  bm_space += page_cnt;         /* One tag byte per page. */
+#endif
   size_t bm_pages = DIV_ROUND_UP (bm_space, PGSIZE);
   if (bm_pages > page_cnt)
     PANIC ("Not enough memory in %s for bitmap.", name);
   page_cnt -= bm_pages;
 
   spinlock_init (&p->lock);
+  p->zeroed_cnt = 0;
   size_t MAP_ENTRY_SIZE = sizeof (p->used_map->bitmap);
   p->used_map = (struct map_entry *)base;   // root-level map entry
   size_t blocks = DIV_ROUND_UP (page_cnt, 512);
@@ -279,8 +403,13 @@ init_pool (struct pool *p, void *base, size_t page_cnt, const char *name)
   if (page_cnt % 512 != 0)
     bitmap_create_in_buf (page_cnt % 512, l2map + page_cnt/512, MAP_ENTRY_SIZE);
 
-  p->base = (void *) ROUND_UP((uintptr_t) &l2map[DIV_ROUND_UP(page_cnt, 512)],
-                              PGSIZE);
+  uint8_t *maps_end = (uint8_t *) &l2map[DIV_ROUND_UP(page_cnt, 512)];
+#ifdef MEMSTAT
+  p->tags = maps_end;
+  memset (p->tags, MEM_MISC, page_cnt);
+  maps_end += page_cnt;
+#endif
+  p->base = (void *) ROUND_UP((uintptr_t) maps_end, PGSIZE);
 }
 
 /* Returns true if PAGE was allocated from POOL,
@@ -1,7 +1,9 @@
 #ifndef THREADS_PALLOC_H
 #define THREADS_PALLOC_H
 
+#include <stdbool.h>
 #include <stddef.h>
+#include "threads/memstat.h"
 
 /* How to allocate pages. */
 enum palloc_flags
@@ -12,10 +14,22 @@ enum palloc_flags
     PAL_NOCACHE = 0x8           /* Disable memory caching for page. */
   };
 
+/* Charges the pages to memory accounting tag TAG (see memstat.h).
+   Combine with the flags above, e.g. PAL_ZERO | PAL_TAG (MEM_THREAD).
+   Untagged pages are charged to MEM_MISC. */
+#define PAL_TAG(TAG) ((TAG) << 8)
+#define PAL_TAG_OF(FLAGS) ((enum mem_tag) (((FLAGS) >> 8) & 0xff))
+
+/* Largest number of contiguous pages palloc_get_multiple() can
+   hand out. */
+#define PALLOC_MAX_PAGES 512
+
 void palloc_init (size_t user_page_limit, size_t user_percent);
 void *palloc_get_page (enum palloc_flags);
 void *palloc_get_multiple (enum palloc_flags, size_t page_cnt);
 void palloc_free_page (void *);
 void palloc_free_multiple (void *, size_t page_cnt);
+bool palloc_prezero_page (void);
+void palloc_print_stats (void);
 
 #endif /* threads/palloc.h */
@@ -22,6 +22,7 @@
 #define PTBITS  10                         /* Number of page table bits. */
 #define PTSPAN  (1 << PTBITS << PGBITS)    /* Bytes covered by a page table. */
 #define PTMASK  BITMASK(PTSHIFT, PTBITS)   /* Page table bits (12:21). */
+#define LPGMASK BITMASK(0, PTSHIFT + PTBITS) /* Offset in a 4 MB page. */
 
 /* Page directory index (bits 22:31). */
 #define PDSHIFT (PTSHIFT + PTBITS)         /* First page directory bit. */
@@ -33,6 +34,11 @@
 #define PCI_ADDR_ZONE_END       0xfe000000
 #define PCI_ADDR_ZONE_PAGES     (PCI_ADDR_ZONE_END-PCI_ADDR_ZONE_BEGIN)/PGSIZE
 #define PCI_ADDR_ZONE_PDES      ((PCI_ADDR_ZONE_PAGES)/1024)
+/* kernel virtual addresses for vmalloc() - 4MB aligned, just below PCI */
+#define VMALLOC_ZONE_BEGIN      0xfb800000
+#define VMALLOC_ZONE_END        PCI_ADDR_ZONE_BEGIN
+#define VMALLOC_ZONE_PAGES      ((VMALLOC_ZONE_END-VMALLOC_ZONE_BEGIN)/PGSIZE)
+#define VMALLOC_ZONE_PDES       ((VMALLOC_ZONE_PAGES)/1024)
 #define APIC_ZONE_PDES          8192
 #define APIC_ZONE_BEGIN         0xfe000000
 
@@ -78,8 +84,13 @@ static inline uintptr_t pd_no (const void *va) {
 #define PTE_CD (1 << 4)         /* 1=cache disabled, 0=cache enabled. */
 #define PTE_A 0x20              /* 1=accessed, 0=not acccessed. */
 #define PTE_D 0x40              /* 1=dirty, 0=not dirty (PTEs only). */
+#define PTE_PS (1 << 7)         /* 1=4 MB page (PDEs only, CR4_PSE). */
 #define PTE_G (1 << 8)          /* 1=global page, do not flush */
 
+/* A PDE with PTE_PS set maps a 4 MB page directly: bits 31:22
+   hold its physical address and PTE_D is valid, as in a PTE.
+   There is no page table. */
+
 /* Returns a PDE that points to page table PT. */
 static inline uint32_t pde_create_user (uint32_t *pt) {
   ASSERT (pg_ofs (pt) == 0);
@@ -92,13 +103,36 @@ static inline uint32_t pde_create_kernel (uint32_t *pt) {
   return vtop (pt) | PTE_P | PTE_W | PTE_G;
 }
 
+/* Returns a PDE that maps the 4 MB page at kernel virtual
+   address PAGE for the kernel, read/write. */
+static inline uint32_t pde_create_kernel_large (void *page) {
+  ASSERT (((uintptr_t) page & LPGMASK) == 0);
+  return vtop (page) | PTE_P | PTE_W | PTE_PS | PTE_G;
+}
+
+/* Returns a PDE that maps the 4 MB page at kernel virtual
+   address PAGE for user and kernel code, writable if
+   WRITABLE. */
+static inline uint32_t pde_create_user_large (void *page, bool writable) {
+  ASSERT (((uintptr_t) page & LPGMASK) == 0);
+  return vtop (page) | PTE_P | (writable ? PTE_W : 0) | PTE_U | PTE_PS;
+}
+
 /* Returns a pointer to the page table that page directory entry
    PDE points to.  The page table must be allocated + present. */
 static inline uint32_t *pde_get_pt (uint32_t pde) {
   ASSERT (pde & PTE_P);
+  ASSERT (!(pde & PTE_PS));
   return ptov (pde & PTE_ADDR);
 }
 
+/* Returns the 4 MB page that PDE, which must have PTE_PS set,
+   maps. */
+static inline void *pde_get_large_page (uint32_t pde) {
+  ASSERT (pde & PTE_PS);
+  return ptov (pde & ~LPGMASK);
+}
+
 /* Returns a PTE that points to PAGE.
    The PTE's page is readable.
    If WRITABLE is true then it will be writable as well.
@@ -238,7 +238,7 @@ do_thread_create (const char *name, int nice, thread_func *function, void *aux)
     ASSERT (function != NULL);
 
     /* Allocate thread. */
-    t = palloc_get_page (PAL_ZERO);
+    t = palloc_get_page (PAL_ZERO | PAL_TAG (MEM_THREAD));
     if (t == NULL)
       return NULL;
 
@@ -570,6 +570,15 @@ idle (void *idle_started_ UNUSED)
       sched_load_balance();
       thread_block(NULL);
 
+      /* Nothing to run: spend the time zeroing pages ahead of
+         PAL_ZERO requests.  Interrupts stay enabled while we do
+         so, and we go around again instead of halting so that a
+         thread that became ready in the meantime gets to run. */
+      intr_enable ();
+      if (palloc_prezero_page ())
+        continue;
+      intr_disable ();
+
       /* Re-enable interrupts and wait for the next one.
 
          The `sti' instruction disables interrupts until the
@@ -116,6 +116,7 @@ struct thread
   struct list ps_list; // list of processes
   struct file **fd_table; /* file descriptor table */
   void * esp;
+  struct tlb_batch *tlb_batch; /* Deferred TLB invalidations, or NULL. */
 #endif
 
 #ifdef VM
@@ -139,6 +140,7 @@ struct process // struct to manage parent/child threads in process.c
    tid_t child_tid; // thread id of child
    char * user_prog_name; // program name
    struct file * exe_file; // keep exe around until exit
+   uint64_t exec_tsc; // TSC at exec, 0 once the first output is written
 };
 #endif
 
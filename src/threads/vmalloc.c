@@ -0,0 +1,268 @@
+#include "threads/vmalloc.h"
+#include <bitmap.h>
+#include <debug.h>
+#include <round.h>
+#include <stdint.h>
+#include <string.h>
+#include "threads/init.h"
+#include "threads/palloc.h"
+#include "threads/pte.h"
+#include "threads/synch.h"
+#include "threads/cpu.h"
+#include "threads/interrupt.h"
+#include "threads/vaddr.h"
+#include "devices/lapic.h"
+#include "lib/kernel/x86.h"
+#include "lib/atomic-ops.h"
+
+/* Virtually contiguous kernel allocator.
+
+   palloc_get_multiple() can only satisfy a request for N pages
+   if N physically contiguous pages are free in one 2 MB block,
+   which becomes unlikely once the kernel pool is fragmented.
+   vmalloc() instead takes N arbitrary pages from the kernel pool
+   and maps them at consecutive addresses in a kernel virtual
+   range reserved for this purpose, VMALLOC_ZONE_BEGIN through
+   VMALLOC_ZONE_END.
+
+   The page tables for the zone are allocated once, at boot, and
+   installed in init_page_dir.  Since every page directory starts
+   as a copy of init_page_dir, all address spaces share them and
+   see the same mappings without any further work.
+
+   Each allocation is followed by an unmapped guard page.  This
+   catches overruns and also tells vfree() where an allocation
+   ends, so no size needs to be stored.
+
+   Mapping a page never requires a TLB flush, because the CPU
+   does not cache not-present entries.  Unmapping does: other
+   CPUs may still hold translations for the freed range.  Rather
+   than interrupting every CPU on each vfree(), freed addresses
+   are parked as "stale" and only become reusable after the next
+   system-wide flush, which vmalloc() performs when it runs out of
+   clean address space. */
+
+/* Address space of the zone.  A set bit in USED means the page
+   is allocated, a guard page, or stale; a set bit in STALE means
+   it was freed but may still be cached in some CPU's TLB.
+   FLUSHING holds the stale pages covered by a flush in progress. */
+static struct spinlock zone_lock;
+static struct bitmap *used_map;
+static struct bitmap *stale_map;
+static struct bitmap *flushing_map;
+static size_t stale_cnt;
+
+/* Space for the bitmaps above: a struct bitmap header followed
+   by one bit per page of the zone. */
+#define ZONE_MAP_WORDS (16 + VMALLOC_ZONE_PAGES / 32)
+static uint32_t used_buf[ZONE_MAP_WORDS];
+static uint32_t stale_buf[ZONE_MAP_WORDS];
+static uint32_t flushing_buf[ZONE_MAP_WORDS];
+
+/* System-wide TLB flush protocol, similar to the one used for
+   user page directories in userprog/pagedir.c. */
+static struct {
+  struct lock lock;   /* only owner of this lock can initiate a flush. */
+  int remaining;      /* CPUs that have yet to acknowledge IPI_TLB_ALL */
+} tlb_flush_state;
+
+static void *zone_alloc (size_t page_cnt);
+static void flush_all_tlbs (void);
+
+static inline uint32_t *
+zone_pte (const void *va)
+{
+  uint32_t pde = init_page_dir[pd_no (va)];
+  return pde_get_pt (pde) + pt_no (va);
+}
+
+static inline size_t
+zone_idx (const void *va)
+{
+  return ((uintptr_t) va - VMALLOC_ZONE_BEGIN) / PGSIZE;
+}
+
+/* Reserves the vmalloc zone and creates its page tables in
+   init_page_dir.  Must be called by paging_init() before any
+   other page directory is created. */
+void
+vmalloc_init (void)
+{
+  for (unsigned i = 0; i < VMALLOC_ZONE_PDES; i++)
+    {
+      size_t pde_idx = pd_no ((void *) VMALLOC_ZONE_BEGIN) + i;
+      void *pt = palloc_get_page (PAL_ASSERT | PAL_ZERO
+                                  | PAL_TAG (MEM_PAGETABLE));
+      init_page_dir[pde_idx] = pde_create_kernel (pt);
+    }
+
+  spinlock_init (&zone_lock);
+  lock_init (&tlb_flush_state.lock);
+  used_map = bitmap_create_in_buf (VMALLOC_ZONE_PAGES, used_buf,
+                                   sizeof used_buf);
+  stale_map = bitmap_create_in_buf (VMALLOC_ZONE_PAGES, stale_buf,
+                                    sizeof stale_buf);
+  flushing_map = bitmap_create_in_buf (VMALLOC_ZONE_PAGES, flushing_buf,
+                                       sizeof flushing_buf);
+  stale_cnt = 0;
+}
+
+/* Obtains PAGE_CNT pages from the kernel pool, which need not be
+   physically contiguous, and maps them at consecutive kernel
+   virtual addresses.  Returns the address of the first page, or
+   a null pointer if either physical memory or address space is
+   exhausted.
+
+   The returned memory must not be handed to devices by physical
+   address, since vtop() does not apply to it.  Must be called
+   from thread context once spinlocks are usable. */
+void *
+vmalloc (size_t page_cnt)
+{
+  uint8_t *base;
+  size_t i;
+
+  ASSERT (!intr_context ());
+  if (page_cnt == 0 || !cpu_can_acquire_spinlock)
+    return NULL;
+
+  base = zone_alloc (page_cnt);
+  if (base == NULL && stale_cnt > 0)
+    {
+      flush_all_tlbs ();
+      base = zone_alloc (page_cnt);
+    }
+  if (base == NULL)
+    return NULL;
+
+  for (i = 0; i < page_cnt; i++)
+    {
+      void *kpage = palloc_get_page (PAL_TAG (MEM_VMALLOC));
+      if (kpage == NULL)
+        {
+          /* Only this CPU can have touched the pages mapped so
+             far, so unmapping them needs no shootdown. */
+          while (i-- > 0)
+            {
+              uint32_t *pte = zone_pte (base + i * PGSIZE);
+              palloc_free_page (pte_get_page (*pte));
+              *pte = 0;
+              invlpg (base + i * PGSIZE);
+            }
+          spinlock_acquire (&zone_lock);
+          bitmap_set_multiple (used_map, zone_idx (base), page_cnt + 1, false);
+          spinlock_release (&zone_lock);
+          return NULL;
+        }
+      *zone_pte (base + i * PGSIZE) = pte_create_kernel (kpage, true);
+    }
+  return base;
+}
+
+/* Unmaps and frees the pages of an allocation returned by
+   vmalloc().  The address range becomes reusable only after the
+   next system-wide TLB flush. */
+void
+vfree (void *pages)
+{
+  uint8_t *va = pages;
+  size_t page_cnt = 0;
+
+  if (pages == NULL)
+    return;
+  ASSERT (vmalloc_owns (pages));
+  ASSERT (pg_ofs (pages) == 0);
+
+  for (; (*zone_pte (va) & PTE_P) != 0; va += PGSIZE, page_cnt++)
+    {
+      uint32_t *pte = zone_pte (va);
+      palloc_free_page (pte_get_page (*pte));
+      *pte = 0;
+      invlpg (va);
+    }
+
+  spinlock_acquire (&zone_lock);
+  ASSERT (bitmap_all (used_map, zone_idx (pages), page_cnt + 1));
+  bitmap_set_multiple (stale_map, zone_idx (pages), page_cnt + 1, true);
+  stale_cnt += page_cnt + 1;
+  spinlock_release (&zone_lock);
+}
+
+/* Returns true if VA lies within the vmalloc zone. */
+bool
+vmalloc_owns (const void *va)
+{
+  return (uintptr_t) va >= VMALLOC_ZONE_BEGIN
+         && (uintptr_t) va < VMALLOC_ZONE_END;
+}
+
+/* Called from the IPI_TLB_ALL handler on CPUs asked to drop
+   their cached translations of the vmalloc zone. */
+void
+vmalloc_handle_tlbflush_request (void)
+{
+  flushtlb ();
+  atomic_deci (&tlb_flush_state.remaining);
+}
+
+/* Reserves PAGE_CNT pages plus a trailing guard page of clean
+   address space.  Returns the first page or a null pointer. */
+static void *
+zone_alloc (size_t page_cnt)
+{
+  size_t idx;
+
+  spinlock_acquire (&zone_lock);
+  idx = bitmap_scan_and_flip (used_map, 0, page_cnt + 1, false);
+  spinlock_release (&zone_lock);
+
+  return idx != BITMAP_ERROR ? (void *) (VMALLOC_ZONE_BEGIN + idx * PGSIZE)
+                             : NULL;
+}
+
+/* Flushes the TLB on every CPU, then makes the address space
+   that was stale when the flush began available again. */
+static void
+flush_all_tlbs (void)
+{
+  size_t idx;
+
+  lock_acquire (&tlb_flush_state.lock);
+
+  /* Pages freed while the flush is in progress may be cached
+     again by the time it completes, so only reclaim those that
+     were already stale when it started. */
+  spinlock_acquire (&zone_lock);
+  for (idx = 0; idx < VMALLOC_ZONE_PAGES; idx++)
+    if (bitmap_test (stale_map, idx))
+      {
+        bitmap_reset (stale_map, idx);
+        bitmap_mark (flushing_map, idx);
+        stale_cnt--;
+      }
+  spinlock_release (&zone_lock);
+
+  flushtlb ();
+  if (atomic_load (&cpu_started_others) && ncpu > 1)
+    {
+      tlb_flush_state.remaining = ncpu - 1;
+      smp_barrier ();
+      lapic_send_ipi_to_all_but_self (IPI_TLB_ALL);
+
+      /* We busy-wait here rather than blocking the calling thread
+         because we expect to be spinning for a short time only. */
+      while (atomic_load (&tlb_flush_state.remaining) > 0)
+        ;
+    }
+
+  spinlock_acquire (&zone_lock);
+  for (idx = 0; idx < VMALLOC_ZONE_PAGES; idx++)
+    if (bitmap_test (flushing_map, idx))
+      {
+        bitmap_reset (flushing_map, idx);
+        bitmap_reset (used_map, idx);
+      }
+  spinlock_release (&zone_lock);
+
+  lock_release (&tlb_flush_state.lock);
+}
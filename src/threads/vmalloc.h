@@ -0,0 +1,13 @@
+#ifndef THREADS_VMALLOC_H
+#define THREADS_VMALLOC_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+void vmalloc_init (void);
+void *vmalloc (size_t page_cnt);
+void vfree (void *pages);
+bool vmalloc_owns (const void *);
+void vmalloc_handle_tlbflush_request (void);
+
+#endif /* threads/vmalloc.h */
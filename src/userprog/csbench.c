@@ -0,0 +1,71 @@
+#include "userprog/csbench.h"
+#include <inttypes.h>
+#include <stdio.h>
+#include "lib/kernel/x86.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "userprog/pagedir.h"
+
+/* Number of round trips between the two threads. */
+#define CSBENCH_ROUNDS 10000
+
+/* State shared by the two threads. */
+struct csbench
+  {
+    struct semaphore ping;      /* Upped by the main thread. */
+    struct semaphore pong;      /* Upped by the partner. */
+    struct semaphore done;      /* Upped when the partner exits. */
+  };
+
+static thread_func partner;
+
+/* Measures kernel thread context switches: the running thread
+   and a partner hand control back and forth through a pair of
+   semaphores.  Both are kernel threads, so with lazy TLB none of
+   the switches should need to load CR3. */
+void
+csbench_run (char **argv UNUSED)
+{
+  struct csbench cb;
+  uint64_t start, cycles;
+  unsigned long long loads;
+  int i;
+
+  sema_init (&cb.ping, 0);
+  sema_init (&cb.pong, 0);
+  sema_init (&cb.done, 0);
+  if (thread_create ("csbench", NICE_DEFAULT, partner, &cb) == TID_ERROR)
+    {
+      printf ("csbench: can't create partner thread\n");
+      return;
+    }
+
+  loads = pagedir_cr3_loads ();
+  start = rdtsc ();
+  for (i = 0; i < CSBENCH_ROUNDS; i++)
+    {
+      sema_up (&cb.ping);
+      sema_down (&cb.pong);
+    }
+  cycles = rdtsc () - start;
+  loads = pagedir_cr3_loads () - loads;
+  sema_down (&cb.done);
+
+  printf ("csbench: %d switches, %"PRIu64" cycles each, %llu CR3 loads\n",
+          2 * CSBENCH_ROUNDS, cycles / (2 * CSBENCH_ROUNDS), loads);
+}
+
+/* Partner thread for csbench_run(). */
+static void
+partner (void *cb_)
+{
+  struct csbench *cb = cb_;
+  int i;
+
+  for (i = 0; i < CSBENCH_ROUNDS; i++)
+    {
+      sema_down (&cb->ping);
+      sema_up (&cb->pong);
+    }
+  sema_up (&cb->done);
+}
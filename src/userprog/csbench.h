@@ -0,0 +1,6 @@
+#ifndef USERPROG_CSBENCH_H
+#define USERPROG_CSBENCH_H
+
+void csbench_run (char **argv);
+
+#endif /* userprog/csbench.h */
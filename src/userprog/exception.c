@@ -1,10 +1,13 @@
 #include "userprog/exception.h"
 #include <inttypes.h>
 #include <stdio.h>
+#include "threads/cpu.h"
 #include "threads/gdt.h"
 #include "threads/interrupt.h"
+#include "threads/synch.h"
 #include "threads/thread.h"
 #include "userprog/syscall.h"
+#include "userprog/uaccess.h"
 #include "vm/page.h"
 #include "threads/palloc.h"
 #include "userprog/pagedir.h"
@@ -14,11 +17,63 @@
 #include "threads/pte.h"
 #include "vm/frame.h"
 #include "vm/swap.h"
+#include "lib/kernel/x86.h"
 /* Number of page faults processed. */
 static long long page_fault_cnt;
 
+#ifdef VM
+/* Number of user page faults resolved by paging in, and the TSC
+   cycles spent resolving them. */
+static long long page_fault_resolved_cnt;
+static uint64_t page_fault_cycles;
+
+/* Page fault latency histograms have FAULT_HIST_BUCKETS buckets,
+   the first for faults that took fewer than 2**FAULT_HIST_SHIFT
+   cycles, each next one for twice as many, the last for all
+   slower ones. */
+#define FAULT_HIST_SHIFT 10
+
+/* Names of the page fault classes, by enum fault_class. */
+static const char *fault_class_names[FAULT_CLASS_CNT] =
+  {"stack growth", "zero-fill", "file read", "swap-in", "eviction",
+   "minor", "invalid"};
+
+/* Latency statistics of one class of page faults, per CPU so the
+   fault path doesn't serialize on them.  Summed when printed. */
+struct fault_stats
+  {
+    long long cnt;                        /* Faults. */
+    uint64_t cycles;                      /* TSC cycles, all of them. */
+    long long hist[FAULT_HIST_BUCKETS];   /* Latency histogram. */
+  };
+static struct fault_stats fault_stats[NCPU_MAX][FAULT_CLASS_CNT];
+
+/* Page faults of the first processes to exit, kept for the
+   shutdown report. */
+#define PROC_FAULT_CNT 32
+struct proc_faults
+  {
+    char name[16];                /* Program name. */
+    tid_t tid;                    /* Its thread. */
+    long long faults;             /* Faults resolved. */
+    long long around;             /* Pages mapped around them. */
+    long long class_cnt[FAULT_CLASS_CNT];     /* Faults, by class. */
+    uint64_t class_cycles[FAULT_CLASS_CNT];   /* Their cycles. */
+    long long hist[FAULT_HIST_BUCKETS];       /* Latency histogram. */
+  };
+static struct proc_faults proc_faults[PROC_FAULT_CNT];
+static size_t proc_faults_cnt;    /* Processes that exited. */
+static struct lock proc_faults_lock;
+
+static enum fault_class classify_fault (unsigned events, bool stack_growth);
+static void record_fault (struct supp_pt *, enum fault_class,
+                          uint64_t start);
+static void print_hist (const long long hist[FAULT_HIST_BUCKETS]);
+#endif
+
 static void kill (struct intr_frame *);
 static void page_fault (struct intr_frame *);
+static void bad_access (struct intr_frame *, bool user);
 static bool
 install_page (void *upage, void *kpage, bool writable);
 
@@ -69,6 +124,9 @@ exception_init (void)
      We need to disable interrupts for page faults because the
      fault address is stored in CR2 and needs to be preserved. */
   intr_register_int (14, 0, INTR_OFF, page_fault, "#PF Page-Fault Exception");
+#ifdef VM
+  lock_init (&proc_faults_lock);
+#endif
 }
 
 /* Prints exception statistics. */
@@ -76,8 +134,142 @@ void
 exception_print_stats (void) 
 {
   printf ("Exception: %lld page faults\n", page_fault_cnt);
+#ifdef VM
+  if (page_fault_resolved_cnt > 0)
+    printf ("Exception: %lld faults resolved, %"PRIu64" cycles average\n",
+            page_fault_resolved_cnt,
+            page_fault_cycles / page_fault_resolved_cnt);
+  for (int c = 0; c < FAULT_CLASS_CNT; c++)
+    {
+      struct fault_stats sum;
+
+      memset (&sum, 0, sizeof sum);
+      for (unsigned i = 0; i < ncpu; i++)
+        {
+          sum.cnt += fault_stats[i][c].cnt;
+          sum.cycles += fault_stats[i][c].cycles;
+          for (int b = 0; b < FAULT_HIST_BUCKETS; b++)
+            sum.hist[b] += fault_stats[i][c].hist[b];
+        }
+      if (sum.cnt > 0)
+        {
+          printf ("Exception: %s: %lld faults, %"PRIu64" cycles average,",
+                  fault_class_names[c], sum.cnt, sum.cycles / sum.cnt);
+          print_hist (sum.hist);
+        }
+    }
+  size_t shown = proc_faults_cnt < PROC_FAULT_CNT ? proc_faults_cnt
+                                                  : PROC_FAULT_CNT;
+  for (size_t i = 0; i < shown; i++)
+    {
+      struct proc_faults *pf = &proc_faults[i];
+      printf ("Exception: %s (%d): %lld faults, %lld pages mapped around",
+              pf->name, pf->tid, pf->faults, pf->around);
+      for (int c = 0; c < FAULT_CLASS_CNT; c++)
+        if (pf->class_cnt[c] > 0)
+          printf (", %lld %s (%"PRIu64" cycles average)",
+                  pf->class_cnt[c], fault_class_names[c],
+                  pf->class_cycles[c] / pf->class_cnt[c]);
+      printf ("\n");
+      printf ("Exception: %s (%d): latency", pf->name, pf->tid);
+      print_hist (pf->hist);
+    }
+  if (proc_faults_cnt > shown)
+    printf ("Exception: %zu more processes not shown\n",
+            proc_faults_cnt - shown);
+#endif
 }
 
+#ifdef VM
+/* Records the page faults of exiting process NAME (thread TID),
+   from its SUPP_PT, to be printed at shutdown.  Printing them at
+   exit would land in the middle of the test output. */
+void
+exception_record_process (const char *name, tid_t tid,
+                          const struct supp_pt *supp_pt)
+{
+  lock_acquire (&proc_faults_lock);
+  if (proc_faults_cnt < PROC_FAULT_CNT)
+    {
+      struct proc_faults *pf = &proc_faults[proc_faults_cnt];
+      strlcpy (pf->name, name, sizeof pf->name);
+      pf->tid = tid;
+      pf->faults = supp_pt->fault_cnt;
+      pf->around = supp_pt->fault_around_cnt;
+      memcpy (pf->class_cnt, supp_pt->fault_class_cnt, sizeof pf->class_cnt);
+      memcpy (pf->class_cycles, supp_pt->fault_class_cycles,
+              sizeof pf->class_cycles);
+      memcpy (pf->hist, supp_pt->fault_hist, sizeof pf->hist);
+    }
+  proc_faults_cnt++;
+  lock_release (&proc_faults_lock);
+}
+
+/* Returns the class of a page fault whose resolution took EVENTS,
+   a set of enum fault_event bits.  The costliest one decides. */
+static enum fault_class
+classify_fault (unsigned events, bool stack_growth)
+{
+  if (events & FAULT_EV_EVICT)
+    return FAULT_EVICT;
+  else if (events & FAULT_EV_SWAP)
+    return FAULT_SWAP;
+  else if (events & FAULT_EV_FILE)
+    return FAULT_FILE;
+  else if (stack_growth)
+    return FAULT_STACK;
+  else if (events & FAULT_EV_ZERO)
+    return FAULT_ZERO;
+  else
+    return FAULT_MINOR;
+}
+
+/* Records a page fault of class CLASS that started at TSC value
+   START for the system and, unless SUPP_PT is null (a thread not
+   made by thread_create()), for the process owning SUPP_PT. */
+static void
+record_fault (struct supp_pt *supp_pt, enum fault_class class,
+              uint64_t start)
+{
+  uint64_t cycles = rdtsc () - start;
+  int bucket = 0;
+
+  while (bucket < FAULT_HIST_BUCKETS - 1
+         && cycles >> (FAULT_HIST_SHIFT + bucket) != 0)
+    bucket++;
+
+  if (supp_pt != NULL)
+    {
+      supp_pt->fault_class_cnt[class]++;
+      supp_pt->fault_class_cycles[class] += cycles;
+      supp_pt->fault_hist[bucket]++;
+    }
+
+  intr_disable_push ();
+  struct fault_stats *fs = &fault_stats[get_cpu () - cpus][class];
+  fs->cnt++;
+  fs->cycles += cycles;
+  fs->hist[bucket]++;
+  intr_enable_pop ();
+}
+
+/* Prints the nonempty buckets of latency histogram HIST, each
+   as the cycles its faults took fewer than, and a new-line. */
+static void
+print_hist (const long long hist[FAULT_HIST_BUCKETS])
+{
+  for (int b = 0; b < FAULT_HIST_BUCKETS; b++)
+    if (hist[b] > 0)
+      {
+        if (b < FAULT_HIST_BUCKETS - 1)
+          printf (" <2^%d:%lld", FAULT_HIST_SHIFT + b, hist[b]);
+        else
+          printf (" more:%lld", hist[b]);
+      }
+  printf ("\n");
+}
+#endif
+
 /* Handler for an exception (probably) caused by a user process. */
 static void
 kill (struct intr_frame *f) 
@@ -146,6 +338,9 @@ page_fault (struct intr_frame *f)
      [IA32-v3a] 5.15 "Interrupt 14--Page Fault Exception
      (#PF)". */
   asm ("movl %%cr2, %0" : "=r" (fault_addr));
+#ifdef VM
+  uint64_t start = rdtsc ();
+#endif
 
   /* Turn interrupts back on (they were only off so that we could
      be assured of reading CR2 before it changed). */
@@ -182,7 +377,22 @@ page_fault (struct intr_frame *f)
          esp = f->esp;
       }
 
-      struct page *fault_page = find_page(thread_cur->supp_pt, fault_addr);
+      // may wait here while the load controller has us deactivated
+      if (user)
+         wset_fault(thread_cur);
+
+      // a CPU's initial thread has nothing to page in
+      struct supp_pt *supp_pt = thread_cur->supp_pt;
+      if (supp_pt == NULL)
+      {
+         record_fault(NULL, FAULT_INVALID, start);
+         bad_access(f, user);
+         return;
+      }
+      supp_pt->fault_events = 0;
+      lock_acquire(&supp_pt->lock);
+
+      struct page *fault_page = find_page(supp_pt, fault_addr);
 
       // stack growth logic
       // not exceed more than 8 mb
@@ -192,53 +402,78 @@ page_fault (struct intr_frame *f)
       if (fault_addr >= esp - 32 && fault_addr > PHYS_BASE - STACK_LIMIT && fault_page == NULL)
           stack_growth = true;
 
-      lock_acquire(&vm_lock);
-
       if (stack_growth && fault_page == NULL)
       {
          fault_page = create_page(fault_addr, NULL, 0, 0, PGSIZE, true, STACK, PAGED_OUT);
          if (fault_page == NULL)
          {
-            lock_release(&vm_lock);
-            f->eax = -1;
-            exit(-1);
+            lock_release(&supp_pt->lock);
+            record_fault(supp_pt, FAULT_INVALID, start);
+            bad_access(f, user);
+            return;
          }
 
-         ASSERT(thread_current()->supp_pt != NULL)
-         struct hash_elem *ret = hash_insert(&thread_current()->supp_pt->hash_map, &fault_page->hash_elem);
+         struct hash_elem *ret = hash_insert(&supp_pt->hash_map, &fault_page->hash_elem);
 
          ASSERT(ret == NULL);
       }
 
       if (fault_page == NULL)
       {
-         lock_release(&vm_lock);
-         f->eax = -1;
-         exit(-1);
+         lock_release(&supp_pt->lock);
+         record_fault(supp_pt, FAULT_INVALID, start);
+         bad_access(f, user);
+         return;
       }
 
       if (!install_page_in_frame(fault_page, thread_cur, stack_growth, write, false, true))
       {
-         lock_release(&vm_lock);
-         f->eax = -1;
-         exit(-1);
+         lock_release(&supp_pt->lock);
+         record_fault(supp_pt, FAULT_INVALID, start);
+         bad_access(f, user);
+         return;
       }
 
-      lock_release(&vm_lock);
+      // by what it took, not by what fault-around does on top
+      enum fault_class class = classify_fault(supp_pt->fault_events, stack_growth);
+      supp_pt->fault_cnt++;
+      if (fault_page->page_status == CODE || fault_page->page_status == MMAP)
+         fault_around(fault_page, thread_cur);
+
+      lock_release(&supp_pt->lock);
+
+      page_fault_resolved_cnt++;
+      page_fault_cycles += rdtsc() - start;
+      record_fault(supp_pt, class, start);
    }
    else
    {
-      f->eax = -1;
-      exit(-1);
+      record_fault(thread_current()->supp_pt, FAULT_INVALID, start);
+      bad_access(f, user);
    }
 
 #else
-   if (user)
+   if (user || fault_addr < PHYS_BASE)
+      bad_access(f, user);
+#endif
+}
+
+/* Handles a fault on memory the process doesn't have.  A kernel
+   access through the uaccess.c primitives resumes at its fixup,
+   which reports the failure to the caller; anything else kills
+   the process. */
+static void
+bad_access (struct intr_frame *f, bool user)
+{
+   uintptr_t fixup = user ? 0 : uaccess_fixup((uintptr_t) f->eip);
+
+   if (fixup != 0)
    {
-      f->eax = -1;
-      exit(-1);
+      f->eip = (void (*) (void)) fixup;
+      return;
    }
-#endif
+   f->eax = -1;
+   exit(-1);
 }
 
 /*
@@ -1,6 +1,8 @@
 #ifndef USERPROG_EXCEPTION_H
 #define USERPROG_EXCEPTION_H
 
+#include "threads/thread.h"
+
 /* Page fault error code bits that describe the cause of the exception.  */
 #define PF_P 0x1    /* 0: not-present page. 1: access rights violation. */
 #define PF_W 0x2    /* 0: read, 1: write. */
@@ -9,5 +11,10 @@
 
 void exception_init (void);
 void exception_print_stats (void);
+#ifdef VM
+struct supp_pt;
+void exception_record_process (const char *name, tid_t,
+                               const struct supp_pt *);
+#endif
 
 #endif /* userprog/exception.h */
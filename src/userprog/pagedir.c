@@ -1,19 +1,100 @@
 #include "userprog/pagedir.h"
 #include <stdbool.h>
 #include <stddef.h>
+#include <stdio.h>
 #include <string.h>
 #include "threads/init.h"
+#include "threads/malloc.h"
 #include "threads/pte.h"
 #include "threads/palloc.h"
 #include "threads/synch.h"
 #include "threads/cpu.h"
+#include "threads/interrupt.h"
+#include "threads/spinlock.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
 #include "devices/lapic.h"
 #include "lib/kernel/x86.h"
 #include "lib/atomic-ops.h"
 
+/* Most pages a TLB flush request names; more flush the whole
+   TLB instead. */
+#define TLB_FLUSH_PAGES 16
+
+/* A TLB flush request's place in one target CPU's mailbox. */
+struct tlb_link
+  {
+    struct list_elem elem;
+    struct tlb_flush *req;
+  };
+
+/* A request to flush user pages of PD from the TLBs of the CPUs
+   it is active on.  Lives on the initiator's stack. */
+struct tlb_flush
+  {
+    uint32_t *pd;                       /* Page directory. */
+    const void *pages[TLB_FLUSH_PAGES]; /* User pages to invlpg. */
+    size_t page_cnt;                    /* Pages, if > TLB_FLUSH_PAGES
+                                           flush everything. */
+    int remaining;                      /* CPUs yet to acknowledge. */
+    struct tlb_link links[NCPU_MAX];    /* One per target CPU. */
+  };
+
+/* A CPU's pending TLB flush requests. */
+struct tlb_mailbox
+  {
+    struct spinlock lock;       /* Protects REQS. */
+    struct list reqs;           /* tlb_link elems from other CPUs. */
+  };
+
+/* Page directory loaded in each CPU's CR3, by index in cpus[].
+   A CPU whose entry isn't PD can't have cached any of PD's user
+   translations: loading CR3 drops them.  Kernel threads keep
+   whatever was loaded before them (lazy TLB), so PD may be
+   loaded on a CPU that doesn't run its process. */
+static uint32_t *cpu_pd[NCPU_MAX];
+static struct tlb_mailbox mailboxes[NCPU_MAX];
+
+/* A page table put aside while the 4 MB of user memory it maps
+   is mapped by a single PDE instead, see pagedir_promote().  Its
+   entries keep the accessed and dirty bits of each 4 kB page: the
+   PDE's bits only say that some page of the 4 MB was accessed or
+   written. */
+struct superpage
+  {
+    struct list_elem elem;      /* In superpages. */
+    uint32_t *pd;               /* Page directory. */
+    uint32_t *pde;              /* Its PDE with PTE_PS set. */
+    uint32_t *pt;               /* Page table to restore. */
+  };
+
+/* All promoted regions, in any page directory.  The lock also
+   covers the entries of their page tables and demotion. */
+static struct list superpages;
+static struct spinlock superpage_lock;
+
+/* PTE bit for OS use: the page may have been written while it was
+   part of a 4 MB page, which can't tell which of its pages were.
+   Counts as dirty, but isn't PTE_D. */
+#define PTE_SP_DIRTY 0x200
+static unsigned long long promote_cnt, demote_cnt;
+
+/* Statistics, per CPU. */
+static unsigned long long cr3_load_cnt[NCPU_MAX];
+static unsigned long long cr3_kept_cnt[NCPU_MAX];
+static unsigned long long shootdown_ipi_cnt[NCPU_MAX];
+
 static uint32_t *active_pd (void);
-static void invalidate_pagedir (uint32_t *);
-static void invalidate_pagedir_others (uint32_t *pd);
+static void invalidate_page (uint32_t *pd, const void *upage);
+static void invalidate_page_deferred (uint32_t *pd, const void *upage);
+static void shootdown (struct tlb_flush *);
+static void flush_all (uint32_t *pd);
+static struct superpage *superpage_find (uint32_t *pde);
+static struct superpage *superpage_take (uint32_t *pde);
+static uint32_t *lookup_shadow (uint32_t *pd, const void *vaddr,
+                                uint32_t **pde);
+static void demote (uint32_t *pd, uint32_t *pde);
+static void batch_flush (struct tlb_batch *);
 
 /* Creates a new page directory that has mappings for kernel
    virtual addresses, but none for user virtual addresses.
@@ -22,7 +103,7 @@ static void invalidate_pagedir_others (uint32_t *pd);
 uint32_t *
 pagedir_create (void) 
 {
-  uint32_t *pd = palloc_get_page (0);
+  uint32_t *pd = palloc_get_page (PAL_TAG (MEM_PAGETABLE));
   if (pd != NULL)
     memcpy (pd, init_page_dir, PGSIZE);
   return pd;
@@ -39,8 +120,21 @@ pagedir_destroy (uint32_t *pd)
     return;
 
   ASSERT (pd != init_page_dir);
+  ASSERT (active_pd () != pd);
+
+  /* Kernel threads may still be borrowing PD on other CPUs.  A
+     request for every page makes them switch to init_page_dir,
+     see pagedir_handle_tlbflush_request(). */
+  flush_all (pd);
+
   for (pde = pd; pde < pd + pd_no (PHYS_BASE); pde++)
-    if (*pde & PTE_P) 
+    if (*pde & PTE_PS)
+      {
+        struct superpage *sp = superpage_take (pde);
+        palloc_free_page (sp->pt);
+        free (sp);
+      }
+    else if (*pde & PTE_P) 
       {
         uint32_t *pt = pde_get_pt (*pde);
         uint32_t *pte;
@@ -59,7 +153,9 @@ pagedir_destroy (uint32_t *pd)
    If PD does not have a page table for VADDR, behavior depends
    on CREATE.  If CREATE is true, then a new page table is
    created and a pointer into it is returned.  Otherwise, a null
-   pointer is returned. */
+   pointer is returned.
+   A 4 MB page holding VADDR is split back into 4 kB pages
+   first. */
 static uint32_t *
 lookup_page (uint32_t *pd, const void *vaddr, bool create)
 {
@@ -73,11 +169,13 @@ lookup_page (uint32_t *pd, const void *vaddr, bool create)
   /* Check for a page table for VADDR.
      If one is missing, create one if requested. */
   pde = pd + pd_no (vaddr);
+  if (*pde & PTE_PS)
+    demote (pd, pde);
   if (*pde == 0) 
     {
       if (create)
         {
-          pt = palloc_get_page (PAL_ZERO);
+          pt = palloc_get_page (PAL_ZERO | PAL_TAG (MEM_PAGETABLE));
           if (pt == NULL) 
             return NULL; 
       
@@ -92,6 +190,22 @@ lookup_page (uint32_t *pd, const void *vaddr, bool create)
   return &pt[pt_no (vaddr)];
 }
 
+/* Like lookup_page() without CREATE, but returns the PDE itself
+   if VADDR is in a 4 MB page. */
+static uint32_t *
+lookup_entry (uint32_t *pd, const void *vaddr)
+{
+  uint32_t *pde = pd + pd_no (vaddr);
+  uint32_t e = *pde;
+
+  if (e & PTE_PS)
+    return pde;
+  else if (e & PTE_P)
+    return pde_get_pt (e) + pt_no (vaddr);
+  else
+    return NULL;
+}
+
 /* Adds a mapping in page directory PD from user virtual page
    UPAGE to the physical frame identified by kernel virtual
    address KPAGE.
@@ -136,11 +250,13 @@ pagedir_get_page (uint32_t *pd, const void *uaddr)
 
   ASSERT (is_user_vaddr (uaddr));
   
-  pte = lookup_page (pd, uaddr, false);
-  if (pte != NULL && (*pte & PTE_P) != 0)
-    return pte_get_page (*pte) + pg_ofs (uaddr);
-  else
+  pte = lookup_entry (pd, uaddr);
+  if (pte == NULL || (*pte & PTE_P) == 0)
     return NULL;
+  else if (*pte & PTE_PS)
+    return pde_get_large_page (*pte) + ((uintptr_t) uaddr & LPGMASK);
+  else
+    return pte_get_page (*pte) + pg_ofs (uaddr);
 }
 
 /* Marks user virtual page UPAGE "not present" in page
@@ -159,35 +275,81 @@ pagedir_clear_page (uint32_t *pd, void *upage)
   if (pte != NULL && (*pte & PTE_P) != 0)
     {
       *pte &= ~PTE_P;
-      invalidate_pagedir (pd);
+      invalidate_page (pd, upage);
+    }
+}
+
+/* If VADDR is in a 4 MB page of PD, returns the entry for VADDR
+   in the page table put aside for it and sets *PDE to the PDE,
+   with superpage_lock held.  Otherwise returns a null pointer. */
+static uint32_t *
+lookup_shadow (uint32_t *pd, const void *vaddr, uint32_t **pde)
+{
+  *pde = pd + pd_no (vaddr);
+  if ((**pde & PTE_PS) == 0)
+    return NULL;
+
+  spinlock_acquire (&superpage_lock);
+  if ((**pde & PTE_PS) == 0)
+    {
+      spinlock_release (&superpage_lock);
+      return NULL;
     }
+  return superpage_find (*pde)->pt + pt_no (vaddr);
 }
 
 /* Returns true if the PTE for virtual page VPAGE in PD is dirty,
    that is, if the page has been modified since the PTE was
-   installed.
+   installed.  A page of a 4 MB page counts as modified once any
+   of the 4 MB is.
    Returns false if PD contains no PTE for VPAGE. */
 bool
 pagedir_is_dirty (uint32_t *pd, const void *vpage) 
 {
-  uint32_t *pte = lookup_page (pd, vpage, false);
-  return pte != NULL && (*pte & PTE_D) != 0;
+  uint32_t *pde, *pte;
+  bool dirty;
+
+  pte = lookup_shadow (pd, vpage, &pde);
+  if (pte != NULL)
+    {
+      dirty = (*pde & PTE_D) != 0 || (*pte & (PTE_D | PTE_SP_DIRTY)) != 0;
+      spinlock_release (&superpage_lock);
+      return dirty;
+    }
+  pte = lookup_entry (pd, vpage);
+  return pte != NULL && (*pte & (PTE_D | PTE_SP_DIRTY)) != 0;
 }
 
 /* Set the dirty bit to DIRTY in the PTE for virtual page VPAGE
-   in PD. */
+   in PD.  Clearing it splits a 4 MB page that has been written,
+   as its pages can't be told apart any more. */
 void
 pagedir_set_dirty (uint32_t *pd, const void *vpage, bool dirty) 
 {
-  uint32_t *pte = lookup_page (pd, vpage, false);
+  uint32_t *pde, *pte;
+
+  pte = lookup_shadow (pd, vpage, &pde);
+  if (pte != NULL)
+    {
+      bool done = dirty || (*pde & PTE_D) == 0;
+      if (dirty)
+        *pte |= PTE_D;
+      else if (done)
+        *pte &= ~(uint32_t) (PTE_D | PTE_SP_DIRTY);
+      spinlock_release (&superpage_lock);
+      if (done)
+        return;
+    }
+
+  pte = dirty ? lookup_entry (pd, vpage) : lookup_page (pd, vpage, false);
   if (pte != NULL) 
     {
       if (dirty)
         *pte |= PTE_D;
       else 
         {
-          *pte &= ~(uint32_t) PTE_D;
-          invalidate_pagedir (pd);
+          *pte &= ~(uint32_t) (PTE_D | PTE_SP_DIRTY);
+          invalidate_page (pd, vpage);
         }
     }
 }
@@ -199,16 +361,55 @@ pagedir_set_dirty (uint32_t *pd, const void *vpage, bool dirty)
 bool
 pagedir_is_accessed (uint32_t *pd, const void *vpage) 
 {
-  uint32_t *pte = lookup_page (pd, vpage, false);
+  uint32_t *pde, *pte;
+  bool accessed;
+
+  pte = lookup_shadow (pd, vpage, &pde);
+  if (pte != NULL)
+    {
+      accessed = ((*pde | *pte) & PTE_A) != 0;
+      spinlock_release (&superpage_lock);
+      return accessed;
+    }
+  pte = lookup_entry (pd, vpage);
   return pte != NULL && (*pte & PTE_A) != 0;
 }
 
 /* Sets the accessed bit to ACCESSED in the PTE for virtual page
-   VPAGE in PD. */
+   VPAGE in PD.  In a 4 MB page, clearing it first passes the
+   PDE's bit on to all of the pages, then clears the page's own:
+   the others stay as recently used as they may have been. */
 void
 pagedir_set_accessed (uint32_t *pd, const void *vpage, bool accessed) 
 {
-  uint32_t *pte = lookup_page (pd, vpage, false);
+  uint32_t *pde, *pte;
+
+  pte = lookup_shadow (pd, vpage, &pde);
+  if (pte != NULL)
+    {
+      bool flush = !accessed && (*pde & PTE_A) != 0;
+      if (flush)
+        {
+          struct superpage *sp = superpage_find (pde);
+          size_t i;
+
+          for (i = 0; i < PGSIZE / sizeof *sp->pt; i++)
+            sp->pt[i] |= PTE_A;
+          *pde &= ~(uint32_t) PTE_A;
+        }
+      if (accessed)
+        *pte |= PTE_A;
+      else
+        *pte &= ~(uint32_t) PTE_A;
+      spinlock_release (&superpage_lock);
+
+      /* Any address in the 4 MB drops its translation. */
+      if (flush)
+        invalidate_page_deferred (pd, vpage);
+      return;
+    }
+
+  pte = lookup_entry (pd, vpage);
   if (pte != NULL) 
     {
       if (accessed)
@@ -216,13 +417,127 @@ pagedir_set_accessed (uint32_t *pd, const void *vpage, bool accessed)
       else 
         {
           *pte &= ~(uint32_t) PTE_A; 
-          invalidate_pagedir (pd);
+          invalidate_page_deferred (pd, vpage);
         }
     }
 }
 
+/* Maps the 4 MB of user memory at UBASE in PD with one 4 MB
+   page, if its page table maps it writable onto 1,024 frames
+   that are physically contiguous and 4 MB aligned.  The page
+   table is kept, to be restored as soon as any of the pages is
+   changed on its own, and keeps their accessed and dirty bits
+   meanwhile.  Returns true if successful.
+   PD's process must not be running on another CPU. */
+bool
+pagedir_promote (uint32_t *pd, void *ubase)
+{
+  const uint32_t bits = PTE_P | PTE_W | PTE_U;
+  uint32_t *pde = pd + pd_no (ubase);
+  uint32_t *pt;
+  uintptr_t base;
+  struct superpage *sp;
+  size_t i;
+
+  ASSERT (((uintptr_t) ubase & LPGMASK) == 0);
+  ASSERT (is_user_vaddr (ubase));
+
+  if ((*pde & PTE_P) == 0 || (*pde & PTE_PS) != 0)
+    return false;
+  pt = pde_get_pt (*pde);
+  base = pt[0] & PTE_ADDR;
+  if (base & LPGMASK)
+    return false;
+  for (i = 0; i < PGSIZE / sizeof *pt; i++)
+    {
+      if ((pt[i] & bits) != bits || (pt[i] & PTE_ADDR) != base + i * PGSIZE)
+        return false;
+    }
+
+  sp = malloc (sizeof *sp);
+  if (sp == NULL)
+    return false;
+  sp->pd = pd;
+  sp->pde = pde;
+  sp->pt = pt;
+
+  spinlock_acquire (&superpage_lock);
+  list_push_back (&superpages, &sp->elem);
+  *pde = pde_create_user_large (ptov (base), true);
+  promote_cnt++;
+  spinlock_release (&superpage_lock);
+
+  /* Drop the 4 kB translations before the 4 MB one is used. */
+  flush_all (pd);
+  return true;
+}
+
+/* Returns the superpage record of PDE.  superpage_lock held. */
+static struct superpage *
+superpage_find (uint32_t *pde)
+{
+  struct list_elem *e;
+
+  ASSERT (spinlock_held_by_current_cpu (&superpage_lock));
+  for (e = list_begin (&superpages); e != list_end (&superpages);
+       e = list_next (e))
+    {
+      struct superpage *sp = list_entry (e, struct superpage, elem);
+      if (sp->pde == pde)
+        return sp;
+    }
+  NOT_REACHED ();
+}
+
+/* Removes and returns the superpage record of PDE. */
+static struct superpage *
+superpage_take (uint32_t *pde)
+{
+  struct superpage *sp;
+
+  spinlock_acquire (&superpage_lock);
+  sp = superpage_find (pde);
+  list_remove (&sp->elem);
+  spinlock_release (&superpage_lock);
+  return sp;
+}
+
+/* Splits the 4 MB page that PDE in PD maps back into 4 kB pages.
+   Each keeps its own accessed and dirty bits and is also marked
+   accessed if the 4 MB page was.  If the 4 MB page was written,
+   each gets PTE_SP_DIRTY rather than PTE_D, so that the pages
+   that weren't written stay apart from those that are later. */
+static void
+demote (uint32_t *pd, uint32_t *pde)
+{
+  struct superpage *sp;
+  uintptr_t base;
+  uint32_t flags;
+  size_t i;
+
+  spinlock_acquire (&superpage_lock);
+  sp = superpage_find (pde);
+  list_remove (&sp->elem);
+  ASSERT (sp->pd == pd);
+
+  base = vtop (pde_get_large_page (*pde));
+  flags = *pde & (PTE_P | PTE_W | PTE_U | PTE_A);
+  if (*pde & PTE_D)
+    flags |= PTE_SP_DIRTY;
+  for (i = 0; i < PGSIZE / sizeof *sp->pt; i++)
+    sp->pt[i] = ((base + i * PGSIZE)
+                 | flags | (sp->pt[i] & (PTE_A | PTE_D | PTE_SP_DIRTY)));
+  *pde = pde_create_user (sp->pt);
+  demote_cnt++;
+  spinlock_release (&superpage_lock);
+
+  free (sp);
+  flush_all (pd);
+}
+
 /* Loads page directory PD into the CPU's page directory base
-   register. */
+   register, unless it is loaded already: shootdowns reach every
+   CPU PD is loaded on, so its TLB entries are still good. */
 void
 pagedir_activate (uint32_t *pd) 
 {
@@ -234,7 +549,45 @@ pagedir_activate (uint32_t *pd)
      new page tables immediately.  See [IA32-v2a] "MOV--Move
      to/from Control Registers" and [IA32-v3a] 3.7.5 "Base
      Address of the Page Directory". */
-  lcr3 (vtop (pd));
+  intr_disable_push ();
+  int cpu = get_cpu () - cpus;
+  if (cpu_pd[cpu] != pd)
+    {
+      cpu_pd[cpu] = pd;
+      lcr3 (vtop (pd));
+      cr3_load_cnt[cpu]++;
+    }
+  else
+    cr3_kept_cnt[cpu]++;
+  intr_enable_pop ();
+}
+
+/* Returns the number of CR3 loads by pagedir_activate() so far,
+   on all CPUs. */
+unsigned long long
+pagedir_cr3_loads (void)
+{
+  unsigned long long cnt = 0;
+
+  for (unsigned i = 0; i < ncpu; i++)
+    cnt += cr3_load_cnt[i];
+  return cnt;
+}
+
+/* Prints page directory statistics. */
+void
+pagedir_print_stats (void)
+{
+  unsigned long long kept = 0, ipis = 0;
+
+  for (unsigned i = 0; i < ncpu; i++)
+    {
+      kept += cr3_kept_cnt[i];
+      ipis += shootdown_ipi_cnt[i];
+    }
+  printf ("Paging: %llu CR3 loads, %llu avoided, %llu TLB shootdown IPIs, "
+          "%llu superpage promotions, %llu demotions\n",
+          pagedir_cr3_loads (), kept, ipis, promote_cnt, demote_cnt);
 }
 
 /* Returns the currently active page directory. */
@@ -252,70 +605,202 @@ active_pd (void)
 
 /* Some page table changes can cause the CPU's translation
    lookaside buffer (TLB) to become out-of-sync with the page
-   table.  When this happens, we have to "invalidate" the TLB by
-   re-activating it.
-
-   This function invalidates the TLB if PD is the active page
-   directory.  (If PD is not active then its entries are not in
-   the TLB, so there is no need to invalidate anything.) */
+   table.  When this happens, we have to "invalidate" the TLB
+   entries for the changed page on every CPU that may have cached
+   them: those on which PD is active.  The current CPU flushes
+   its own with invlpg, the others are sent IPI_TLB with a
+   request naming the page. */
 static void
-invalidate_pagedir (uint32_t *pd) 
+invalidate_page (uint32_t *pd, const void *upage)
 {
-  if (active_pd () == pd) 
-    {
-      /* Re-activating PD clears the TLB.  See [IA32-v3a] 3.12
-         "Translation Lookaside Buffers (TLBs)". */
-      pagedir_activate (pd);
-    } 
-  else
-    {
-      /* The PD is not active on the current CPU, but it could be
-         active on other CPUs.  Inform the other CPUs that they
-         need to invalidate any TLB entries related to this PD.
-         If Pintos supported multi-threaded processes, this PD
-         could be active on both this and other CPUs.
-       */
-      invalidate_pagedir_others (pd);
-    }
-}
+  struct tlb_flush req;
 
-static struct {
-  struct lock lock; /* only owner of this lock can initiate TLB flush. */
-  uint32_t *pd;     /* pagedir to be invalidated */
-  int remaining;    /* remaining number of CPUs that must acknowledge IPI_TLB */
-} tlb_flush_state;
+  req.pd = pd;
+  req.pages[0] = upage;
+  req.page_cnt = 1;
+  shootdown (&req);
+}
 
-/* Initialize the lock used to protect the TLB flushing protocol. */
+/* Initialize the TLB shootdown mailboxes. */
 void
 pagedir_init (void)
 {
-  lock_init (&tlb_flush_state.lock);
+  for (int i = 0; i < NCPU_MAX; i++)
+    {
+      spinlock_init (&mailboxes[i].lock);
+      list_init (&mailboxes[i].reqs);
+    }
+  list_init (&superpages);
+  spinlock_init (&superpage_lock);
+}
+
+/* Flushes REQ's pages from this CPU's TLB if REQ's page
+   directory is active here. */
+static void
+flush_local (const struct tlb_flush *req)
+{
+  if (active_pd () != req->pd)
+    return;
+  if (req->page_cnt > TLB_FLUSH_PAGES)
+    lcr3 (vtop (req->pd));
+  else
+    for (size_t i = 0; i < req->page_cnt; i++)
+      invlpg (req->pages[i]);
 }
 
+/* Flushes REQ's pages from the TLB of every CPU on which its page
+   directory is active, and waits for the others to acknowledge.
+   Each initiator has a request of its own, so shootdowns from
+   different CPUs (or threads) proceed concurrently.  We
+   busy-wait with interrupts on, serving requests sent to us
+   meanwhile, because we expect to be spinning for a short time
+   only. */
 static void
-invalidate_pagedir_others (uint32_t *pd)
+shootdown (struct tlb_flush *req)
 {
-  lock_acquire (&tlb_flush_state.lock);
-  tlb_flush_state.remaining = ncpu - 1;
-  tlb_flush_state.pd = pd;
+  bool targets[NCPU_MAX];
+  int target_cnt = 0;
+
+  /* The PTE change must be visible before we look at who has
+     the page directory loaded: a CPU that loads it afterwards
+     walks the new tables. */
   smp_barrier ();
-  lapic_send_ipi_to_all_but_self (IPI_TLB);
 
-  /* We busy-wait here rather than blocking the calling thread
-     because we expect to be spinning for a short time only. */
-  while (atomic_load (&tlb_flush_state.remaining) > 0)
+  intr_disable_push ();
+  struct cpu *self = get_cpu ();
+  for (unsigned i = 0; i < ncpu; i++)
+    {
+      targets[i] = cpus + i != self && cpu_pd[i] == req->pd
+                   && atomic_load (&cpu_started_others);
+      target_cnt += targets[i];
+    }
+  req->remaining = target_cnt;
+  for (unsigned i = 0; i < ncpu; i++)
+    if (targets[i])
+      {
+        req->links[i].req = req;
+        spinlock_acquire (&mailboxes[i].lock);
+        list_push_back (&mailboxes[i].reqs, &req->links[i].elem);
+        spinlock_release (&mailboxes[i].lock);
+        lapic_send_ipi_to (IPI_TLB, cpus[i].id);
+      }
+  shootdown_ipi_cnt[self - cpus] += target_cnt;
+  flush_local (req);
+  intr_enable_pop ();
+
+  while (atomic_load (&req->remaining) > 0)
     ;
-  lock_release (&tlb_flush_state.lock);
 }
 
-/* This method will be called from the IPI TLB_FLUSH interrupt
-   handler on CPUs to which a request to flush their TLB was sent.
- */
+/* Flushes all of PD's user pages from every CPU's TLB. */
+static void
+flush_all (uint32_t *pd)
+{
+  struct tlb_flush req;
+
+  req.pd = pd;
+  req.page_cnt = TLB_FLUSH_PAGES + 1;
+  shootdown (&req);
+}
+
+/* This method will be called from the IPI_TLB interrupt handler
+   on CPUs to which a request to flush their TLB was sent.  The
+   initiator's request is gone once its count drops, so it is
+   read before acknowledging.  A kernel thread borrowing the
+   page directory switches to init_page_dir instead of flushing,
+   so it gets no more requests for it. */
 void
 pagedir_handle_tlbflush_request (void)
 {
-  if (active_pd () == tlb_flush_state.pd)
-    pagedir_activate (active_pd ());
+  struct tlb_mailbox *mb = &mailboxes[get_cpu () - cpus];
+
+  spinlock_acquire (&mb->lock);
+  while (!list_empty (&mb->reqs))
+    {
+      struct list_elem *e = list_pop_front (&mb->reqs);
+      struct tlb_flush *req = list_entry (e, struct tlb_link, elem)->req;
+      if (active_pd () == req->pd && thread_current ()->pagedir != req->pd)
+        pagedir_activate (NULL);
+      else
+        flush_local (req);
+      atomic_deci (&req->remaining);
+    }
+  spinlock_release (&mb->lock);
+}
+
+/* Starts deferring the TLB invalidations that only clear
+   accessed bits into BATCH, until pagedir_batch_end().  An
+   eviction sweep rakes many accessed bits; a stale TLB entry
+   only keeps one from being set again for a while, so they can
+   wait and go out as one request per page directory. */
+void
+pagedir_batch_begin (struct tlb_batch *batch)
+{
+  struct thread *t = thread_current ();
+
+  ASSERT (t->tlb_batch == NULL);
+  batch->cnt = 0;
+  t->tlb_batch = batch;
+}
 
-  atomic_deci (&tlb_flush_state.remaining);
+/* Flushes the invalidations deferred since
+   pagedir_batch_begin() and stops deferring. */
+void
+pagedir_batch_end (void)
+{
+  struct thread *t = thread_current ();
+  struct tlb_batch *batch = t->tlb_batch;
+
+  ASSERT (batch != NULL);
+  batch_flush (batch);
+  t->tlb_batch = NULL;
+}
+
+/* Sends the invalidations in BATCH, one request per page
+   directory, and empties it. */
+static void
+batch_flush (struct tlb_batch *batch)
+{
+  while (batch->cnt > 0)
+    {
+      struct tlb_flush req;
+      size_t kept = 0;
+
+      req.pd = batch->pd[0];
+      req.page_cnt = 0;
+      for (size_t i = 0; i < batch->cnt; i++)
+        if (batch->pd[i] == req.pd)
+          {
+            if (req.page_cnt < TLB_FLUSH_PAGES)
+              req.pages[req.page_cnt] = batch->page[i];
+            req.page_cnt++;
+          }
+        else
+          {
+            batch->pd[kept] = batch->pd[i];
+            batch->page[kept] = batch->page[i];
+            kept++;
+          }
+      batch->cnt = kept;
+      shootdown (&req);
+    }
+}
+
+/* Invalidates UPAGE in PD now, or later if the current thread is
+   batching. */
+static void
+invalidate_page_deferred (uint32_t *pd, const void *upage)
+{
+  struct tlb_batch *batch = thread_current ()->tlb_batch;
+
+  if (batch == NULL)
+    {
+      invalidate_page (pd, upage);
+      return;
+    }
+  if (batch->cnt == TLB_BATCH_PAGES)
+    batch_flush (batch);
+  batch->pd[batch->cnt] = pd;
+  batch->page[batch->cnt] = upage;
+  batch->cnt++;
 }
@@ -2,8 +2,20 @@
 #define USERPROG_PAGEDIR_H
 
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 
+/* Most invalidations a batch holds before it is flushed early. */
+#define TLB_BATCH_PAGES 16
+
+/* TLB invalidations deferred by pagedir_batch_begin(). */
+struct tlb_batch
+  {
+    uint32_t *pd[TLB_BATCH_PAGES];
+    const void *page[TLB_BATCH_PAGES];
+    size_t cnt;
+  };
+
 void pagedir_init (void);
 uint32_t *pagedir_create (void);
 void pagedir_destroy (uint32_t *pd);
@@ -14,7 +26,12 @@ bool pagedir_is_dirty (uint32_t *pd, const void *upage);
 void pagedir_set_dirty (uint32_t *pd, const void *upage, bool dirty);
 bool pagedir_is_accessed (uint32_t *pd, const void *upage);
 void pagedir_set_accessed (uint32_t *pd, const void *upage, bool accessed);
+bool pagedir_promote (uint32_t *pd, void *ubase);
 void pagedir_activate (uint32_t *pd);
 void pagedir_handle_tlbflush_request (void);
+unsigned long long pagedir_cr3_loads (void);
+void pagedir_print_stats (void);
+void pagedir_batch_begin (struct tlb_batch *);
+void pagedir_batch_end (void);
 
 #endif /* userprog/pagedir.h */
@@ -5,6 +5,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include "threads/gdt.h"
+#include "userprog/exception.h"
 #include "userprog/pagedir.h"
 #include "userprog/syscall.h"
 #include "threads/tss.h"
@@ -17,6 +18,7 @@
 #include "threads/palloc.h"
 #include "threads/thread.h"
 #include "threads/vaddr.h"
+#include "lib/kernel/x86.h"
 #include "threads/synch.h"
 #include "threads/malloc.h"
 #include "threads/thread.h"
@@ -24,6 +26,8 @@
 #include "vm/page.h"
 #include "lib/string.h"
 #include "vm/frame.h"
+#include "vm/mappedfile.h"
+#include "vm/prepage.h"
 
 static thread_func start_process NO_RETURN;
 static bool load(const char *cmdline, struct process *ps, char **argv, int argc, void (**eip)(void), void **esp);
@@ -39,7 +43,7 @@ tid_t process_execute(const char *file_name)
   char *fn_copy;
   tid_t tid;
 
-  struct process *ps = malloc(sizeof(struct process));
+  struct process *ps = malloc_tagged(sizeof(struct process), MEM_PROCESS);
   if (ps == NULL)
   {
     return TID_ERROR;
@@ -50,6 +54,7 @@ tid_t process_execute(const char *file_name)
   ps->ref_count = 2;
   ps->good_start = false;
   ps->exe_file = NULL;
+  ps->exec_tsc = rdtsc();
   sema_init(&ps->user_prog_exit, 0);
   sema_init(&ps->child_started, 0);
 
@@ -163,6 +168,150 @@ start_process(void *p)
   NOT_REACHED();
 }
 
+#ifdef VM
+/* What a forked child copies from its parent, on the parent's
+   stack: the parent waits in process_fork() until it's done. */
+struct fork_info
+{
+  struct process *ps;        /* The child's process struct. */
+  struct thread *parent;
+  struct intr_frame *if_;    /* Parent's user context at the fork. */
+};
+
+static thread_func start_fork NO_RETURN;
+static bool fork_files(struct thread *parent, struct process *ps);
+
+/* Creates a copy of the current process, which returns 0 from the
+   system call that F belongs to.  Memory is shared copy-on-write
+   (see fork_spt()), open files and mappings are reopened at the
+   same positions.  Returns the child's thread id, or TID_ERROR if
+   it could not be set up. */
+tid_t process_fork(struct intr_frame *f)
+{
+  struct thread *cur = thread_current();
+  if (cur->ps == NULL || cur->ps->exe_file == NULL)
+    return TID_ERROR;
+
+  struct process *ps = malloc_tagged(sizeof(struct process), MEM_PROCESS);
+  if (ps == NULL)
+    return TID_ERROR;
+  lock_init(&ps->ps_lock);
+  ps->exit_status = -1;
+  ps->child_tid = -1;
+  ps->ref_count = 2;
+  ps->good_start = false;
+  ps->exe_file = NULL;
+  ps->exec_tsc = 0;
+  sema_init(&ps->user_prog_exit, 0);
+  sema_init(&ps->child_started, 0);
+
+  size_t name_size = strlen(cur->ps->user_prog_name) + 1;
+  ps->user_prog_name = malloc_tagged(name_size, MEM_PROCESS);
+  if (ps->user_prog_name == NULL)
+  {
+    free(ps);
+    return TID_ERROR;
+  }
+  strlcpy(ps->user_prog_name, cur->ps->user_prog_name, name_size);
+
+  struct fork_info info = {ps, cur, f};
+  tid_t tid = thread_create(thread_name(), NICE_DEFAULT, start_fork, &info);
+  if (tid != TID_ERROR)
+    sema_down(&ps->child_started); // child is done with info
+
+  if (tid == TID_ERROR || !ps->good_start)
+  {
+    free(ps->user_prog_name);
+    free(ps);
+    return TID_ERROR;
+  }
+
+  ps->child_tid = tid;
+  list_push_back(&cur->ps_list, &ps->elem);
+  return tid;
+}
+
+/* A thread function that turns a new thread into a copy of the
+   forking process described by INFO_ and returns to user mode
+   where the parent made the fork system call. */
+static void
+start_fork(void *info_)
+{
+  struct fork_info *info = info_;
+  struct process *ps = info->ps;
+  struct thread *parent = info->parent;
+  struct thread *cur = thread_current();
+  bool success = false;
+
+  /* Same user context, but fork() returns 0 in the child. */
+  struct intr_frame if_ = *info->if_;
+  if_.eax = 0;
+
+  cur->pagedir = pagedir_create();
+  if (cur->pagedir != NULL)
+  {
+    process_activate();
+    success = fork_files(parent, ps) && fork_spt(parent, ps->exe_file);
+  }
+
+  if (!success)
+  {
+    // process_exit() only closes it once ps is ours
+    lock_acquire(&fs_lock);
+    file_close(ps->exe_file);
+    lock_release(&fs_lock);
+    sema_up(&ps->child_started);
+    thread_exit();
+  }
+
+  ps->good_start = true;
+  cur->ps = ps;
+  cur->esp = NULL;
+  sema_up(&ps->child_started);
+
+  asm volatile("movl %0, %%esp; jmp intr_exit" : : "g"(&if_) : "memory");
+  NOT_REACHED();
+}
+
+/* Reopens PARENT's executable, file descriptors and mapped files
+   for the current thread, the child being forked with process
+   struct PS.  Descriptors keep their positions. */
+static bool
+fork_files(struct thread *parent, struct process *ps)
+{
+  struct thread *cur = thread_current();
+  bool success = false;
+
+  lock_acquire(&fs_lock);
+  ps->exe_file = file_reopen(parent->ps->exe_file);
+  if (ps->exe_file == NULL)
+    goto done;
+  file_deny_write(ps->exe_file);
+
+  if (parent->fd_table != NULL)
+  {
+    cur->fd_table = calloc_tagged(FD_MAX, sizeof(struct file *), MEM_PROCESS);
+    if (cur->fd_table == NULL)
+      goto done;
+    for (int i = FD_MIN; i < FD_MAX; i++)
+    {
+      if (parent->fd_table[i] == NULL)
+        continue;
+      cur->fd_table[i] = file_reopen(parent->fd_table[i]);
+      if (cur->fd_table[i] == NULL)
+        goto done;
+      file_seek(cur->fd_table[i], file_tell(parent->fd_table[i]));
+    }
+  }
+
+  success = fork_mapped_file_table(parent->mapped_file_table, cur->mapped_file_table);
+
+done:
+  lock_release(&fs_lock);
+  return success;
+}
+#endif
+
 /* Waits for thread TID to die and returns its exit status.  If
    it was terminated by the kernel (i.e. killed due to an
    exception), returns -1.  If TID is invalid or if it was not a
@@ -215,13 +364,18 @@ void process_exit(void)
 
 #ifdef VM
 // free/wb info before sema up
-lock_acquire(&vm_lock);
+lock_acquire(&cur->supp_pt->lock);
 
 free_mapped_file_table(cur->mapped_file_table);
 
-free_spt(cur->supp_pt);
+lock_release(&cur->supp_pt->lock);
 
-lock_release(&vm_lock);
+// kernel threads, e.g. prefetch ones, exit through here too
+if (cur->ps != NULL)
+  exception_record_process(cur->name, tid, cur->supp_pt);
+if (cur->ps != NULL && cur->ps->exe_file != NULL)
+  prepage_exit(cur->ps->exe_file, cur->supp_pt);
+free_spt(cur->supp_pt); // takes the spt lock itself, then frees it
 #endif
 
   for (struct list_elem *e = list_begin(&cur->ps_list);
@@ -322,8 +476,11 @@ void process_activate(void)
 {
   struct thread *t = thread_current();
 
-  /* Activate thread's page tables. */
-  pagedir_activate(t->pagedir);
+  /* Activate thread's page tables.  A kernel thread never
+     touches user memory, so it keeps running on whatever page
+     directory is loaded rather than reloading init_page_dir. */
+  if (t->pagedir != NULL)
+    pagedir_activate(t->pagedir);
 
   /* Set thread's kernel stack for use in processing
      interrupts. */
@@ -388,9 +545,9 @@ struct Elf32_Phdr
 #define PT_STACK 0x6474e551 /* Stack segment. */
 
 /* Flags for p_flags.  See [ELF3] 2-3 and 2-4. */
-#define PF_X 1 /* Executable. */
-#define PF_W 2 /* Writable. */
-#define PF_R 4 /* Readable. */
+#define ELF_PF_X 1 /* Executable. */
+#define ELF_PF_W 2 /* Writable. */
+#define ELF_PF_R 4 /* Readable. */
 
 static bool setup_stack(void **esp);
 static bool validate_segment(const struct Elf32_Phdr *, struct file *);
@@ -482,7 +639,7 @@ bool load(const char *file_name, struct process *ps, char **argv, int argc, void
     case PT_LOAD:
       if (validate_segment(&phdr, file))
       {
-        bool writable = (phdr.p_flags & PF_W) != 0;
+        bool writable = (phdr.p_flags & ELF_PF_W) != 0;
         uint32_t file_page = phdr.p_offset & ~PGMASK;
         uint32_t mem_page = phdr.p_vaddr & ~PGMASK;
         uint32_t page_offset = phdr.p_vaddr & PGMASK;
@@ -563,6 +720,9 @@ bool load(const char *file_name, struct process *ps, char **argv, int argc, void
   hex_dump(*esp, *esp, PHYS_BASE - (uintptr_t)*esp, true);
   */
   success = true;
+#ifdef VM
+  prepage_exec(file, t->supp_pt);
+#endif
 
  done:
   /* We arrive here whether the load is successful or not. */
@@ -660,11 +820,11 @@ load_segment (struct file *file, off_t ofs, uint8_t *upage,
         return false;
       }
       ASSERT(thread_current()->supp_pt != NULL)
-      lock_acquire(&vm_lock);
+      lock_acquire(&thread_current()->supp_pt->lock);
       struct hash_elem *ret = hash_insert(&thread_current()->supp_pt->hash_map, &page->hash_elem);
 
       ASSERT(ret == NULL);
-      lock_release(&vm_lock);
+      lock_release(&thread_current()->supp_pt->lock);
 /* Get a page of memory. */
 #else
       uint8_t *kpage = palloc_get_page(PAL_USER);
@@ -710,15 +870,16 @@ setup_stack(void **esp)
   bool success = false;
 
 #ifdef VM
-  lock_acquire(&vm_lock);
-
   struct page *page = create_page(((uint8_t *)PHYS_BASE) - PGSIZE, NULL, 0, 0, PGSIZE, true, STACK, PAGED_OUT);
   if (page == NULL)
   {
-    lock_release(&vm_lock);
     return false;
   }
-  struct frame *frame = ft_get_page_frame(thread_current(), page, true); //should stack frames be pinned? i think until end of this func after install
+  // frame comes back busy (not evictable), get it before taking the spt lock
+  struct frame *frame = ft_get_page_frame(thread_current(), page, false);
+  memset(frame->kaddr, 0, PGSIZE); // may be an evicted frame
+
+  lock_acquire(&thread_current()->supp_pt->lock);
   page->page_location = PAGED_IN; // be careful, i think we're fine
 
   kpage = frame->kaddr;
@@ -751,8 +912,11 @@ setup_stack(void **esp)
   }
 #ifdef VM
   ASSERT(kpage != NULL);
-  frame->pinned = false;
-  lock_release(&vm_lock);
+  if (success)
+  {
+    ft_frame_ready(frame);
+  }
+  lock_release(&thread_current()->supp_pt->lock);
 #endif
   return success;
 }
@@ -15,15 +15,18 @@
 #include "vm/mappedfile.h"
 #include "userprog/exception.h"
 #include "vm/swap.h"
+#include "vm/pagecache.h"
+#include "vm/prepage.h"
+#include "userprog/uaccess.h"
 
 /* Function declarations */
 static void syscall_handler (struct intr_frame *);
 static int write(int fd, const void * buffer, unsigned size);
-static bool is_valid_user_ptr(const void *ptr);
+#ifndef VM
 static bool validate_user_buffer(const void *uaddr, size_t size);
-static bool get_user_byte(const uint8_t *uaddr, uint8_t *kaddr);
-static bool copy_user_string(const char *usrc, char *kdst, size_t max_len);
-static const char *buffer_check(struct intr_frame *f, int set_eax_err);
+#endif
+static bool get_args(struct intr_frame *f, uint32_t *arg, int cnt);
+static const char *buffer_check(struct intr_frame *f, const char *ustr, int set_eax_err);
 #ifdef VM
 bool get_pinned_frames(void *uaddr, bool write, size_t size);
 void unpin_frames(void *uaddr, size_t size);
@@ -36,33 +39,8 @@ syscall_init (void)
   intr_register_int (0x30, 3, INTR_ON, syscall_handler, "syscall");
 }
 
-/* Validates that a user pointer is valid by checking that:
-   - It is not NULL
-   - Points to user virtual address space (below PHYS_BASE)
-   - Has a valid page mapping
-   Parameters:
-     - ptr: Pointer to validate
-   Returns true if valid, false otherwise.
-*/
-static bool
-is_valid_user_ptr(const void *ptr)
-{
-    struct thread *t = thread_current();
-    
-    #ifdef VM
-    // use spt into as well
-    struct supp_pt *supp_pt = t->supp_pt;
-
-    lock_acquire(&vm_lock);
-    bool ret = ptr != NULL && is_user_vaddr(ptr) && (pagedir_get_page(t->pagedir, ptr) != NULL || find_page(supp_pt, (void *)ptr) != NULL);
-    lock_release(&vm_lock);
-
-    #else
-    bool ret = ptr != NULL && is_user_vaddr(ptr) && (pagedir_get_page(t->pagedir, ptr) != NULL);
-    #endif
-
-    return ret;
-} 
+#ifndef VM
+/* With VM, buffers are pinned instead, see get_pinned_frames(). */
 
 /* Validate a buffer in user memory
    Parameters:
@@ -85,9 +63,6 @@ bool validate_user_buffer(const void *uaddr, size_t size)
 
     /* Check page directory entries */
     struct thread *t = thread_current();
-    #ifdef VM
-    struct supp_pt *supp_pt = t->supp_pt;
-    #endif
     uint32_t *pd = t->pagedir;
     
     /* Handle single page case */
@@ -99,20 +74,7 @@ bool validate_user_buffer(const void *uaddr, size_t size)
     for (void *page = pg_round_down(start); page <= end; page += PGSIZE) 
     {
         // check if page is mapped; if not, return false
-#ifdef VM
-
-    // VOLATILE THANK YOU DR. BACK
-    volatile char touch UNUSED;
-    touch = *(volatile char *)page;
-    // touch each page
-
-    lock_acquire(&vm_lock);
-    bool ret = pagedir_get_page(pd, page) == NULL && find_page(supp_pt, page) == NULL;
-    lock_release(&vm_lock);
-
-#else
     bool ret = pagedir_get_page(pd, page) == NULL;
-#endif
     if (ret)
     {
       return false;
@@ -121,119 +83,30 @@ bool validate_user_buffer(const void *uaddr, size_t size)
 
   return true;
 }
+#endif
 
-/* Copies a byte from user memory into kernel memory.
-   Parameters:
-     - uaddr: User virtual address to copy from
-     - kaddr: Kernel address to copy to
-   Returns true if successful, false if invalid user pointer 
-*/
-static bool
-get_user_byte(const uint8_t *uaddr, uint8_t *kaddr)
-{
-    if (!is_valid_user_ptr(uaddr))
-        return false;
-    
-    *kaddr = *uaddr;
-    return true;
-}
-
-/* Copy a string from user memory (similar to strlcpy)
-   Parameters:
-     - usrc: User source string
-     - kdst: Kernel destination buffer
-     - max_len: Maximum length to copy
-   Returns true if successful, false if invalid user pointer or buffer overflow
-*/
-static bool
-copy_user_string(const char *usrc, char *kdst, size_t max_len)
-{
-    /* Handle minimum buffer size */
-    if (max_len == 0)
-      return true;
-
-    /* Loop string until max len or null terminator */
-    for (size_t i = 0; i < max_len; i++) {
-      uint8_t byte;
-      const uint8_t * src = (const uint8_t *)usrc + i;
-      int result = get_user_byte(src, &byte);
-
-      if (!result){
-        return false;
-      }
-      kdst[i] = byte;
-      if (byte == '\0'){
-        return true;
-      }
-    }
-    /* Null terminate if we hit max length */
-    kdst[max_len-1] = '\0';
-    return true;
-}
-
-/* Writes a byte from kernel memory to user memory.
-   Parameters:
-     - uaddr: User virtual address to write to
-     - kbyte: Kernel byte to copy
-   Returns true if successful, false if invalid user pointer
+/* Copies the CNT 32-bit arguments that follow the syscall number on
+   the user stack into ARG.
+   Returns false if the user stack isn't all there.
 */
 static bool
-put_user_byte(uint8_t *uaddr, uint8_t kbyte)
+get_args(struct intr_frame *f, uint32_t *arg, int cnt)
 {
-    /* Check if user pointer is valid */
-    if (!is_valid_user_ptr(uaddr))
-        return false;
-
-    /* Write byte to user memory */
-    *uaddr = kbyte;
-    return true; // if byte copied successfully (no page faults)
+  return copy_from_user(arg, (uint32_t *)f->esp + 1, cnt * sizeof *arg);
 }
 
-/* Copies data from kernel memory to user memory.
-   Parameters:
-     - udst: User destination buffer
-     - ksrc: Kernel source buffer
-     - max_len: Maximum length to copy
-   Returns true if successful, false if invalid user pointer or buffer overflow
-*/
-static bool
-memcpy_to_user(void *udst, const void *ksrc, size_t max_len)
-{
-  /* user destination & kernel source pointers */
-  uint8_t *udst_ptr = udst;
-  const uint8_t *ksrc_ptr = ksrc;
-
-  /* Copy each byte from kernel to user */
-  for (size_t i = 0; i < max_len; i++)
-  {
-    if (!put_user_byte(udst_ptr + i, ksrc_ptr[i])) {
-      return false; // if any byte fails to copy
-    }
-  }
-  return true;
-}
-
-// checks the program name/file name, returns it if good; filename at esp + 4
+// copies in the program name/file name at user address ustr, returns it if good
 // pass in the value of an error (ex: 0 for false, -1, etc.) in the int
-static const char *buffer_check(struct intr_frame *f, int set_eax_err)
+static const char *buffer_check(struct intr_frame *f, const char *ustr, int set_eax_err)
 {
-  char *filename = malloc(128); // Kernel buffer, set size for now
+  char *filename = malloc_tagged(128, MEM_BUFFER); // Kernel buffer, set size for now
   if (filename == NULL)
   {
     f->eax = set_eax_err;
     exit(-1);
   }
 
-  const char *cmd_line = *((char **)(f->esp + 4));
-
-  bool valid = validate_user_buffer(f->esp + 4, 128);
-  if (!valid)
-  {
-    free(filename);
-    f->eax = set_eax_err;
-    exit(-1);
-  }
-  valid = copy_user_string(cmd_line, filename, 128);
+  bool valid = strncpy_from_user(filename, ustr, 128) >= 0;
 
   /* Check if filename is valid */
   if (!valid)
@@ -255,23 +128,13 @@ static void
 syscall_handler(struct intr_frame *f)
 {
   thread_current()->esp = f->esp; // save esp
-  // Check if user pointer is valid (i.e. is in user space)
-  if (f->esp >= PHYS_BASE || !is_valid_user_ptr(f->esp))
+  // Get the syscall number, all four bytes of it must be user memory (sc-boundary-3)
+  uint32_t sc_num;
+  if (!copy_from_user(&sc_num, f->esp, sizeof sc_num))
   {
     exit(-1);
   }
-
-  for (int i = 0; i < 4; i++)
-  {
-    uint8_t *temp = (uint8_t *)(f->esp + i); // check byte by byte for sc-boundary-3
-    if (!is_valid_user_ptr(temp + i))
-    {
-      exit(-1);
-    }
-  }
-
-  // Get the syscall number
-  uint32_t sc_num = *((uint32_t *)(f->esp));
+  uint32_t arg[3]; // syscall arguments, see get_args
 
   // Syscalls Handled Via Switch Cases
   switch (sc_num) {
@@ -280,16 +143,16 @@ syscall_handler(struct intr_frame *f)
     // read
     case SYS_READ: {
       // check ptrs
-      if (!is_valid_user_ptr(f->esp) || !is_valid_user_ptr(f->esp + 4) || !is_valid_user_ptr(f->esp + 8) || !is_valid_user_ptr(f->esp + 12))
+      if (!get_args(f, arg, 3))
       {
         f->eax = -1;
         exit(-1);
       }
 
       // extract func params
-      int fd = *((int *)(f->esp + 4));
-      const void *buffer = *((void **)(f->esp + 8));
-      unsigned size = *((unsigned *)(f->esp + 12));
+      int fd = (int) arg[0];
+      const void *buffer = (void *) arg[1];
+      unsigned size = arg[2];
       int bytes_read = -1; // default return value (if error when reading)
 
       if (size == 0)
@@ -300,14 +163,15 @@ syscall_handler(struct intr_frame *f)
       }
 
 #ifdef VM
-      lock_acquire(&vm_lock);
-      if (!get_pinned_frames((void *)buffer, false, size))
+      // the kernel writes into the buffer
+      lock_acquire(&thread_current()->supp_pt->lock);
+      if (!get_pinned_frames((void *)buffer, true, size))
       {
-        lock_release(&vm_lock);
+        lock_release(&thread_current()->supp_pt->lock);
         f->eax = -1;
         exit(-1);
       }
-      lock_release(&vm_lock);
+      lock_release(&thread_current()->supp_pt->lock);
 #else
       /* Validate buffer */
       if (!validate_user_buffer(buffer, size))
@@ -333,8 +197,14 @@ syscall_handler(struct intr_frame *f)
       /* Perform read operation */
       struct file *file = cur->fd_table[fd];
 
+#ifdef VM
+      // straight from the page cache into the pinned frames, which takes
+      // fs_lock itself
+      lock_release(&fs_lock);
+      bytes_read = pagecache_read(file, cur->pagedir, (void *)buffer, size);
+#else
       /* Allocate kernel buffer and read from file */
-      uint8_t *kern_buf = malloc(size);
+      uint8_t *kern_buf = malloc_virtual(size, MEM_BUFFER);
       if (kern_buf == NULL)
       {
         f->eax = -1;
@@ -347,24 +217,24 @@ syscall_handler(struct intr_frame *f)
 
       /* Copy to user buffer if read succeeded */
       if (bytes_read > 0) {
-        /* Re-validate buffer since page status might have changed */
-        if (!validate_user_buffer(buffer, bytes_read) ||
-            !memcpy_to_user((void *)buffer, kern_buf, bytes_read))
+        if (!copy_to_user((void *)buffer, kern_buf, bytes_read))
         {
+          free(kern_buf);
           f->eax = -1;
           exit(-1);
         }
       }
       
       free(kern_buf);
+#endif
       f->eax = bytes_read;
 
       thread_current()->esp = NULL;
 
 #ifdef VM
-      lock_acquire(&vm_lock);
+      lock_acquire(&thread_current()->supp_pt->lock);
       unpin_frames((void *)buffer, size);
-      lock_release(&vm_lock);
+      lock_release(&thread_current()->supp_pt->lock);
 #endif
 
       break;
@@ -372,25 +242,26 @@ syscall_handler(struct intr_frame *f)
 
     // write
     case SYS_WRITE: {
-      if (!is_valid_user_ptr(f->esp) || !is_valid_user_ptr(f->esp + 4) || !is_valid_user_ptr(f->esp + 8) || !is_valid_user_ptr(f->esp + 12))
+      if (!get_args(f, arg, 3))
       {
         f->eax = -1;
         exit(-1);
       }
 
-      int fd = *((int *)(f->esp + 4));
-      const void *buffer = *((void **)(f->esp + 8));
-      unsigned size = *((unsigned *)(f->esp + 12));
+      int fd = (int) arg[0];
+      const void *buffer = (void *) arg[1];
+      unsigned size = arg[2];
 
 #ifdef VM
-      lock_acquire(&vm_lock);
-      if (!get_pinned_frames((void *)buffer, true, size))
+      // the kernel only reads the buffer
+      lock_acquire(&thread_current()->supp_pt->lock);
+      if (!get_pinned_frames((void *)buffer, false, size))
       {
-        lock_release(&vm_lock);
+        lock_release(&thread_current()->supp_pt->lock);
         f->eax = -1;
         exit(-1);
       }
-      lock_release(&vm_lock);
+      lock_release(&thread_current()->supp_pt->lock);
 #else
       /* Validate buffer */
       if (!validate_user_buffer(buffer, size))
@@ -406,22 +277,22 @@ syscall_handler(struct intr_frame *f)
 
       thread_current()->esp = NULL;
 #ifdef VM
-      lock_acquire(&vm_lock);
+      lock_acquire(&thread_current()->supp_pt->lock);
       unpin_frames((void *)buffer, size);
-      lock_release(&vm_lock);
+      lock_release(&thread_current()->supp_pt->lock);
 #endif
       break;
     }
 
     case SYS_SEEK:
     {
-      if (!is_valid_user_ptr(f->esp) || !is_valid_user_ptr(f->esp + 4) || !is_valid_user_ptr(f->esp + 8))
+      if (!get_args(f, arg, 2))
       {
         exit(-1);
       }
 
-      int fd = *(int *)(f->esp + 4);
-      unsigned position = *(unsigned *)(f->esp + 8);
+      int fd = (int) arg[0];
+      unsigned position = arg[1];
 
       struct thread *cur = thread_current();
       lock_acquire(&fs_lock);
@@ -442,14 +313,14 @@ syscall_handler(struct intr_frame *f)
 
     // create
     case SYS_CREATE: {
-      if (!is_valid_user_ptr(f->esp) || !is_valid_user_ptr(f->esp + 4) || !is_valid_user_ptr(f->esp + 8))
+      if (!get_args(f, arg, 2))
       {
         f->eax = 0;
         exit(0);
       }
 
-      const char *filename = buffer_check(f, 0); // called in other syscalls with a filename buffer too, but checks byte by byte for validity
-      unsigned initial_size = *(unsigned *)(f->esp + 8);
+      const char *filename = buffer_check(f, (const char *) arg[0], 0); // called in other syscalls with a filename buffer too
+      unsigned initial_size = arg[1];
 
       if (strnlen(filename, NAME_MAX) >= NAME_MAX)
       {
@@ -470,12 +341,12 @@ syscall_handler(struct intr_frame *f)
     // open
     case SYS_OPEN:
     {
-      if (!is_valid_user_ptr(f->esp) || !is_valid_user_ptr(f->esp + 4))
+      if (!get_args(f, arg, 1))
       {
         f->eax = -1;
         exit(-1);
       }
-      const char *filename = buffer_check(f, -1);
+      const char *filename = buffer_check(f, (const char *) arg[0], -1);
 
       /* Open file */
       lock_acquire(&fs_lock);
@@ -493,7 +364,7 @@ syscall_handler(struct intr_frame *f)
 
       if (cur->fd_table == NULL) {
         // calloc (since we know the size)
-        cur->fd_table = calloc(FD_MAX, sizeof(struct file *));
+        cur->fd_table = calloc_tagged(FD_MAX, sizeof(struct file *), MEM_PROCESS);
         if (cur->fd_table == NULL)
         {
           f->eax = -1;
@@ -534,12 +405,12 @@ syscall_handler(struct intr_frame *f)
     // remove
     case SYS_REMOVE:
     {
-      if (!is_valid_user_ptr(f->esp) || !is_valid_user_ptr(f->esp + 4))
+      if (!get_args(f, arg, 1))
       {
         f->eax = 0;
         exit(0);
       }
-      const char *filename = buffer_check(f, 0);
+      const char *filename = buffer_check(f, (const char *) arg[0], 0);
 
       lock_acquire(&fs_lock);
       f->eax = filesys_remove(filename) ? 1 : 0;
@@ -552,13 +423,13 @@ syscall_handler(struct intr_frame *f)
 
     // file size
     case SYS_FILESIZE: {
-      if (!is_valid_user_ptr(f->esp) || !is_valid_user_ptr(f->esp + 4))
+      if (!get_args(f, arg, 1))
       {
         f->eax = -1;
         exit(-1);
       }
 
-      int fd = *((int *)(f->esp + 4));
+      int fd = (int) arg[0];
       struct thread *cur = thread_current();
 
       lock_acquire(&fs_lock);
@@ -581,14 +452,14 @@ syscall_handler(struct intr_frame *f)
 
     // exit
     case SYS_EXIT: {
-      if (!is_valid_user_ptr(f->esp) || !is_valid_user_ptr(f->esp + 4))
+      if (!get_args(f, arg, 1))
       {
         f->eax = -1;
         exit(-1);
       }
       else
       {
-        int status = *((int *)(f->esp + 4));
+        int status = (int) arg[0];
         f->eax = status;
         exit(status);
       }
@@ -599,14 +470,14 @@ syscall_handler(struct intr_frame *f)
 
     // wait
     case SYS_WAIT:
-      if (!is_valid_user_ptr(f->esp) || !is_valid_user_ptr(f->esp + 4))
+      if (!get_args(f, arg, 1))
       {
         f->eax = -1;
         exit(-1);
       }
       else
       {
-        tid_t pid = *((tid_t *)(f->esp + 4));
+        tid_t pid = (tid_t) arg[0];
         f->eax = process_wait(pid);
       }
 
@@ -615,12 +486,12 @@ syscall_handler(struct intr_frame *f)
 
     // exec
     case SYS_EXEC:
-      if (!is_valid_user_ptr(f->esp) || !is_valid_user_ptr(f->esp + 4))
+      if (!get_args(f, arg, 1))
       {
         f->eax = -1;
         exit(-1);
       }
-      const char *cmd_line = buffer_check(f, -1);
+      const char *cmd_line = buffer_check(f, (const char *) arg[0], -1);
       f->eax = process_execute(cmd_line);
       free((char *)cmd_line);
 
@@ -629,13 +500,13 @@ syscall_handler(struct intr_frame *f)
 
     // close
     case SYS_CLOSE: {
-      if (!is_valid_user_ptr(f->esp) || !is_valid_user_ptr(f->esp + 4))
+      if (!get_args(f, arg, 1))
       {
         f->eax = -1;
         exit(-1);
       }
 
-      int fd = *((int *)(f->esp + 4));
+      int fd = (int) arg[0];
       struct thread *cur = thread_current();
 
       lock_acquire(&fs_lock);
@@ -657,13 +528,13 @@ syscall_handler(struct intr_frame *f)
 
     // tell
     case SYS_TELL: {
-      if (!is_valid_user_ptr(f->esp) || !is_valid_user_ptr(f->esp + 4))
+      if (!get_args(f, arg, 1))
       {
         f->eax = -1;
         exit(-1);
       }
 
-      int fd = *((int *)(f->esp + 4));
+      int fd = (int) arg[0];
       struct thread *cur = thread_current();
 
       lock_acquire(&fs_lock);
@@ -691,14 +562,14 @@ syscall_handler(struct intr_frame *f)
 #ifdef VM
     case SYS_MMAP:
     {
-      if (!is_valid_user_ptr(f->esp) || !is_valid_user_ptr(f->esp + 4) || !is_valid_user_ptr(f->esp + 8))
+      if (!get_args(f, arg, 2))
       {
         f->eax = -1;
         exit(-1);
       }
 
-      int fd = *((int *)(f->esp + 4));
-      void *buffer = *((void **)(f->esp + 8));
+      int fd = (int) arg[0];
+      void *buffer = (void *) arg[1];
 
       // check NULL and aligned
       if (pg_ofs(buffer) != 0 || buffer == 0)
@@ -740,7 +611,7 @@ syscall_handler(struct intr_frame *f)
       int pages = (length + PGSIZE - 1) / PGSIZE; // round up formula
       void *curr = buffer;
 
-      lock_acquire(&vm_lock);
+      lock_acquire(&thread_current()->supp_pt->lock);
       struct supp_pt *supp_pt = cur->supp_pt;
 
       for (int i = 0; i < pages; i++)
@@ -749,7 +620,7 @@ syscall_handler(struct intr_frame *f)
         {
           f->eax = -1;
           thread_current()->esp = NULL;
-          lock_release(&vm_lock);
+          lock_release(&thread_current()->supp_pt->lock);
           return;
         }
         curr += PGSIZE;
@@ -759,7 +630,7 @@ syscall_handler(struct intr_frame *f)
       if (mapped_file == NULL)
       {
         f->eax = -1;
-        lock_release(&vm_lock);
+        lock_release(&thread_current()->supp_pt->lock);
         exit(-1);
       }
       list_push_back(&cur->mapped_file_table->list, &mapped_file->elem);
@@ -782,7 +653,7 @@ syscall_handler(struct intr_frame *f)
         if (page == NULL)
         {
           f->eax = -1;
-          lock_release(&vm_lock);
+          lock_release(&thread_current()->supp_pt->lock);
           exit(-1);
         }
         page->map_id = mapped_file->map_id;
@@ -796,7 +667,7 @@ syscall_handler(struct intr_frame *f)
 
       f->eax = mapped_file->map_id;
 
-      lock_release(&vm_lock);
+      lock_release(&thread_current()->supp_pt->lock);
 
       thread_current()->esp = NULL;
       break;
@@ -805,39 +676,63 @@ syscall_handler(struct intr_frame *f)
     // munmap
     case SYS_MUNMAP:
     {
-      if (!is_valid_user_ptr(f->esp) || !is_valid_user_ptr(f->esp + 4))
+      if (!get_args(f, arg, 1))
       {
         f->eax = -1;
         exit(-1);
       }
 
-      mapid_t mapping = *((int *)(f->esp + 4));
+      mapid_t mapping = (int) arg[0];
       struct thread *cur = thread_current();
 
-      lock_acquire(&vm_lock);
+      lock_acquire(&thread_current()->supp_pt->lock);
 
       struct mapped_file *mapped_file = find_mapped_file(cur->mapped_file_table, mapping);
 
       if (mapped_file == NULL)
       {
         f->eax = -1;
-        lock_release(&vm_lock);
+        lock_release(&thread_current()->supp_pt->lock);
         break;
       }
 
       if (!free_mapped_file(mapped_file->map_id, cur->mapped_file_table))
       {
         f->eax = -1;
-        lock_release(&vm_lock);
+        lock_release(&thread_current()->supp_pt->lock);
         break;
       }
 
-      lock_release(&vm_lock);
+      lock_release(&thread_current()->supp_pt->lock);
 
       thread_current()->esp = NULL;
 
       break;
     }
+
+    case SYS_FORK:
+      f->eax = process_fork(f);
+      thread_current()->esp = NULL;
+      break;
+
+    case SYS_MSYNC:
+    {
+      if (!get_args(f, arg, 1))
+      {
+        f->eax = -1;
+        exit(-1);
+      }
+
+      mapid_t mapping = (int) arg[0];
+      struct thread *cur = thread_current();
+
+      lock_acquire(&cur->supp_pt->lock);
+      f->eax = sync_mapped_file(mapping, cur->mapped_file_table) ? 0 : -1;
+      lock_release(&cur->supp_pt->lock);
+
+      thread_current()->esp = NULL;
+      break;
+    }
 #endif
     default:
       thread_current()->esp = NULL;
@@ -860,6 +755,9 @@ Returns:
 */
 static int write(int fd, const void * buffer, unsigned size){
   if(fd == 1){
+#ifdef VM
+    prepage_first_output();
+#endif
     lock_acquire(&fs_lock);
     unsigned count = 0;
     void *pos = (void *)buffer;
@@ -886,9 +784,19 @@ static int write(int fd, const void * buffer, unsigned size){
 
     unsigned count = 0;
     while(count < size){
+#ifdef VM
+      // a page at a time, straight out of the pinned frame
+      const void *upos = buffer + count;
+      int buffer_size = PGSIZE - pg_ofs(upos);
+      buffer_size = (size-count) < (unsigned) buffer_size ? (int) (size-count) : buffer_size;
+      const void *src = pagedir_get_page(cur->pagedir, upos);
+      ASSERT(src != NULL);
+#else
       int buffer_size = (size-count) > 207 ? 207 : size-count;
+      const void *src = buffer+count;
+#endif
 
-      off_t bytes = file_write(cur_file, buffer+count, buffer_size);
+      off_t bytes = file_write(cur_file, src, buffer_size);
       if (bytes <= 0)
       {
         break;
@@ -923,7 +831,7 @@ void exit(int status){
 }
 
 #ifdef VM
-// unpin previously pinned frames in read/write/wb related needs
+// unpin previously pinned frames in read/write/wb related needs, spt lock held
 void unpin_frames(void *uaddr, size_t size)
 {
   const void *start = uaddr;
@@ -943,15 +851,12 @@ void unpin_frames(void *uaddr, size_t size)
     struct page *page = find_page(supp_pt, curr);
     ASSERT(page != NULL && page->page_location == PAGED_IN)
 
-    struct frame *frame = get_page_frame(page);
-    ASSERT(frame != NULL);
-
-    frame->pinned = false;
+    ft_set_pinned(page, false);
     curr += PGSIZE;
   }
 }
 
-// acquire pinned frames for read/write/wb related needs
+// acquire pinned frames for read/write/wb related needs, spt lock held
 bool get_pinned_frames(void *uaddr, bool write, size_t size)
 {
   const void *start = uaddr;
@@ -971,12 +876,11 @@ bool get_pinned_frames(void *uaddr, bool write, size_t size)
   {
     struct page *page = find_page(supp_pt, curr); // continguous
 
-    if (page != NULL && page->page_location == PAGED_IN) // alr mapped/overlap
+    // alr mapped/overlap. a write may still need a cow break, which
+    // install_page_in_frame does
+    if (!write && page != NULL && page->page_location == PAGED_IN)
     {
-      struct frame *frame = get_page_frame(page);
-      ASSERT(frame != NULL);
-
-      frame->pinned = true;
+      ft_set_pinned(page, true);
       curr += PGSIZE;
       continue;
     }
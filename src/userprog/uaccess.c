@@ -0,0 +1,122 @@
+#include "userprog/uaccess.h"
+#include "threads/vaddr.h"
+
+/* An exception table entry.  A fault on user memory by the
+   instruction at INSN that the page fault handler can't resolve
+   resumes at FIXUP instead of killing the process. */
+struct exception_entry
+  {
+    uintptr_t insn;
+    uintptr_t fixup;
+  };
+
+/* The exception table, gathered from the __ex_table sections of
+   all objects by the linker script. */
+extern const struct exception_entry _start_ex_table[], _end_ex_table[];
+
+/* Returns true if [UADDR, UADDR + SIZE) is all below PHYS_BASE. */
+static bool
+user_range (const void *uaddr, size_t size)
+{
+  uintptr_t start = (uintptr_t) uaddr;
+  return (start <= (uintptr_t) PHYS_BASE
+          && size <= (uintptr_t) PHYS_BASE - start);
+}
+
+/* Copies SIZE bytes from SRC to DST, a word at a time and then
+   the bytes left over, where one of them is in user memory.
+   Returns false if a fault on it couldn't be resolved, with only
+   part of the bytes copied. */
+static bool
+copy_user (void *dst, const void *src, size_t size)
+{
+  int failed = 1;
+  size_t words = size / sizeof (uint32_t);
+
+  asm volatile ("1: rep movsl\n"
+                "   movl %[bytes], %%ecx\n"
+                "2: rep movsb\n"
+                "   xorl %[failed], %[failed]\n"
+                "3:\n"
+                ".section __ex_table, \"a\"\n"
+                "   .long 1b, 3b\n"
+                "   .long 2b, 3b\n"
+                ".previous"
+                : [failed] "+a" (failed), "+c" (words), "+S" (src), "+D" (dst)
+                : [bytes] "rm" (size % sizeof (uint32_t))
+                : "memory");
+  return !failed;
+}
+
+/* Reads the byte at user address UADDR into *BYTE.  Returns
+   false if the fault on it couldn't be resolved. */
+static inline bool
+get_user (char *byte, const char *uaddr)
+{
+  int failed = 1;
+  char b;
+
+  asm volatile ("1: movb %[src], %[b]\n"
+                "   xorl %[failed], %[failed]\n"
+                "2:\n"
+                ".section __ex_table, \"a\"\n"
+                "   .long 1b, 2b\n"
+                ".previous"
+                : [failed] "+r" (failed), [b] "=q" (b)
+                : [src] "m" (*uaddr));
+  *byte = b;
+  return !failed;
+}
+
+/* Copies SIZE bytes from user address USRC to KDST.  Returns
+   false if any of them isn't in the process's address space. */
+bool
+copy_from_user (void *kdst, const void *usrc, size_t size)
+{
+  return user_range (usrc, size) && copy_user (kdst, usrc, size);
+}
+
+/* Copies SIZE bytes from KSRC to user address UDST.  Returns
+   false if any of them isn't in the process's address space or
+   isn't writable. */
+bool
+copy_to_user (void *udst, const void *ksrc, size_t size)
+{
+  return user_range (udst, size) && copy_user (udst, ksrc, size);
+}
+
+/* Copies the null-terminated string at user address USRC to
+   KDST, which has room for SIZE bytes.  A longer string is
+   truncated to SIZE - 1 bytes, and KDST is always terminated if
+   SIZE is nonzero.  Returns the length of the copy, or -1 if the
+   string isn't in the process's address space. */
+int
+strncpy_from_user (char *kdst, const char *usrc, size_t size)
+{
+  size_t len;
+
+  if (size == 0)
+    return 0;
+  for (len = 0; len + 1 < size; len++)
+    {
+      if (!user_range (usrc + len, 1) || !get_user (&kdst[len], usrc + len))
+        return -1;
+      if (kdst[len] == '\0')
+        return len;
+    }
+  kdst[len] = '\0';
+  return len;
+}
+
+/* Returns where to resume after a fault on user memory by the
+   kernel instruction at EIP, or 0 if it has no fixup. */
+uintptr_t
+uaccess_fixup (uintptr_t eip)
+{
+  const struct exception_entry *e;
+
+  for (e = _start_ex_table; e < _end_ex_table; e++)
+    if (e->insn == eip)
+      return e->fixup;
+  return 0;
+}
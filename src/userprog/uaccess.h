@@ -0,0 +1,19 @@
+#ifndef USERPROG_UACCESS_H
+#define USERPROG_UACCESS_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Copying between kernel and user memory.  Nothing is looked up
+   beforehand: the copies just touch user memory, faults on pages
+   the process has are resolved by the page fault handler as
+   usual, and the exception table tells it where to resume when a
+   fault can't be resolved. */
+
+bool copy_from_user (void *kdst, const void *usrc, size_t size);
+bool copy_to_user (void *udst, const void *ksrc, size_t size);
+int strncpy_from_user (char *kdst, const char *usrc, size_t size);
+uintptr_t uaccess_fixup (uintptr_t eip);
+
+#endif /* userprog/uaccess.h */
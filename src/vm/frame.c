@@ -10,208 +10,1060 @@
 #include "threads/malloc.h"
 #include "vm/mappedfile.h"
 #include <stdio.h>
+#include <string.h>
 #include "userprog/syscall.h"
 #include "vm/swap.h"
+#include "vm/replace.h"
+#include "vm/pagecache.h"
+#include "threads/pte.h"
+
+// an aligned 4 MB run of user frames, which can back a user superpage.
+// a process that reserves it gets its frames for the pages of one 4 MB
+// region in order, see ft_reserve_superpage()
+struct sp_block {
+    size_t first; // index in ft->frames of the first frame
+    size_t free_cnt; // frames of the run on the free list
+    struct supp_pt *owner; // reserved by, or NULL
+    void *ubase; // region reserved for
+};
 
 // frame table
+// lock is held only while manipulating the lists, the replacement policy
+// and the pin_cnt/busy/thread/page/mappers fields of frames, never across I/O
+// frames is indexed by physical frame number (minus base_pfn), so the
+// descriptor of any user page is found in O(1) from its address
 struct frame_table {
-    struct list used_list; // used pages
+    struct frame *frames; // one descriptor per user pool page
+    size_t base_pfn; // physical frame number of frames[0]
+    size_t frame_cnt; // number of entries in frames
+
+    size_t used_cnt; // frames handed to the replacement policy
     struct list free_list; // free pages
+    struct sp_block *blocks; // superpage blocks, see struct sp_block
+    size_t block_cnt;
+
+    struct lock lock; // frame table lock
 
-    struct list_elem* clock_elem; // clock hand
+    // page cleaner: woken when the free list drops below low_wm, evicts
+    // until it is back at high_wm so faults rarely have to do the I/O
+    size_t free_cnt; // length of free_list
+    size_t low_wm, high_wm; // free frame watermarks
+    struct semaphore cleaner_wake; // upped to start a cleaner run
+    bool cleaner_active; // run requested and not yet finished
+
+    // all zeros, mapped read-only for reads of zero-fill pages never
+    // written. a kernel pool page, not a frame: never evicted
+    void *zero_page;
+
+    // statistics
+    size_t fault_evict_cnt, fault_evict_io_cnt; // evictions on the fault path
+    size_t local_evict_cnt; // of those, by a process over its resident set limit
+    size_t evict_type_cnt[STACK + 1]; // evictions, by enum page_status
+    size_t cleaner_evict_cnt, cleaner_evict_io_cnt; // evictions by the cleaner
+    size_t cleaner_runs;
+    size_t zero_map_cnt; // zero page mappings made
+    size_t reserve_cnt; // superpage blocks reserved
 };
 
 // global frame table
 static struct frame_table * ft;
 
-static struct frame * get_next_frame(struct frame *);
-static struct frame *evict_frame(void);
+// orders used frames for eviction, see vm/replace.h
+static const struct replacement_policy *policy = &twoq_policy;
+
+static void used_remove(struct frame *, bool);
+static struct frame *take_frame(void);
+static struct frame *evict_frame(bool, struct supp_pt *, bool *);
+static bool try_lock_mappers(struct frame *);
+static void unlock_mappers(struct frame *, struct list_elem *);
+static void evict_cached(struct frame *);
+static void evict_cow(struct frame *);
+static void leave_shared(struct frame *, struct page *);
+static bool needs_io(struct frame *);
+static void page_cleaner(void *);
+static void free_push(struct frame *);
+static void free_remove(struct frame *);
+static void init_blocks(void);
+static struct sp_block *find_block(struct supp_pt *, const void *);
 
 // init frame table
 void init_ft(void) {
-    ft = malloc(sizeof(struct frame_table));
+    ft = malloc_tagged(sizeof(struct frame_table), MEM_FRAME);
     if(ft == NULL){
         exit(-1);
     }
-    list_init(&ft->used_list);
     list_init(&ft->free_list);
+    lock_init(&ft->lock);
+    sema_init(&ft->cleaner_wake, 0);
+    policy->init();
 
-    ft->clock_elem = NULL;
+    ft->used_cnt = 0;
+    ft->free_cnt = 0;
+    ft->low_wm = ft->high_wm = 0;
+    ft->cleaner_active = false;
+    ft->fault_evict_cnt = ft->fault_evict_io_cnt = 0;
+    ft->local_evict_cnt = 0;
+    memset(ft->evict_type_cnt, 0, sizeof ft->evict_type_cnt);
+    ft->cleaner_evict_cnt = ft->cleaner_evict_io_cnt = 0;
+    ft->cleaner_runs = 0;
+    ft->zero_map_cnt = 0;
+    ft->reserve_cnt = 0;
+    ft->blocks = NULL;
+    ft->block_cnt = 0;
+    ft->zero_page = palloc_get_page(PAL_ZERO | PAL_TAG(MEM_USER));
+    if(ft->zero_page == NULL){
+        PANIC("no memory for the zero page");
+    }
+    pagecache_init();
+    prepage_init();
 
-    uint32_t* kpage;
+    void *kpage;
+    void *chain = NULL;
+    size_t min_pfn = SIZE_MAX, max_pfn = 0;
 
-    // pre-fetch all the pages from user pool
-    while((kpage = palloc_get_page(PAL_USER | PAL_ZERO))){
-        struct frame * frame_ptr = malloc(sizeof(struct frame));
+    // pre-fetch all the pages from user pool, chained through their first
+    // word until we know how big the descriptor array must be
+    while((kpage = palloc_get_page(PAL_USER | PAL_ZERO | PAL_TAG(MEM_USER)))){
+        size_t pfn = vtop(kpage) >> PGBITS;
+        min_pfn = pfn < min_pfn ? pfn : min_pfn;
+        max_pfn = pfn > max_pfn ? pfn : max_pfn;
+        *(void **)kpage = chain;
+        chain = kpage;
+    }
+    if(chain == NULL){
+        return;
+    }
+
+    ft->base_pfn = min_pfn;
+    ft->frame_cnt = max_pfn - min_pfn + 1;
+    ft->frames = calloc_tagged(ft->frame_cnt, sizeof(struct frame), MEM_FRAME);
+    if(ft->frames == NULL){
+        PANIC("no memory for frame table");
+    }
+
+    while(chain != NULL){
+        kpage = chain;
+        chain = *(void **)kpage;
+        *(void **)kpage = NULL;
+
+        struct frame * frame_ptr = &ft->frames[(vtop(kpage) >> PGBITS) - ft->base_pfn];
         frame_ptr->kaddr = kpage;
-        frame_ptr->pinned = false;
-        list_push_front(&ft->free_list, &frame_ptr->elem);
+        frame_ptr->pin_cnt = 0;
+        frame_ptr->busy = false;
+        frame_ptr->pcp = NULL;
+        frame_ptr->cow = false;
+        list_init(&frame_ptr->mappers);
+    }
+    init_blocks();
+    for (size_t i = 0; i < ft->frame_cnt; i++) {
+        if (ft->frames[i].kaddr != NULL) {
+            free_push(&ft->frames[i]);
+        }
+    }
+
+    // keep ~1.5% of user memory free, at least a handful of frames
+    ft->low_wm = ft->free_cnt / 64 > 4 ? ft->free_cnt / 64 : 4;
+    ft->high_wm = 2 * ft->low_wm;
+}
+
+// use the named replacement policy, only before init_ft()
+bool ft_select_policy(const char *name){
+    const struct replacement_policy *p = replacement_policy_find(name);
+    if(p == NULL){
+        return false;
     }
+    policy = p;
+    return true;
+}
+
+// true if there are more free frames than the cleaner aims for, so
+// speculative page-ins won't cause evictions
+bool ft_has_spare_frames(void){
+    lock_acquire(&ft->lock);
+    bool spare = ft->free_cnt > ft->high_wm;
+    lock_release(&ft->lock);
+    return spare;
 }
 
-// get a page frame
+// the shared zero page, to be mapped read-only for a read of a zero-fill
+// page
+void *ft_zero_page(void){
+    lock_acquire(&ft->lock);
+    ft->zero_map_cnt++;
+    lock_release(&ft->lock);
+    return ft->zero_page;
+}
+
+// start the page cleaner, swap must be initialized
+void ft_start_cleaner(void){
+    if(thread_create("pagecleaner", NICE_DEFAULT, page_cleaner, NULL) == TID_ERROR){
+        PANIC("can't start page cleaner");
+    }
+}
+
+// page cleaner thread, refills the free list up to the high watermark
+static void
+page_cleaner(void *aux UNUSED)
+{
+    for (;;) {
+        sema_down(&ft->cleaner_wake);
+
+        // the accessed bits raked over the whole run go out together
+        struct tlb_batch batch;
+        pagedir_batch_begin(&batch);
+
+        lock_acquire(&ft->lock);
+        ft->cleaner_runs++;
+        while (ft->free_cnt < ft->high_wm) {
+            bool io;
+            struct frame *frame = evict_frame(true, NULL, &io);
+            if (frame == NULL) {
+                break; // nothing evictable right now, wait for the next fault
+            }
+
+            lock_acquire(&ft->lock);
+            frame->pin_cnt = 0;
+            frame->busy = false;
+            free_push(frame);
+            ft->cleaner_evict_cnt++;
+            ft->cleaner_evict_io_cnt += io;
+        }
+        ft->cleaner_active = false;
+        lock_release(&ft->lock);
+        pagedir_batch_end();
+    }
+}
+
+// get a page frame, returned busy (not evictable) until ft_frame_ready()
+// must not be called with an spt lock held, eviction may need it
 struct frame *ft_get_page_frame(struct thread *page_thread, struct page * page, bool pinned)
 {
+    lock_acquire(&ft->lock);
+    // in a reserved region the page gets its place in the block, if free
     struct frame * frame_ptr = NULL;
-
-    // get from free list if we can
-    if(!list_empty(&ft->free_list)){
-        struct list_elem * e = list_pop_front(&ft->free_list);
-        frame_ptr = list_entry(e, struct frame, elem);
-        frame_ptr->thread = page_thread;
-        frame_ptr->page = page;
-        frame_ptr->pinned = pinned;
-        list_push_front(&ft->used_list, e);
-        return frame_ptr;
+    struct sp_block *block = find_block(page_thread->supp_pt, page->uaddr);
+    if (block != NULL) {
+        frame_ptr = &ft->frames[block->first + pt_no(page->uaddr)];
+        if (frame_ptr->free) {
+            free_remove(frame_ptr);
+        } else {
+            frame_ptr = NULL;
+        }
+    }
+    // over its resident set limit while frames are short: the process
+    // replaces one of its own pages, see vm/wset.c
+    struct supp_pt *supp_pt = page_thread->supp_pt;
+    if (frame_ptr == NULL && supp_pt->rss >= supp_pt->rss_limit && ft->free_cnt <= ft->high_wm) {
+        bool io;
+        struct tlb_batch batch;
+        pagedir_batch_begin(&batch);
+        frame_ptr = evict_frame(false, supp_pt, &io);
+        pagedir_batch_end();
+        if (frame_ptr != NULL) {
+            page_fault_event(FAULT_EV_EVICT);
+            lock_acquire(&ft->lock);
+            ft->fault_evict_cnt++;
+            ft->fault_evict_io_cnt += io;
+            ft->local_evict_cnt++;
+        }
+    }
+    if (frame_ptr == NULL) {
+        frame_ptr = take_frame();
     }
 
-    // need to evict a page frame
-    frame_ptr = evict_frame();
-    ASSERT(frame_ptr != NULL);
+    supp_pt->rss++;
+    frame_ptr->thread = page_thread;
+    frame_ptr->page = page;
+    frame_ptr->upage = pg_round_down(page->uaddr);
+    frame_ptr->pin_cnt = pinned;
+    frame_ptr->busy = true;
+    frame_ptr->pcp = NULL;
+    page->frame = frame_ptr;
+    policy->add(frame_ptr);
+    ft->used_cnt++;
 
-    if (frame_ptr != NULL) {
-        frame_ptr->thread = page_thread;
-        frame_ptr->page = page;
-        frame_ptr->pinned = pinned;
-        list_push_front(&ft->used_list, &frame_ptr->elem);
-    }
+    lock_release(&ft->lock);
     return frame_ptr;
 }
 
-// Get the next frame in the clock hand order
-static struct frame *
-get_next_frame(struct frame *current) {
-    struct list_elem *next = list_next(&current->elem);
-    if (next == list_end(&ft->used_list)) {
-        next = list_begin(&ft->used_list); // wrap around to the beginning of the list
+// get a frame for page cache entry pcp, returned busy until ft_frame_ready()
+// and pinned until ft_unpin(). same rules as ft_get_page_frame()
+struct frame *ft_get_cache_frame(struct pc_page *pcp)
+{
+    lock_acquire(&ft->lock);
+    struct frame * frame_ptr = take_frame();
+
+    frame_ptr->thread = NULL;
+    frame_ptr->page = NULL;
+    frame_ptr->upage = NULL;
+    frame_ptr->pin_cnt = 1;
+    frame_ptr->busy = true;
+    frame_ptr->pcp = pcp;
+    ASSERT(list_empty(&frame_ptr->mappers));
+    policy->add(frame_ptr);
+    ft->used_cnt++;
+
+    lock_release(&ft->lock);
+    return frame_ptr;
+}
+
+// page cache frame no longer cached, back to the free list unless it is
+// still mapped or pinned (false). caller holds the page cache lock
+bool ft_free_cache_frame(struct frame * frame){
+    lock_acquire(&ft->lock);
+    ASSERT(frame->pcp != NULL);
+    if (frame->pin_cnt > 0 || frame->busy || !list_empty(&frame->mappers)) {
+        lock_release(&ft->lock);
+        return false;
     }
-    return list_entry(next, struct frame, elem);
+    used_remove(frame, false);
+    frame->pcp = NULL;
+    frame->busy = false;
+    free_push(frame);
+    lock_release(&ft->lock);
+    return true;
 }
 
-// Evict a frame from the frame table (using clock hand algorithm)
+// take a frame from the free list, or evict one (drops the lock for I/O)
+// called and returns with the frame table lock held
 static struct frame *
-evict_frame()
+take_frame(void)
 {
-    ASSERT(lock_held_by_current_thread(&vm_lock));
+    struct frame * frame_ptr = NULL;
 
-    // first time we evict
-    if(ft->clock_elem == NULL){
-        ft->clock_elem = list_begin(&ft->used_list);
+    if(!list_empty(&ft->free_list)){
+        frame_ptr = list_entry(list_front(&ft->free_list), struct frame, elem);
+        free_remove(frame_ptr);
+    }
+    else {
+        bool io;
+        struct tlb_batch batch;
+        pagedir_batch_begin(&batch);
+        frame_ptr = evict_frame(false, NULL, &io);
+        pagedir_batch_end();
+        ASSERT(frame_ptr != NULL);
+        page_fault_event(FAULT_EV_EVICT);
+        lock_acquire(&ft->lock);
+        ft->fault_evict_cnt++;
+        ft->fault_evict_io_cnt += io;
     }
 
+    // running low, have the cleaner get ahead of the next faults
+    if(ft->free_cnt < ft->low_wm && !ft->cleaner_active){
+        ft->cleaner_active = true;
+        sema_up(&ft->cleaner_wake);
+    }
+    return frame_ptr;
+}
+
+// frame filled and mapped, may be evicted now unless pinned
+void ft_frame_ready(struct frame * frame){
+    lock_acquire(&ft->lock);
+    ASSERT(frame->busy);
+    frame->busy = false;
+    lock_release(&ft->lock);
+}
+
+// pin or unpin the frame holding page, caller holds the owner's spt lock
+// a shared frame counts one pin per mapper that wants it pinned
+void ft_set_pinned(struct page * page, bool pinned){
+    struct frame * frame = get_page_frame(page);
+    ASSERT(frame != NULL);
+
+    lock_acquire(&ft->lock);
+    if (!frame_is_shared(frame)) {
+        frame->pin_cnt = pinned;
+    }
+    else if (page->pinned != pinned) {
+        page->pinned = pinned;
+        if (pinned) {
+            frame->pin_cnt++;
+        }
+        else {
+            ASSERT(frame->pin_cnt > 0);
+            frame->pin_cnt--;
+        }
+    }
+    lock_release(&ft->lock);
+}
+
+// take or drop a pin on a page cache frame
+void ft_pin(struct frame * frame){
+    lock_acquire(&ft->lock);
+    ASSERT(frame->pcp != NULL);
+    frame->pin_cnt++;
+    lock_release(&ft->lock);
+}
+
+void ft_unpin(struct frame * frame){
+    lock_acquire(&ft->lock);
+    ASSERT(frame->pcp != NULL && frame->pin_cnt > 0);
+    frame->pin_cnt--;
+    lock_release(&ft->lock);
+}
+
+// page is now mapped read-only onto page cache frame, which the caller
+// pinned. the pin stays with page if pinned, else it is dropped. caller
+// holds the owner's spt lock
+void ft_map_shared(struct frame * frame, struct page * page, bool pinned){
+    lock_acquire(&ft->lock);
+    ASSERT(frame->pcp != NULL && frame->pin_cnt > 0);
+    list_push_back(&frame->mappers, &page->mapper_elem);
+    page->frame = frame;
+    page->pinned = pinned;
+    if (!pinned) {
+        frame->pin_cnt--;
+    }
+    lock_release(&ft->lock);
+}
+
+// unmap page from shared frame. a page cache frame stays cached, a
+// copy-on-write frame is freed with its last mapper. caller holds the
+// owner's spt lock
+void ft_unmap_shared(struct frame * frame, struct page * page){
+    lock_acquire(&ft->lock);
+    ASSERT(frame_is_shared(frame) && page->frame == frame);
+    leave_shared(frame, page);
+    pagedir_clear_page(page->thread->pagedir, pg_round_down(page->uaddr));
+    page->page_location = PAGED_OUT;
+    page->frame = NULL;
+    lock_release(&ft->lock);
+}
+
+// take page off shared frame's mappers with its pin, free the frame if
+// it was the last to share it copy-on-write. frame table lock held
+static void
+leave_shared(struct frame *frame, struct page *page) {
+    list_remove(&page->mapper_elem);
+    if (page->pinned) {
+        ASSERT(frame->pin_cnt > 0);
+        frame->pin_cnt--;
+        page->pinned = false;
+    }
+    if (frame->cow && list_empty(&frame->mappers)) {
+        ASSERT(frame->pin_cnt == 0 && !frame->busy);
+        used_remove(frame, false);
+        frame->cow = false;
+        free_push(frame);
+    }
+}
+
+// fork: child_page gets parent_page's resident anonymous frame, shared
+// copy-on-write from now on. the caller maps both read-only. caller holds
+// both spt locks
+void ft_share_cow(struct page * parent_page, struct page * child_page){
+    struct frame * frame = get_page_frame(parent_page);
+    ASSERT(frame != NULL);
+
+    lock_acquire(&ft->lock);
+    ASSERT(frame->pcp == NULL && !frame->busy);
+    if (!frame->cow) {
+        // the parent is in the fork syscall, it can't have it pinned
+        ASSERT(frame->pin_cnt == 0);
+        frame->thread->supp_pt->rss--;
+        frame->cow = true;
+        frame->thread = NULL;
+        frame->page = NULL;
+        frame->upage = NULL;
+        parent_page->pinned = false;
+        list_push_back(&frame->mappers, &parent_page->mapper_elem);
+    }
+    list_push_back(&frame->mappers, &child_page->mapper_elem);
+    child_page->frame = frame;
+    child_page->pinned = false;
+    lock_release(&ft->lock);
+}
+
+// write fault on copy-on-write frame by page: if nobody else shares it any
+// more, it becomes page's own frame (true) and only needs to be mapped
+// writable. caller holds the owner's spt lock
+bool ft_cow_take(struct frame * frame, struct page * page){
+    lock_acquire(&ft->lock);
+    ASSERT(frame->cow && page->frame == frame);
+    bool alone = list_size(&frame->mappers) == 1;
+    if (alone) {
+        list_remove(&page->mapper_elem);
+        frame->cow = false;
+        frame->thread = page->thread;
+        frame->thread->supp_pt->rss++;
+        frame->page = page;
+        frame->upage = pg_round_down(page->uaddr);
+        frame->pin_cnt = page->pinned;
+        page->pinned = false;
+    }
+    lock_release(&ft->lock);
+    return alone;
+}
+
+// page has copied copy-on-write frame into a frame of its own, which the
+// caller maps in its place: stop sharing frame. caller holds the owner's
+// spt lock
+void ft_cow_copied(struct frame * frame, struct page * page){
+    lock_acquire(&ft->lock);
+    ASSERT(frame->cow);
+    leave_shared(frame, page);
+    lock_release(&ft->lock);
+}
+
+// true if frame was accessed since the last call, clears the accessed bit
+// of every mapping. frame table lock held
+bool ft_test_accessed(struct frame * frame){
+    if (!frame_is_shared(frame)) {
+        bool accessed = pagedir_is_accessed(frame->thread->pagedir, frame->upage);
+        pagedir_set_accessed(frame->thread->pagedir, frame->upage, false);
+        return accessed;
+    }
+
+    bool accessed = false;
+    for (struct list_elem *e = list_begin(&frame->mappers); e != list_end(&frame->mappers); e = list_next(e)) {
+        struct page *page = list_entry(e, struct page, mapper_elem);
+        void *upage = pg_round_down(page->uaddr);
+        if (pagedir_is_accessed(page->thread->pagedir, upage)) {
+            pagedir_set_accessed(page->thread->pagedir, upage, false);
+            accessed = true;
+        }
+    }
+    return accessed;
+}
+
+// take a frame away from the replacement policy
+static void
+used_remove(struct frame *frame, bool evicted) {
+    policy->remove(frame, evicted);
+    ft->used_cnt--;
+    if (!frame_is_shared(frame)) {
+        frame->thread->supp_pt->rss--;
+    }
+}
+
+// true if evicting frame means writing it out, racy but only a hint
+static bool
+needs_io(struct frame *frame) {
+    if (frame->pcp != NULL) {
+        return false; // page cache frames are never dirty
+    }
+    if (frame->cow) {
+        return true; // goes to swap, nobody can tell if it's still there
+    }
+    switch (frame->page->page_status) {
+        case CODE:
+            return false;
+        case DATA_BSS:
+        case STACK:
+            // unmodified since swapped in, its slot still has it
+            if (frame->page->swap_index != UINT32_MAX) {
+                return pagedir_is_dirty(frame->thread->pagedir, frame->upage);
+            }
+            return true;
+        default:
+            return pagedir_is_dirty(frame->thread->pagedir, frame->upage);
+    }
+}
+
+// Evict a frame from the frame table, in the replacement policy's order
+// called with the frame table lock held, returns with it released and the
+// victim off all lists. the victim's owner's spt lock is only try-acquired
+// (the owner may hold it while waiting for the frame table lock), and both
+// locks are dropped while the page is written out
+// on the fault path frames that need I/O are passed over for the first two
+// laps, the cleaner takes them as they come and gets NULL (lock still held)
+// instead of waiting when nothing can be evicted. so does a process over
+// its resident set limit, which only evicts private frames of its own
+// (only). frames of deactivated processes go regardless of their accessed
+// bits. *io tells if we wrote
+static struct frame *
+evict_frame(bool cleaner, struct supp_pt *only, bool *io)
+{
+    ASSERT(lock_held_by_current_thread(&ft->lock));
+
     struct frame *victim = NULL;
-    struct frame *curr = list_entry(ft->clock_elem, struct frame, elem);
-    ASSERT(curr != NULL);
+    struct supp_pt *supp_pt = NULL;
+    size_t scanned = 0;
 
     while (victim == NULL) {
-        ASSERT(curr->page != NULL && curr->page->page_location == PAGED_IN && curr->thread->pagedir != NULL); // used list attributes
-        
-        // skip if pinned
-        if (curr->pinned == true) {
-            curr = get_next_frame(curr);
+        size_t used = ft->used_cnt;
+
+        // everything busy, pinned or locked by its owner: let them finish
+        if (used == 0 || scanned > 3 * used) {
+            if (cleaner || only != NULL) {
+                return NULL;
+            }
+            lock_release(&ft->lock);
+            thread_yield();
+            lock_acquire(&ft->lock);
+            scanned = 0;
             continue;
         }
 
-        // check if the frame has been accessed
-        bool accessed = pagedir_is_accessed(curr->thread->pagedir, curr->page->uaddr);
+        struct frame *curr = policy->next();
+        scanned++;
 
-        // trail is clean, get our victim to evict
-        if (!accessed) {
-            victim = curr;
-            victim->pinned = true;
-            victim->page->page_location = IN_TRANSIT;
+        // skip if pinned or in the middle of I/O
+        if (curr->pin_cnt > 0 || curr->busy) {
+            continue;
+        }
+        ASSERT(frame_is_shared(curr) || (curr->page != NULL && curr->thread->pagedir != NULL)); // used list attributes
+        if (only != NULL && (frame_is_shared(curr) || curr->thread->supp_pt != only)) {
+            continue;
+        }
 
-            ASSERT(victim->thread->pagedir != NULL);
+        // check if the frame has been accessed (rakes the trail)
+        bool inactive = !frame_is_shared(curr) && curr->thread->supp_pt->inactive;
+        if (ft_test_accessed(curr) && !inactive) {
+            policy->referenced(curr);
+            continue;
+        }
 
-            // clear the accessed bit, not present
-            pagedir_clear_page(victim->thread->pagedir, pg_round_down(victim->page->uaddr));
+        // rather drop a clean page, the cleaner writes the dirty ones
+        if (!cleaner && scanned <= 2 * used && needs_io(curr)) {
+            continue;
+        }
 
-            // set clock hand
-            ft->clock_elem = &get_next_frame(victim)->elem;
-            list_remove(&victim->elem);
+        // shared: needs every mapper (and the page cache for its frames)
+        if (frame_is_shared(curr)) {
+            if (!try_lock_mappers(curr)) {
+                continue;
+            }
+            *io = curr->cow;
+            // copy-on-write frames hold data, bss or stack pages, the page
+            // cache only code
+            enum page_status status = CODE;
+            if (curr->cow) {
+                status = list_entry(list_front(&curr->mappers), struct page, mapper_elem)->page_status;
+            }
+            ft->evict_type_cnt[status]++;
+            if (curr->cow) {
+                evict_cow(curr); // releases the frame table lock
+            }
+            else {
+                evict_cached(curr);
+                lock_release(&ft->lock);
+            }
+            return curr;
+        }
 
-            break;
-        } else {
-            // rake the trail
-            pagedir_set_accessed(curr->thread->pagedir, curr->page->uaddr, false);
-            curr = get_next_frame(curr);
+        // trail is clean, get our victim to evict if its owner lets us
+        supp_pt = curr->thread->supp_pt;
+        if (lock_held_by_current_thread(&supp_pt->lock) || !lock_try_acquire(&supp_pt->lock)) {
             continue;
         }
+        victim = curr;
+    }
+
+    struct page *page = victim->page;
+    uint32_t *pd = victim->thread->pagedir;
+    ASSERT(page->page_location == PAGED_IN);
+
+    victim->busy = true;
+    used_remove(victim, true);
+    ft->evict_type_cnt[page->page_status]++;
+    lock_release(&ft->lock);
+
+    page->page_location = IN_TRANSIT;
+    page->frame = NULL;
+
+    // clear the accessed bit, not present. the dirty bit survives in the
+    // pte, read it afterwards so a racing user write can't be lost
+    pagedir_clear_page(pd, victim->upage);
+    bool dirty = pagedir_is_dirty(pd, victim->upage);
+
+    struct file *wb_file = NULL;
+    if ((page->page_status == MMAP || page->page_status == MUNMAP) && dirty) {
+        struct mapped_file * mapped_file = find_mapped_file(victim->thread->mapped_file_table, page->map_id);
+        ASSERT(mapped_file != NULL);
+        wb_file = mapped_file->file;
+    }
+
+    // swapped in and not written since: the slot still holds the page
+    size_t kept_slot = page->swap_index;
+    if (kept_slot != UINT32_MAX && dirty) {
+        st_free_page(kept_slot);
+        kept_slot = page->swap_index = UINT32_MAX;
     }
+    lock_release(&supp_pt->lock);
 
-    switch (victim->page->page_status) {
+    // page I/O without any vm lock held, the owner waits on page->transit
+    *io = ((page->page_status == DATA_BSS || page->page_status == STACK) && kept_slot == UINT32_MAX)
+          || wb_file != NULL;
+    enum page_location new_location = PAGED_OUT;
+    size_t swap_index = UINT32_MAX;
+    switch (page->page_status) {
         // no need to write back code pages (just a read-only page)
         case CODE:
-            victim->page->page_location = PAGED_OUT;
             break;
 
-        // DATA, BSS, STACK: write to swap if dirty
+        // DATA, BSS, STACK: write to swap unless the kept slot has it
         case DATA_BSS:
         case STACK:
-            victim->page->page_location = SWAP;
-            ASSERT(victim->page->swap_index == UINT32_MAX);
-
-            victim->page->swap_index = st_write_at(victim->kaddr);
+            new_location = SWAP;
+            if (kept_slot != UINT32_MAX) {
+                swap_index = kept_slot;
+                st_page_dropped();
+            }
+            else {
+                swap_index = st_write_at(victim->kaddr, supp_pt, page);
+            }
             break;
 
         // MMAP: wb to file if dirty
         case MUNMAP: // won't hit here
         case MMAP:
-            if (pagedir_is_dirty(victim->thread->pagedir, victim->page->uaddr)) {
-                struct mapped_file * mapped_file = find_mapped_file(victim->thread->mapped_file_table, victim->page->map_id);
-                ASSERT(mapped_file != NULL);
-
-                lock_release(&vm_lock);
+            if (wb_file != NULL) {
                 lock_acquire(&fs_lock);
-                
-                file_write_at(mapped_file->file, victim->kaddr, victim->page->read_bytes, victim->page->ofs);
-                
+                file_write_at(wb_file, victim->kaddr, page->read_bytes, page->ofs);
                 lock_release(&fs_lock);
-                lock_acquire(&vm_lock);
             }
-            victim->page->page_location = PAGED_OUT;
-
             break;
         default:
-            victim->page->page_location = PAGED_OUT;
             break;
     }
-    cond_broadcast(&victim->page->transit, &vm_lock); // for eviction
+
+    lock_acquire(&supp_pt->lock);
+    page->page_location = new_location;
+    page->swap_index = swap_index;
+    cond_broadcast(&page->transit, &supp_pt->lock); // for eviction
+    lock_release(&supp_pt->lock);
 
     victim->thread = NULL;
     victim->page = NULL;
+    victim->upage = NULL;
 
     // frame fields set after return
     return victim;
 }
 
-// used page frame added to free list
+// try to take the locks evicting shared frame needs: the spt lock of
+// every process mapping it, and the page cache lock for a page cache
+// frame. all or nothing
+static bool
+try_lock_mappers(struct frame *frame) {
+    if (frame->pcp != NULL && !pagecache_try_lock()) {
+        return false;
+    }
+
+    struct list_elem *e;
+    for (e = list_begin(&frame->mappers); e != list_end(&frame->mappers); e = list_next(e)) {
+        struct supp_pt *supp_pt = list_entry(e, struct page, mapper_elem)->thread->supp_pt;
+        if (lock_held_by_current_thread(&supp_pt->lock) || !lock_try_acquire(&supp_pt->lock)) {
+            break;
+        }
+    }
+    if (e == list_end(&frame->mappers)) {
+        return true;
+    }
+
+    unlock_mappers(frame, e);
+    if (frame->pcp != NULL) {
+        pagecache_unlock();
+    }
+    return false;
+}
+
+// release the spt locks of frame's mappers up to end
+static void
+unlock_mappers(struct frame *frame, struct list_elem *end) {
+    for (struct list_elem *e = list_begin(&frame->mappers); e != end; e = list_next(e)) {
+        lock_release(&list_entry(e, struct page, mapper_elem)->thread->supp_pt->lock);
+    }
+}
+
+// evict a page cache frame locked by try_lock_mappers(): unmap it from
+// every process and drop it from the page cache, releasing those locks.
+// the contents are always on disk, nothing to write
+static void
+evict_cached(struct frame *victim) {
+    used_remove(victim, true);
+    victim->busy = true;
+
+    while (!list_empty(&victim->mappers)) {
+        struct page *page = list_entry(list_pop_front(&victim->mappers), struct page, mapper_elem);
+        struct supp_pt *supp_pt = page->thread->supp_pt;
+
+        ASSERT(page->page_location == PAGED_IN && !page->pinned);
+        pagedir_clear_page(page->thread->pagedir, pg_round_down(page->uaddr));
+        page->page_location = PAGED_OUT;
+        page->frame = NULL;
+        lock_release(&supp_pt->lock);
+    }
+
+    pagecache_evicted(victim->pcp);
+    victim->pcp = NULL;
+}
+
+// evict a copy-on-write frame locked by try_lock_mappers(), called with
+// the frame table lock held and returns with it and the spt locks
+// released. the page is written to one swap slot that all its mappers
+// share. they wait on page->transit like for any eviction meanwhile
+static void
+evict_cow(struct frame *victim) {
+    used_remove(victim, true);
+    victim->busy = true;
+
+    for (struct list_elem *e = list_begin(&victim->mappers); e != list_end(&victim->mappers); e = list_next(e)) {
+        struct page *page = list_entry(e, struct page, mapper_elem);
+        ASSERT(page->page_location == PAGED_IN && !page->pinned);
+        pagedir_clear_page(page->thread->pagedir, pg_round_down(page->uaddr));
+        page->page_location = IN_TRANSIT;
+        page->frame = NULL;
+    }
+    unlock_mappers(victim, list_end(&victim->mappers));
+    lock_release(&ft->lock);
+
+    // nobody else touches the list while the pages are in transit
+    struct page *first = list_entry(list_front(&victim->mappers), struct page, mapper_elem);
+    size_t swap_index = st_write_at(victim->kaddr, first->thread->supp_pt, first);
+
+    while (!list_empty(&victim->mappers)) {
+        struct page *page = list_entry(list_pop_front(&victim->mappers), struct page, mapper_elem);
+        struct supp_pt *supp_pt = page->thread->supp_pt;
+        if (page != first) {
+            st_dup_page(swap_index);
+        }
+
+        lock_acquire(&supp_pt->lock);
+        page->page_location = SWAP;
+        page->swap_index = swap_index;
+        cond_broadcast(&page->transit, &supp_pt->lock);
+        lock_release(&supp_pt->lock);
+    }
+    victim->cow = false;
+}
+
+// background writeback: the next resident private mmap page from frame
+// *cursor on that is dirty and wasn't accessed since the last look. the
+// accessed bit is raked like the evictor does, so a page still being
+// written to is left to collect more writes. returns it with the spt lock
+// of its owner (*owner) held, NULL at the end of the table
+struct page *ft_next_dirty_mmap(size_t *cursor, struct thread **owner){
+    struct page *page = NULL;
+    struct tlb_batch batch;
+    pagedir_batch_begin(&batch);
+
+    lock_acquire(&ft->lock);
+    for (; *cursor < ft->frame_cnt; (*cursor)++) {
+        struct frame *frame = &ft->frames[*cursor];
+        if (frame->page == NULL || frame_is_shared(frame) || frame->pin_cnt > 0 || frame->busy
+            || frame->page->page_status != MMAP
+            || !pagedir_is_dirty(frame->thread->pagedir, frame->upage)) {
+            continue;
+        }
+        if (ft_test_accessed(frame)) {
+            policy->referenced(frame);
+            continue;
+        }
+        if (!lock_try_acquire(&frame->thread->supp_pt->lock)) {
+            continue;
+        }
+        page = frame->page;
+        *owner = frame->thread;
+        (*cursor)++;
+        break;
+    }
+    lock_release(&ft->lock);
+    pagedir_batch_end();
+    return page;
+}
+
+// mark a resident private frame busy while it is written out in place, so
+// the evictor passes it over. false if it is pinned or already busy.
+// ft_frame_ready() ends it. caller holds the owner's spt lock
+bool ft_try_busy(struct frame * frame){
+    lock_acquire(&ft->lock);
+    ASSERT(!frame_is_shared(frame));
+    bool idle = frame->pin_cnt == 0 && !frame->busy;
+    if (idle) {
+        frame->busy = true;
+    }
+    lock_release(&ft->lock);
+    return idle;
+}
+
+// used page frame added to free list, caller holds the owner's spt lock
 void page_frame_freed(struct frame * frame){
-    list_remove(&frame->elem);
+    lock_acquire(&ft->lock);
+    used_remove(frame, false);
     ASSERT(frame->thread->pagedir != NULL);
     ASSERT(frame->page != NULL);
 
     uint32_t * pd = frame->thread->pagedir;
     frame->thread = NULL;
 
-    pagedir_clear_page(pd, pg_round_down(frame->page->uaddr));
+    pagedir_clear_page(pd, frame->upage);
     struct page * page = frame->page;
     page->page_location = PAGED_OUT;
+    page->frame = NULL;
     frame->page = NULL;
-    frame->pinned = false;
-    list_push_front(&ft->free_list, &frame->elem);
+    frame->upage = NULL;
+    frame->pin_cnt = 0;
+    frame->busy = false;
+    free_push(frame);
+    lock_release(&ft->lock);
 }
 
-// get page frame corresponding to a page
+// get page frame corresponding to a page, caller holds the owner's spt lock
 struct frame * get_page_frame(struct page * page){
-    for (struct list_elem *e = list_begin(&ft->used_list); e != list_end(&ft->used_list); e = list_next(e)){
-        struct frame *frame = list_entry(e, struct frame, elem);
+    ASSERT(page->frame == NULL || page->frame->page == page || frame_is_shared(page->frame));
+    return page->frame;
+}
+
+// print frame table statistics
+void ft_print_stats(void){
+    if(ft == NULL){
+        return;
+    }
+    printf("Frames: %s replacement, %zu evicted on fault (%zu written, %zu local), %zu evicted by cleaner (%zu written) in %zu runs, %zu zero page mappings, %zu superpage reservations\n",
+           policy->name, ft->fault_evict_cnt, ft->fault_evict_io_cnt, ft->local_evict_cnt,
+           ft->cleaner_evict_cnt, ft->cleaner_evict_io_cnt, ft->cleaner_runs,
+           ft->zero_map_cnt, ft->reserve_cnt);
+    printf("Frames: evicted %zu code, %zu data/bss, %zu stack, %zu mmap pages\n",
+           ft->evict_type_cnt[CODE], ft->evict_type_cnt[DATA_BSS], ft->evict_type_cnt[STACK],
+           ft->evict_type_cnt[MMAP] + ft->evict_type_cnt[MUNMAP]);
+}
 
-        ASSERT(frame->page != NULL);
+// put a free frame on the free list. frames of a reserved block go to the
+// back, they're handed to others only once nothing else is left
+static void
+free_push(struct frame *frame)
+{
+    frame->free = true;
+    ft->free_cnt++;
+    if (frame->block != NULL) {
+        frame->block->free_cnt++;
+        if (frame->block->owner != NULL) {
+            list_push_back(&ft->free_list, &frame->elem);
+            return;
+        }
+    }
+    list_push_front(&ft->free_list, &frame->elem);
+}
+
+// take a frame off the free list
+static void
+free_remove(struct frame *frame)
+{
+    ASSERT(frame->free);
+    list_remove(&frame->elem);
+    frame->free = false;
+    ft->free_cnt--;
+    if (frame->block != NULL) {
+        frame->block->free_cnt--;
+    }
+}
+
+// find the aligned 4 MB runs of the user pool, frames aren't free yet
+static void
+init_blocks(void)
+{
+    size_t per_block = PTSPAN / PGSIZE;
+    size_t first = (per_block - ft->base_pfn % per_block) % per_block;
+
+    ft->block_cnt = first < ft->frame_cnt ? (ft->frame_cnt - first) / per_block : 0;
+    if (ft->block_cnt == 0) {
+        return;
+    }
+    ft->blocks = calloc_tagged(ft->block_cnt, sizeof(struct sp_block), MEM_FRAME);
+    if (ft->blocks == NULL) {
+        ft->block_cnt = 0;
+        return;
+    }
+    size_t cnt = 0;
+    for (size_t b = 0; b < ft->block_cnt; b++) {
+        struct sp_block *block = &ft->blocks[cnt];
+        block->first = first + b * per_block;
+        size_t i;
+        for (i = 0; i < per_block; i++) {
+            if (ft->frames[block->first + i].kaddr == NULL) {
+                break; // a hole, not all of it is user pool
+            }
+        }
+        if (i == per_block) {
+            for (i = 0; i < per_block; i++) {
+                ft->frames[block->first + i].block = block;
+            }
+            cnt++;
+        }
+    }
+    ft->block_cnt = cnt;
+}
 
-        if(frame->page == page){
-            return frame;
+// block reserved by spt for the 4 MB region holding upage, or NULL.
+// frame table lock held
+static struct sp_block *
+find_block(struct supp_pt *spt, const void *upage)
+{
+    void *ubase = (void *) ((uintptr_t) upage & ~LPGMASK);
+    for (size_t b = 0; b < ft->block_cnt; b++) {
+        if (ft->blocks[b].owner == spt && ft->blocks[b].ubase == ubase) {
+            return &ft->blocks[b];
         }
     }
     return NULL;
 }
+
+// true if spt has no block for the 4 MB region at ubase and a completely
+// free one is there to reserve
+bool ft_superpage_wanted(struct supp_pt *spt, const void *ubase)
+{
+    bool wanted = false;
+    lock_acquire(&ft->lock);
+    if (find_block(spt, ubase) == NULL) {
+        for (size_t b = 0; b < ft->block_cnt && !wanted; b++) {
+            wanted = ft->blocks[b].owner == NULL
+                     && ft->blocks[b].free_cnt == PTSPAN / PGSIZE;
+        }
+    }
+    lock_release(&ft->lock);
+    return wanted;
+}
+
+// reserve a free block for the 4 MB region at ubase of spt: the region's
+// pages get its frames in order, so the region can be mapped as one
+// superpage once they are all in. false if no block is free
+bool ft_reserve_superpage(struct supp_pt *spt, const void *ubase)
+{
+    ASSERT(((uintptr_t) ubase & LPGMASK) == 0);
+    lock_acquire(&ft->lock);
+    struct sp_block *block = NULL;
+    for (size_t b = 0; b < ft->block_cnt; b++) {
+        if (ft->blocks[b].owner == NULL && ft->blocks[b].free_cnt == PTSPAN / PGSIZE) {
+            block = &ft->blocks[b];
+            break;
+        }
+    }
+    if (block != NULL) {
+        block->owner = spt;
+        block->ubase = (void *) ubase;
+        ft->reserve_cnt++;
+        for (size_t i = 0; i < PTSPAN / PGSIZE; i++) {
+            struct frame *frame = &ft->frames[block->first + i];
+            list_remove(&frame->elem);
+            list_push_back(&ft->free_list, &frame->elem);
+        }
+    }
+    lock_release(&ft->lock);
+    return block != NULL;
+}
+
+// true if every frame of spt's block for the 4 MB region at ubase is in
+// use, the region may be mappable as a superpage now
+bool ft_superpage_full(struct supp_pt *spt, const void *ubase)
+{
+    lock_acquire(&ft->lock);
+    struct sp_block *block = find_block(spt, ubase);
+    bool full = block != NULL && block->free_cnt == 0;
+    lock_release(&ft->lock);
+    return full;
+}
+
+// drop spt's reservations, the process is exiting
+void ft_release_superpages(struct supp_pt *spt)
+{
+    lock_acquire(&ft->lock);
+    for (size_t b = 0; b < ft->block_cnt; b++) {
+        if (ft->blocks[b].owner == spt) {
+            ft->blocks[b].owner = NULL;
+            ft->blocks[b].ubase = NULL;
+        }
+    }
+    lock_release(&ft->lock);
+}
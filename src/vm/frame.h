@@ -12,12 +12,59 @@ struct frame {
     void * kaddr; // kernel/phys addr
     struct thread* thread; //given by caller
     struct page * page; // back pointer to page in SPT, given by caller
+    void * upage; // reverse map: user page in thread's address space
     struct list_elem elem; //list elem
-    bool pinned; // eviction, pinning, given by caller
+    unsigned pin_cnt; // pins held by syscalls and mappers being set up, not evictable
+    bool busy; // being filled or evicted, not evictable
+    struct pc_page * pcp; // page cache entry if the frame belongs to the page cache
+    bool cow; // anonymous memory shared copy-on-write since a fork
+    struct list mappers; // struct pages mapping a shared frame (frame table lock)
+    bool active; // replacement policy state, see vm/replace.c
+    bool referenced;
+    bool free; // on the free list
+    struct sp_block * block; // aligned 4 MB run it is part of, or NULL
 };
 
+struct pc_page;
+struct supp_pt;
+
+// a shared frame is mapped by the pages on its mappers list rather than by
+// frame->page: a page cache frame or a copy-on-write one
+static inline bool frame_is_shared(const struct frame *frame) {
+    return frame->pcp != NULL || frame->cow;
+}
+
 void init_ft(void);
+bool ft_select_policy(const char *name);
+void ft_start_cleaner(void);
+bool ft_has_spare_frames(void);
+void *ft_zero_page(void);
+void ft_print_stats(void);
 struct frame* ft_get_page_frame(struct thread*, struct page * page, bool);
 void page_frame_freed(struct frame * frame);
 struct frame * get_page_frame(struct page * page);
+void ft_frame_ready(struct frame * frame);
+void ft_set_pinned(struct page * page, bool pinned);
+bool ft_test_accessed(struct frame * frame);
+struct page *ft_next_dirty_mmap(size_t *cursor, struct thread **owner);
+bool ft_try_busy(struct frame * frame);
+
+// 4 MB superpage reservations, see vm/page.c
+bool ft_superpage_wanted(struct supp_pt *spt, const void *ubase);
+bool ft_reserve_superpage(struct supp_pt *spt, const void *ubase);
+bool ft_superpage_full(struct supp_pt *spt, const void *ubase);
+void ft_release_superpages(struct supp_pt *spt);
+
+// page cache frames, see vm/pagecache.c
+struct frame * ft_get_cache_frame(struct pc_page * pcp);
+bool ft_free_cache_frame(struct frame * frame);
+void ft_pin(struct frame * frame);
+void ft_unpin(struct frame * frame);
+void ft_map_shared(struct frame * frame, struct page * page, bool pinned);
+void ft_unmap_shared(struct frame * frame, struct page * page);
+
+// copy-on-write frames, see vm/page.c fork_spt()
+void ft_share_cow(struct page * parent_page, struct page * child_page);
+bool ft_cow_take(struct frame * frame, struct page * page);
+void ft_cow_copied(struct frame * frame, struct page * page);
 #endif
\ No newline at end of file
@@ -5,26 +5,60 @@
 #include "threads/palloc.h"
 #include "threads/vaddr.h"
 #include "userprog/pagedir.h"
+#include "devices/timer.h"
+#include "lib/string.h"
 
-mapid_t id;
+#define WB_PAGES 8 // most dirty pages coalesced into one file write
+#define WB_INTERVAL TIMER_FREQ // ticks between background writeback passes
+
+mapid_t id = -1; // last id handed out, ids are never reused
+
+// statistics, fs_lock
+static size_t wb_page_cnt, wb_write_cnt, wb_pass_cnt;
+
+static bool wb_candidate(struct thread *owner, struct page *page, struct mapped_file *mapped_file);
+static size_t writeback_run(struct thread *owner, struct page *page, uint8_t *buf);
+static void mmap_writeback(void *aux);
 
 // init mapped_file_table
 struct mapped_file_table *create_mapped_file_table()
 {
-    struct mapped_file_table * mapped_file_table = malloc(sizeof(struct mapped_file_table));
+    struct mapped_file_table * mapped_file_table = malloc_tagged(sizeof(struct mapped_file_table), MEM_MMAP);
     if (mapped_file_table == NULL)
     {
         return NULL;
     }
     list_init(&mapped_file_table->list);
-    id = -1;
     return mapped_file_table;
 }
 
+// fork: copy parent's mapped files into the empty table child, on files of
+// their own with the same ids. fs_lock held
+bool fork_mapped_file_table(struct mapped_file_table *parent, struct mapped_file_table *child)
+{
+    for (struct list_elem *e = list_begin(&parent->list); e != list_end(&parent->list); e = list_next(e)){
+        struct mapped_file *mapped_file = list_entry(e, struct mapped_file, elem);
+        struct mapped_file *copy = malloc_tagged(sizeof(struct mapped_file), MEM_MMAP);
+        if (copy == NULL){
+            return false;
+        }
+        copy->file = file_reopen(mapped_file->file);
+        if (copy->file == NULL){
+            free(copy);
+            return false;
+        }
+        copy->addr = mapped_file->addr;
+        copy->length = mapped_file->length;
+        copy->map_id = mapped_file->map_id;
+        list_push_back(&child->list, &copy->elem);
+    }
+    return true;
+}
+
 // create mapped file
 struct mapped_file * create_mapped_file(struct file * file, void * addr, off_t length)
 {
-    struct mapped_file * mapped_file = malloc(sizeof(struct mapped_file));
+    struct mapped_file * mapped_file = malloc_tagged(sizeof(struct mapped_file), MEM_MMAP);
     if(mapped_file == NULL){
         return NULL;
     }
@@ -57,6 +91,9 @@ bool free_mapped_file(mapid_t mapping, struct mapped_file_table * mapped_file_ta
 
     ASSERT(mapped_file != NULL);
 
+    // coalesced while it can, the loop below writes whatever is left
+    sync_mapped_file(mapping, mapped_file_table);
+
     if (!get_pinned_frames(mapped_file->addr, true, mapped_file->length))
     {
       return false;
@@ -79,14 +116,15 @@ bool free_mapped_file(mapid_t mapping, struct mapped_file_table * mapped_file_ta
         
         if (pagedir_is_dirty(cur->pagedir, page->uaddr))
         {
-            lock_release(&vm_lock);
+            // frame is pinned, safe to drop the spt lock for I/O
+            lock_release(&supp_pt->lock);
             lock_acquire(&fs_lock);
 
             // writeback
             file_write_at(mapped_file->file, frame->kaddr, page->read_bytes, page->ofs);
 
             lock_release(&fs_lock);
-            lock_acquire(&vm_lock);
+            lock_acquire(&supp_pt->lock);
         }
 
         page->page_status = MUNMAP; // used in page fault
@@ -114,4 +152,155 @@ struct mapped_file *find_mapped_file(struct mapped_file_table *mapped_file_table
         mapped_file = NULL;
     }
     return mapped_file;
-}
\ No newline at end of file
+}
+
+// msync: write back the dirty resident pages of mapping, contiguous ones
+// in runs of up to WB_PAGES per write. they stay mapped. false if mapping
+// isn't in the table or there is no buffer. spt lock held
+bool sync_mapped_file(mapid_t mapping, struct mapped_file_table *mapped_file_table)
+{
+    struct thread *cur = thread_current();
+    struct mapped_file *mapped_file = find_mapped_file(mapped_file_table, mapping);
+    if (mapped_file == NULL)
+    {
+        return false;
+    }
+    uint8_t *buf = palloc_get_multiple(PAL_TAG(MEM_BUFFER), WB_PAGES);
+    if (buf == NULL)
+    {
+        return false;
+    }
+
+    uint8_t *end = (uint8_t *)mapped_file->addr + mapped_file->length;
+    for (uint8_t *upage = mapped_file->addr; upage < end; upage += PGSIZE)
+    {
+        struct page *page = find_page(cur->supp_pt, upage);
+        if (wb_candidate(cur, page, mapped_file))
+        {
+            // runs start at the first dirty page, so this one is in it
+            size_t cnt = writeback_run(cur, page, buf);
+            if (cnt > 1)
+            {
+                upage += (cnt - 1) * PGSIZE;
+            }
+        }
+    }
+    palloc_free_multiple(buf, WB_PAGES);
+    return true;
+}
+
+// start the background writeback thread
+void mmap_start_writeback(void)
+{
+    if (thread_create("mmapwb", NICE_DEFAULT, mmap_writeback, NULL) == TID_ERROR)
+    {
+        PANIC("can't start mmap writeback");
+    }
+}
+
+void mmap_print_stats(void)
+{
+    printf("Mmap: %zu pages written back in %zu writes, %zu background passes\n",
+           wb_page_cnt, wb_write_cnt, wb_pass_cnt);
+}
+
+// page is resident, private and dirty, and belongs to mapped_file. spt
+// lock held
+static bool wb_candidate(struct thread *owner, struct page *page, struct mapped_file *mapped_file)
+{
+    return page != NULL && page->page_status == MMAP && page->map_id == mapped_file->map_id
+           && page->page_location == PAGED_IN && !frame_is_shared(page->frame)
+           && pagedir_is_dirty(owner->pagedir, pg_round_down(page->uaddr));
+}
+
+// write the run of dirty pages around owner's page (at most WB_PAGES of
+// them) to its file in one write through buf, returns how many. the pages
+// stay mapped: their dirty bits are cleared before the copy, so a write
+// racing with it just dirties them again. meanwhile they are busy for the
+// evictor and in transit for the owner, whose munmap and exit wait for
+// them. called and returns with owner's spt lock held, drops it for I/O
+static size_t writeback_run(struct thread *owner, struct page *page, uint8_t *buf)
+{
+    struct supp_pt *supp_pt = owner->supp_pt;
+    struct mapped_file *mapped_file = find_mapped_file(owner->mapped_file_table, page->map_id);
+    ASSERT(mapped_file != NULL);
+
+    // back to the start of the run, keeping page within reach of it
+    uint8_t *upage = pg_round_down(page->uaddr);
+    for (size_t n = 1; n < WB_PAGES && upage > (uint8_t *)mapped_file->addr; n++)
+    {
+        if (!wb_candidate(owner, find_page(supp_pt, upage - PGSIZE), mapped_file))
+        {
+            break;
+        }
+        upage -= PGSIZE;
+    }
+
+    struct page *run[WB_PAGES];
+    size_t cnt = 0;
+    off_t bytes = 0;
+    uint8_t *end = (uint8_t *)mapped_file->addr + mapped_file->length;
+    for (; cnt < WB_PAGES && upage < end; upage += PGSIZE)
+    {
+        struct page *p = find_page(supp_pt, upage);
+        if (!wb_candidate(owner, p, mapped_file) || !ft_try_busy(p->frame))
+        {
+            break;
+        }
+        pagedir_set_dirty(owner->pagedir, upage, false);
+        memcpy(buf + cnt * PGSIZE, p->frame->kaddr, p->read_bytes);
+        p->page_location = IN_TRANSIT;
+        bytes += p->read_bytes;
+        run[cnt++] = p;
+    }
+    if (cnt == 0)
+    {
+        return 0;
+    }
+
+    lock_release(&supp_pt->lock);
+    lock_acquire(&fs_lock);
+    file_write_at(mapped_file->file, buf, bytes, run[0]->ofs);
+    wb_page_cnt += cnt;
+    wb_write_cnt++;
+    lock_release(&fs_lock);
+    lock_acquire(&supp_pt->lock);
+
+    for (size_t i = 0; i < cnt; i++)
+    {
+        run[i]->page_location = PAGED_IN;
+        ft_frame_ready(run[i]->frame);
+        cond_broadcast(&run[i]->transit, &supp_pt->lock);
+    }
+    return cnt;
+}
+
+// writeback thread: every WB_INTERVAL ticks, write back the dirty mmap
+// pages that weren't touched since the pass before, so munmap and eviction
+// rarely find much left to write
+static void mmap_writeback(void *aux UNUSED)
+{
+    uint8_t *buf = palloc_get_multiple(PAL_TAG(MEM_BUFFER), WB_PAGES);
+    if (buf == NULL)
+    {
+        PANIC("no memory for mmap writeback");
+    }
+
+    for (;;)
+    {
+        timer_sleep(WB_INTERVAL);
+
+        size_t cursor = 0;
+        struct thread *owner;
+        struct page *page;
+        while ((page = ft_next_dirty_mmap(&cursor, &owner)) != NULL)
+        {
+            writeback_run(owner, page, buf);
+            lock_release(&owner->supp_pt->lock);
+        }
+
+        lock_acquire(&fs_lock);
+        wb_pass_cnt++;
+        lock_release(&fs_lock);
+    }
+}
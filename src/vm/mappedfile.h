@@ -26,8 +26,12 @@ struct mapped_file {
 struct mapped_file_table *create_mapped_file_table(void);
 struct mapped_file * create_mapped_file(struct file * file, void * addr, off_t length);
 void free_mapped_file_table(struct mapped_file_table * mapped_file_table);
+bool fork_mapped_file_table(struct mapped_file_table *parent, struct mapped_file_table *child);
 mapid_t * mmap (int fd, void *addr);
 bool free_mapped_file (mapid_t mapping, struct mapped_file_table * mapped_file_table);
+bool sync_mapped_file(mapid_t mapping, struct mapped_file_table *mapped_file_table);
+void mmap_start_writeback(void);
+void mmap_print_stats(void);
 struct mapped_file *find_mapped_file(struct mapped_file_table *mapped_file_table, mapid_t map_id);
 extern mapid_t id; // map_id is set to this
 
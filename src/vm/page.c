@@ -1,17 +1,17 @@
 #include "page.h"
 #include "userprog/pagedir.h"
 #include "threads/vaddr.h"
+#include "threads/pte.h"
 #include "threads/malloc.h"
 #include "vm/frame.h"
 #include "vm/swap.h"
+#include "vm/pagecache.h"
 #include "threads/thread.h"
 #include "userprog/exception.h"
 #include <stdio.h>
 #include "userprog/syscall.h"
 #include "lib/string.h"
 
-struct lock vm_lock; // global vm lock
-
 // hash table functions
 static unsigned
 page_hash(const struct hash_elem *p_, void *aux UNUSED);
@@ -19,24 +19,44 @@ static bool
 page_less(const struct hash_elem *a_, const struct hash_elem *b_,
           void *aux UNUSED);
 
-static void free_page(struct hash_elem *e, void *aux UNUSED);
+// pages around a faulting code or mmap page that fault_around() looks at,
+// the aligned window holding it. -faultaround=PAGES, 0 or 1 turns it off
+static size_t fault_around_pages = 16;
 
-// init vm lock
-void init_spt()
-{
-    lock_init(&vm_lock);
-}
+static void free_page(struct hash_elem *e, void *aux UNUSED);
+static void swap_readahead(struct supp_pt *supp_pt, struct thread *thread_cur, size_t slot);
+static bool map_cached_page(struct page *page, struct thread *thread_cur, bool pinned);
+static bool break_cow(struct page *page, struct thread *thread_cur, bool pinned);
+static bool superpage_eligible(struct supp_pt *supp_pt, void *ubase);
+static bool map_resident_page(struct page *page, struct thread *thread_cur);
+static void flush_mapped_pages(struct thread *parent);
+static bool fork_page(struct page *parent_page, struct thread *parent, struct thread *child, struct file *exe);
 
 // init spt
 struct supp_pt *create_supp_pt(void)
 {
-    struct supp_pt *supp_pt = malloc(sizeof(struct supp_pt));
+    struct supp_pt *supp_pt = malloc_tagged(sizeof(struct supp_pt), MEM_SPT);
     if (supp_pt == NULL)
     {
         return NULL;
     }
-    if(hash_init(&supp_pt->hash_map, page_hash, page_less, NULL) == false){
-        free_spt(supp_pt);
+    lock_init(&supp_pt->lock);
+    supp_pt->swap_cursor = 0;
+    supp_pt->fault_cnt = 0;
+    supp_pt->fault_around_cnt = 0;
+    supp_pt->trace_on = false;
+    supp_pt->trace_cnt = 0;
+    supp_pt->rss = 0;
+    supp_pt->rss_limit = WSET_NO_LIMIT;
+    supp_pt->last_fault = 0;
+    supp_pt->inactive = false;
+    supp_pt->owner = NULL;
+    supp_pt->fault_events = 0;
+    memset(supp_pt->fault_class_cnt, 0, sizeof supp_pt->fault_class_cnt);
+    memset(supp_pt->fault_class_cycles, 0, sizeof supp_pt->fault_class_cycles);
+    memset(supp_pt->fault_hist, 0, sizeof supp_pt->fault_hist);
+    if(hash_init(&supp_pt->hash_map, page_hash, page_less, supp_pt) == false){
+        free(supp_pt);
         return NULL;
     }
     return supp_pt;
@@ -45,7 +65,7 @@ struct supp_pt *create_supp_pt(void)
 // creates a page entry for spt
 struct page *create_page(void *uaddr, struct file *file, off_t ofs, uint32_t read_bytes, uint32_t zero_bytes, bool writable, enum page_status page_status, enum page_location page_location)
 {
-    struct page *page = malloc(sizeof(struct page));
+    struct page *page = malloc_tagged(sizeof(struct page), MEM_SPT);
     if (page == NULL)
     {
         return NULL;
@@ -60,6 +80,10 @@ struct page *create_page(void *uaddr, struct file *file, off_t ofs, uint32_t rea
     page->page_location = page_location;
     page->map_id = -1;
     page->swap_index = UINT32_MAX;
+    page->evicted_at = 0;
+    page->frame = NULL;
+    page->thread = thread_current();
+    page->pinned = false;
     cond_init(&page->transit);
 
     return page;
@@ -101,38 +125,189 @@ page_less(const struct hash_elem *a_, const struct hash_elem *b_,
 
 // ps exit, frees swap slot if applicable, page out any page frames the struct page may still occupy
 void free_spt(struct supp_pt *supp_pt){
+    wset_exit(supp_pt);
+    lock_acquire(&supp_pt->lock);
     hash_destroy(&supp_pt->hash_map, free_page); // or clear?
+    lock_release(&supp_pt->lock);
+    ft_release_superpages(supp_pt);
     free(supp_pt);
 }
 
-// action func for hash_destroy
-static void free_page(struct hash_elem *e, void *aux UNUSED){
+// action func for hash_destroy, aux is the supp_pt (lock held)
+static void free_page(struct hash_elem *e, void *aux){
     // mapped files wb and freed before in ps exit
     struct page *page = hash_entry(e, struct page, hash_elem);
+    struct supp_pt *supp_pt = aux;
+
+    // an evictor may still be writing the page out
+    while (page->page_location == IN_TRANSIT)
+    {
+        cond_wait(&page->transit, &supp_pt->lock);
+    }
 
-    //
     if(page->swap_index != UINT32_MAX){
         st_free_page(page->swap_index);
     }
 
+    if(page->page_location == ZERO){
+        pagedir_clear_page(page->thread->pagedir, pg_round_down(page->uaddr));
+    }
+
     if(page->page_location == PAGED_IN){
         struct frame * frame = get_page_frame(page);
         ASSERT(frame != NULL);
 
-        page_frame_freed(frame);
+        if(frame_is_shared(frame)){
+            ft_unmap_shared(frame, page);
+        }
+        else{
+            page_frame_freed(frame);
+        }
     }
 
     free(page);
 }
 
+// fork: copy parent's spt into the current thread's (the child's). resident
+// anonymous pages are shared copy-on-write and swapped out ones share their
+// slot, file backed pages are read in again by the child (code from the
+// page cache). exe is the child's executable and its mapped file table is
+// already a copy of the parent's. the parent waits for us meanwhile, only
+// evictors touch its pages
+bool fork_spt(struct thread *parent, struct file *exe)
+{
+    struct thread *child = thread_current();
+    struct supp_pt *parent_spt = parent->supp_pt;
+    struct supp_pt *child_spt = child->supp_pt;
+
+    lock_acquire(&parent_spt->lock);
+    flush_mapped_pages(parent);
+
+    lock_acquire(&child_spt->lock);
+    bool success = true;
+    struct hash_iterator i;
+    hash_first(&i, &parent_spt->hash_map);
+    while (success && hash_next(&i))
+    {
+        struct page *page = hash_entry(hash_cur(&i), struct page, hash_elem);
+        success = fork_page(page, parent, child, exe);
+    }
+    lock_release(&child_spt->lock);
+    lock_release(&parent_spt->lock);
+    return success;
+}
+
+// write parent's modified mmap pages back, so the child reads the same
+// data in. parent's spt lock held, dropped for the I/O (the hash table
+// doesn't change, the parent is blocked)
+static void flush_mapped_pages(struct thread *parent)
+{
+    struct supp_pt *supp_pt = parent->supp_pt;
+    struct hash_iterator i;
+    hash_first(&i, &supp_pt->hash_map);
+    while (hash_next(&i))
+    {
+        struct page *page = hash_entry(hash_cur(&i), struct page, hash_elem);
+        void *upage = pg_round_down(page->uaddr);
+        if (page->page_status != MMAP || page->page_location != PAGED_IN
+            || !pagedir_is_dirty(parent->pagedir, upage))
+        {
+            continue;
+        }
+        struct mapped_file *mapped_file = find_mapped_file(parent->mapped_file_table, page->map_id);
+        ASSERT(mapped_file != NULL);
+
+        // frame is pinned, safe to drop the spt lock for I/O
+        ft_set_pinned(page, true);
+        lock_release(&supp_pt->lock);
+        lock_acquire(&fs_lock);
+        file_write_at(mapped_file->file, page->frame->kaddr, page->read_bytes, page->ofs);
+        lock_release(&fs_lock);
+        lock_acquire(&supp_pt->lock);
+        pagedir_set_dirty(parent->pagedir, upage, false);
+        ft_set_pinned(page, false);
+    }
+}
+
+// add child's copy of parent_page to its spt, both spt locks held
+static bool fork_page(struct page *parent_page, struct thread *parent, struct thread *child, struct file *exe)
+{
+    struct file *file = parent_page->file;
+    if (parent_page->page_status == MMAP || parent_page->page_status == MUNMAP)
+    {
+        struct mapped_file *mapped_file = find_mapped_file(child->mapped_file_table, parent_page->map_id);
+        ASSERT(mapped_file != NULL);
+        file = mapped_file->file;
+    }
+    else if (file != NULL)
+    {
+        file = exe;
+    }
+
+    struct page *page = create_page(parent_page->uaddr, file, parent_page->ofs, parent_page->read_bytes,
+                                    parent_page->zero_bytes, parent_page->writable, parent_page->page_status, PAGED_OUT);
+    if (page == NULL)
+    {
+        return false;
+    }
+    page->map_id = parent_page->map_id;
+    hash_insert(&child->supp_pt->hash_map, &page->hash_elem);
+
+    if (parent_page->page_status != DATA_BSS && parent_page->page_status != STACK)
+    {
+        return true;
+    }
+
+    // an evictor may be writing it out, drops the parent's lock only
+    while (parent_page->page_location == IN_TRANSIT)
+    {
+        cond_wait(&parent_page->transit, &parent->supp_pt->lock);
+    }
+
+    if (parent_page->page_location == SWAP)
+    {
+        st_dup_page(parent_page->swap_index);
+        page->swap_index = parent_page->swap_index;
+        page->page_location = SWAP;
+    }
+    else if (parent_page->page_location == PAGED_IN)
+    {
+        void *upage = pg_round_down(parent_page->uaddr);
+        void *kpage = get_page_frame(parent_page)->kaddr;
+        if (!pagedir_set_page(child->pagedir, upage, kpage, false))
+        {
+            return false;
+        }
+
+        // a kept slot can't tell a write that came before the fork, and
+        // the read-only mapping below forgets the dirty bit
+        if (parent_page->swap_index != UINT32_MAX)
+        {
+            st_free_page(parent_page->swap_index);
+            parent_page->swap_index = UINT32_MAX;
+        }
+        ft_share_cow(parent_page, page);
+        page->page_location = PAGED_IN;
+
+        // its page table is there already, this can't fail
+        pagedir_clear_page(parent->pagedir, upage);
+        return pagedir_set_page(parent->pagedir, upage, kpage, false);
+    }
+    return true;
+}
+
 // install a struct page in a page frame, for get_pinned_frames and page_fault
-//
+// called and returns with the owner's spt lock held, but drops it while
+// getting a frame (which may evict) and while reading the page in
 bool install_page_in_frame(struct page *page, struct thread *thread_cur, bool stack_growth, bool write, bool pinned, bool page_fault)
 {
+    struct supp_pt *supp_pt = thread_cur->supp_pt;
+    ASSERT(lock_held_by_current_thread(&supp_pt->lock));
+
     // move 78 https://www.youtube.com/watch?v=mzZWPcgcRD0
     while (page->page_location == IN_TRANSIT)
     {
-        cond_wait(&page->transit, &vm_lock);
+        cond_wait(&page->transit, &supp_pt->lock);
     }
 
     // if munmap'ed or ps exit (implicitly closed)
@@ -152,58 +327,104 @@ bool install_page_in_frame(struct page *page, struct thread *thread_cur, bool st
         return false;
     }
 
-    // final check, shouldn't hit here but just in case
-    struct frame *temp_frame = get_page_frame(page);
-    if (temp_frame != NULL)
+    // already resident, e.g. the fault raced with nothing to do or the
+    // caller only wants it pinned. evictors need our spt lock, so the
+    // frame can't go away under us
+    if (page->page_location == PAGED_IN)
+    {
+        // shared since a fork, the writer gets its own copy
+        if (write && page->frame->cow)
+        {
+            return break_cow(page, thread_cur, pinned);
+        }
+        if (pinned)
+        {
+            ft_set_pinned(page, true);
+        }
+        return true;
+    }
+
+    // first write to (or pin of) a zero page, it needs a frame of its own
+    if (page->page_location == ZERO)
     {
-        ASSERT(page->page_location != PAGED_IN);
-        page_frame_freed(temp_frame);
+        pagedir_clear_page(thread_cur->pagedir, pg_round_down(page->uaddr));
+        page->page_location = PAGED_OUT;
     }
 
     ASSERT(pagedir_get_page(thread_cur->pagedir, pg_round_down(page->uaddr)) == NULL);
 
-    void *upage = pg_round_down(page->uaddr);
-
-    struct frame *frame = ft_get_page_frame(thread_cur, page, true);
-
-    uint8_t *kpage = frame->kaddr;
+    // whole code pages are shared through the page cache, a partial one
+    // would show whatever follows the segment in the file instead of zeros
+    if (page->page_status == CODE && page->read_bytes == PGSIZE)
+    {
+        return map_cached_page(page, thread_cur, pinned);
+    }
 
-    ASSERT(kpage != NULL);
+    void *upage = pg_round_down(page->uaddr);
 
     // if page in swap, make sure to page in
-    bool in_swap = page->page_location == SWAP;
+    enum page_location old_location = page->page_location;
+    bool in_swap = old_location == SWAP;
+    size_t swap_index = page->swap_index;
     if (in_swap)
     {
-        ASSERT(page->swap_index != UINT32_MAX);
+        ASSERT(swap_index != UINT32_MAX);
     }
 
-    page->page_location = PAGED_IN;
+    // nothing to read in: while it's only read, all processes can share
+    // one page of zeros. pins are for frames, they get a real one
+    bool zero_fill = !in_swap && page->read_bytes == 0;
+    if (zero_fill)
+    {
+        page_fault_event(FAULT_EV_ZERO);
+    }
+    if (zero_fill && !write && !pinned)
+    {
+        if (!pagedir_set_page(thread_cur->pagedir, upage, ft_zero_page(), false))
+        {
+            return false;
+        }
+        page->page_location = ZERO;
+        return true;
+    }
 
-    if (pagedir_get_page(thread_cur->pagedir, upage) != NULL || pagedir_set_page(thread_cur->pagedir, upage, kpage, page->writable) == false)
+    // a large region of process memory gets its frames from one aligned
+    // 4 MB block, so it can be mapped as a superpage once it's all in
+    void *ubase = (void *) ((uintptr_t) upage & ~LPGMASK);
+    if (page->writable && page->page_status != CODE
+        && ft_superpage_wanted(supp_pt, ubase) && superpage_eligible(supp_pt, ubase))
     {
-        page_frame_freed(frame);
-        return false;
+        ft_reserve_superpage(supp_pt, ubase);
     }
 
+    // nobody else touches the page until we're done, drop the lock for I/O
+    page->page_location = IN_TRANSIT;
+    lock_release(&supp_pt->lock);
+
+    struct frame *frame = ft_get_page_frame(thread_cur, page, pinned);
+
+    uint8_t *kpage = frame->kaddr;
+
+    ASSERT(kpage != NULL);
+
     // fetch data into frame
-    if (!stack_growth)
+    // a page read from swap keeps its slot until written, unless this
+    // fault is the write
+    bool success = true;
+    bool slot_kept = false;
+    if (!stack_growth && !zero_fill)
     {
         if ((page->page_status == DATA_BSS || page->page_status == STACK) && in_swap)
         {
-            st_read_at(kpage, page->swap_index);
-            page->swap_index = UINT32_MAX;
+            slot_kept = st_read_at(kpage, swap_index, !write);
+            page_fault_event(FAULT_EV_SWAP);
         }
         else
         {
-            lock_release(&vm_lock);
+            page_fault_event(FAULT_EV_FILE);
             lock_acquire(&fs_lock);
-            file_seek(page->file, page->ofs);
-            if (file_read(page->file, kpage, page->read_bytes) != (int)page->read_bytes)
-            {
-                return false;
-            }
+            success = file_read_at(page->file, kpage, page->read_bytes, page->ofs) == (int)page->read_bytes;
             lock_release(&fs_lock);
-            lock_acquire(&vm_lock);
         }
     }
     // don't zero out the paged in data from swap just acquired
@@ -212,15 +433,250 @@ bool install_page_in_frame(struct page *page, struct thread *thread_cur, bool st
         memset(kpage + page->read_bytes, 0, page->zero_bytes);
     }
 
+    lock_acquire(&supp_pt->lock);
+
+    if (in_swap && !slot_kept)
+    {
+        page->swap_index = UINT32_MAX;
+    }
+    page->page_location = PAGED_IN;
+
+    if (!success || pagedir_set_page(thread_cur->pagedir, upage, kpage, page->writable) == false)
+    {
+        page_frame_freed(frame);
+        if (!success || slot_kept)
+        {
+            page->page_location = old_location;
+        }
+        cond_broadcast(&page->transit, &supp_pt->lock);
+        return false;
+    }
+    cond_broadcast(&page->transit, &supp_pt->lock);
+
     // should be true at this point
     ASSERT(page->page_location == PAGED_IN);
-    ASSERT(frame->pinned == true);
     ASSERT(frame->thread == thread_cur);
 
-    // unpin if not requested
-    if (!pinned)
+    // frame may be evicted from now on (unless pinned)
+    ft_frame_ready(frame);
+
+    // the last page of a reserved region is in, map it all with one PDE.
+    // evicting or unmapping any of it splits it up again
+    if (ft_superpage_full(supp_pt, ubase))
+    {
+        pagedir_promote(thread_cur->pagedir, ubase);
+    }
+
+    // its cluster neighbours were likely evicted along with it and will be
+    // wanted soon too
+    if (in_swap && page_fault)
+    {
+        swap_readahead(supp_pt, thread_cur, swap_index);
+    }
+    return true;
+}
+
+// true if every page of the 4 MB region at ubase is writable process
+// memory with a frame of its own: data, bss, stack or a mapped file.
+// spt lock held
+static bool superpage_eligible(struct supp_pt *supp_pt, void *ubase)
+{
+    for (size_t i = 0; i < PTSPAN / PGSIZE; i++)
+    {
+        struct page *p = find_page(supp_pt, (uint8_t *) ubase + i * PGSIZE);
+        if (p == NULL || !p->writable || p->page_status == CODE || p->page_status == MUNMAP)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+// map a code page read-only onto its page cache frame, reading it in if
+// nobody has it cached. called and returns with the spt lock held
+static bool map_cached_page(struct page *page, struct thread *thread_cur, bool pinned)
+{
+    struct supp_pt *supp_pt = thread_cur->supp_pt;
+    void *upage = pg_round_down(page->uaddr);
+    enum page_location old_location = page->page_location;
+
+    page->page_location = IN_TRANSIT;
+    lock_release(&supp_pt->lock);
+
+    // comes back pinned, so it stays put until it's mapped
+    size_t len;
+    struct frame *frame = pagecache_get(page->file, page->ofs, &len);
+
+    lock_acquire(&supp_pt->lock);
+
+    bool success = frame != NULL && len == page->read_bytes
+                   && pagedir_set_page(thread_cur->pagedir, upage, frame->kaddr, false);
+    if (success)
+    {
+        page->page_location = PAGED_IN;
+        ft_map_shared(frame, page, pinned);
+        prepage_note(supp_pt, page->ofs);
+    }
+    else
+    {
+        page->page_location = old_location;
+        if (frame != NULL)
+        {
+            ft_unpin(frame);
+        }
+    }
+    cond_broadcast(&page->transit, &supp_pt->lock);
+    return success;
+}
+
+// write to a page mapped read-only onto a copy-on-write frame: take the
+// frame over if nobody else shares it any more, else copy it into a frame
+// of our own. called and returns with the spt lock held
+static bool break_cow(struct page *page, struct thread *thread_cur, bool pinned)
+{
+    struct supp_pt *supp_pt = thread_cur->supp_pt;
+    void *upage = pg_round_down(page->uaddr);
+    struct frame *shared = page->frame;
+
+    if (ft_cow_take(shared, page))
+    {
+        if (pinned)
+        {
+            ft_set_pinned(page, true);
+        }
+        pagedir_clear_page(thread_cur->pagedir, upage);
+        return pagedir_set_page(thread_cur->pagedir, upage, shared->kaddr, true);
+    }
+
+    // our pin keeps the shared copy in place while we drop the lock
+    pinned = pinned || page->pinned;
+    ft_set_pinned(page, true);
+    page->page_location = IN_TRANSIT;
+    lock_release(&supp_pt->lock);
+
+    struct frame *frame = ft_get_page_frame(thread_cur, page, pinned);
+    memcpy(frame->kaddr, shared->kaddr, PGSIZE);
+
+    lock_acquire(&supp_pt->lock);
+    ft_cow_copied(shared, page);
+    pagedir_clear_page(thread_cur->pagedir, upage);
+    page->page_location = PAGED_IN;
+
+    bool success = pagedir_set_page(thread_cur->pagedir, upage, frame->kaddr, true);
+    if (!success)
+    {
+        page_frame_freed(frame);
+    }
+    cond_broadcast(&page->transit, &supp_pt->lock);
+    if (success)
+    {
+        ft_frame_ready(frame);
+    }
+    return success;
+}
+
+// the page fault the current thread is resolving took event, for the
+// fault classes in userprog/exception.c
+void page_fault_event(enum fault_event event)
+{
+    struct supp_pt *supp_pt = thread_current()->supp_pt;
+    if (supp_pt != NULL)
+    {
+        supp_pt->fault_events |= event;
+    }
+}
+
+// set the fault-around window, only before the first process starts
+void page_set_fault_around(size_t pages)
+{
+    fault_around_pages = pages;
+}
+
+// after a fault on a code or mmap page, map the other pages of the same
+// segment in its window: those already in the page cache wherever they
+// are, without I/O, and the ones after it (a sequential scan) by reading
+// them in as long as there are frames to spare. returns how many were
+// mapped. called and returns with the spt lock held
+size_t fault_around(struct page *page, struct thread *thread_cur)
+{
+    struct supp_pt *supp_pt = thread_cur->supp_pt;
+    if (fault_around_pages <= 1 || (page->page_status != CODE && page->page_status != MMAP))
+    {
+        return 0;
+    }
+
+    size_t window = fault_around_pages * PGSIZE;
+    uint8_t *fault_upage = pg_round_down(page->uaddr);
+    uint8_t *start = (uint8_t *)((uintptr_t)fault_upage / window * window);
+    enum page_status status = page->page_status;
+    struct file *file = page->file;
+    mapid_t map_id = page->map_id;
+    size_t mapped = 0;
+
+    for (uint8_t *upage = start; upage < start + window && is_user_vaddr(upage); upage += PGSIZE)
+    {
+        struct page *p = upage != fault_upage ? find_page(supp_pt, upage) : NULL;
+        if (p == NULL || p->page_location != PAGED_OUT || p->page_status != status
+            || p->file != file || p->map_id != map_id)
+        {
+            continue;
+        }
+
+        if (map_resident_page(p, thread_cur))
+        {
+            mapped++;
+        }
+        else if (upage > fault_upage && ft_has_spare_frames()
+                 && install_page_in_frame(p, thread_cur, false, false, false, false))
+        {
+            mapped++;
+        }
+    }
+    supp_pt->fault_around_cnt += mapped;
+    return mapped;
+}
+
+// map a code page whose page cache frame is resident, no I/O and the spt
+// lock stays held. false if it isn't cached
+static bool map_resident_page(struct page *page, struct thread *thread_cur)
+{
+    if (page->page_status != CODE || page->read_bytes != PGSIZE)
+    {
+        return false;
+    }
+
+    size_t len;
+    struct frame *frame = pagecache_lookup(page->file, page->ofs, &len);
+    if (frame == NULL)
+    {
+        return false;
+    }
+    if (len != page->read_bytes
+        || !pagedir_set_page(thread_cur->pagedir, pg_round_down(page->uaddr), frame->kaddr, false))
     {
-        frame->pinned = false;
+        ft_unpin(frame);
+        return false;
     }
+    page->page_location = PAGED_IN;
+    ft_map_shared(frame, page, false);
+    prepage_note(thread_cur->supp_pt, page->ofs);
     return true;
-}
\ No newline at end of file
+}
+
+// page in the pages swapped out after slot in the same cluster, as long as
+// there are frames to spare. called and returns with the spt lock held
+static void swap_readahead(struct supp_pt *supp_pt, struct thread *thread_cur, size_t slot)
+{
+    struct page *pages[SWAP_CLUSTER - 1];
+    size_t cnt = st_cluster_pages(supp_pt, slot, pages, SWAP_CLUSTER - 1);
+
+    // we are the only one freeing our pages, they can't go away while
+    // install_page_in_frame drops the lock, but they may be paged in
+    for (size_t i = 0; i < cnt && ft_has_spare_frames(); i++)
+    {
+        if (pages[i]->page_location == SWAP)
+        {
+            install_page_in_frame(pages[i], thread_cur, false, false, false, false);
+        }
+    }
+}
@@ -1,16 +1,16 @@
 #ifndef VM_PAGE_H
 #define VM_PAGE_H
 
+#include <stdint.h>
 #include "lib/kernel/hash.h"
 #include "threads/synch.h"
 #include "filesys/file.h"
 #include "vm/mappedfile.h"
 #include "vm/frame.h"
+#include "vm/prepage.h"
+#include "vm/wset.h"
 #include "threads/synch.h"
 
-// global vm lock
-extern struct lock vm_lock;
-
 // status of a page set on creation
 enum page_status {
     MMAP, // mapped to file
@@ -25,12 +25,64 @@ enum page_location {
     PAGED_IN, // in a page frame
     PAGED_OUT, // not in a page frame
     SWAP, // in swap space
-    IN_TRANSIT // for eviction
+    IN_TRANSIT, // being evicted or loaded, spt lock dropped for I/O
+    ZERO // zero-fill page only read so far, mapped onto the shared zero page
+};
+
+// classes of page faults, by what resolving them took. see
+// userprog/exception.c
+enum fault_class {
+    FAULT_STACK, // stack growth
+    FAULT_ZERO, // zero-fill page, mapped onto the zero page or a new frame
+    FAULT_FILE, // read from the executable or a mapped file
+    FAULT_SWAP, // read from swap
+    FAULT_EVICT, // a frame had to be evicted first
+    FAULT_MINOR, // no I/O or new frame: cached, copy-on-write or raced
+    FAULT_INVALID, // the process dies
+    FAULT_CLASS_CNT
+};
+
+// latency histogram buckets, by log2 of the cycles taken
+#define FAULT_HIST_BUCKETS 16
+
+// what the page fault being resolved took, reported with
+// page_fault_event() by whatever does it
+enum fault_event {
+    FAULT_EV_ZERO = 1,
+    FAULT_EV_FILE = 2,
+    FAULT_EV_SWAP = 4,
+    FAULT_EV_EVICT = 8
 };
 
 // enables page fault handling by supplementing the page table
+// lock protects the hash map, the fields of every struct page in it and
+// the process's mapped file table. it is dropped for frame allocation and
+// page I/O, so page faults in different processes run in parallel.
+// lock order: supp_pt lock, then frame table lock. an evictor holding the
+// frame table lock only ever try-acquires a supp_pt lock.
 struct supp_pt {
     struct hash hash_map; // uaddr key, value is struct page
+    struct lock lock; // per-process spt lock
+    size_t swap_cursor; // next slot of the swap cluster being filled (swap lock)
+    long long fault_cnt; // page faults resolved for this process
+    long long fault_around_cnt; // pages mapped by fault_around() on top
+    bool trace_on; // exec'd, record code pages for prepage_exit()
+    size_t trace_cnt;
+    off_t trace[PREPAGE_PAGES]; // offsets of the first code pages mapped
+
+    // working set, see vm/wset.c
+    size_t rss; // private frames held (frame table lock)
+    size_t rss_limit; // resident set limit while frames are short (wset lock)
+    int64_t last_fault; // timer ticks at the last page fault (wset lock)
+    bool inactive; // deactivated by the load controller (wset lock)
+    struct thread *owner; // process, once it has faulted (wset lock)
+    struct list_elem wset_elem; // in wset's list of processes while owner set
+
+    // page fault statistics, only touched by the process itself
+    unsigned fault_events; // enum fault_event bits of the current fault
+    long long fault_class_cnt[FAULT_CLASS_CNT];
+    uint64_t fault_class_cycles[FAULT_CLASS_CNT];
+    long long fault_hist[FAULT_HIST_BUCKETS]; // latency, all classes
 };
 
 // page entry in the spt
@@ -48,16 +100,24 @@ struct page {
     struct file * file; // exe file
     size_t swap_index; // if page in swap space
     mapid_t map_id; // if page is for a mapped file
-    struct condition transit; // for eviction
+    struct condition transit; // signaled (with spt lock) when IN_TRANSIT ends
+    struct frame * frame; // frame holding the page while PAGED_IN
+    struct thread * thread; // owner, whose spt this page is in
+    struct list_elem mapper_elem; // in frame->mappers if frame is a page cache frame
+    bool pinned; // holds a pin on its page cache frame (frame table lock)
+    unsigned evicted_at; // eviction count when last evicted, 0 if not (vm/replace.c)
 };
 
-void init_spt(void);
 struct supp_pt * create_supp_pt(void);
 void free_spt(struct supp_pt *supp_pt);
 
 struct page * create_page(void * uaddr, struct file * file, off_t ofs, uint32_t read_bytes, uint32_t zero_bytes, bool writable, enum page_status, enum page_location);
 struct page *find_page(struct supp_pt *supp_pt, void *uaddr);
 bool install_page_in_frame(struct page *page, struct thread *thread_cur, bool stack_growth, bool write, bool pinned, bool page_fault);
+bool fork_spt(struct thread *parent, struct file *exe);
+void page_set_fault_around(size_t pages);
+size_t fault_around(struct page *page, struct thread *thread_cur);
+void page_fault_event(enum fault_event event);
 
 #endif
 
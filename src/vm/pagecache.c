@@ -0,0 +1,300 @@
+#include "vm/pagecache.h"
+#include <debug.h>
+#include <stdio.h>
+#include <string.h>
+#include "lib/kernel/hash.h"
+#include "lib/kernel/list.h"
+#include "filesys/inode.h"
+#include "threads/malloc.h"
+#include "threads/synch.h"
+#include "threads/vaddr.h"
+#include "userprog/pagedir.h"
+#include "userprog/syscall.h"
+#include "vm/frame.h"
+
+// page cache: one copy of each file page, keyed by (inode sector, page
+// offset), in a frame that belongs to the frame table like any other.
+// whole code pages are mapped read-only from it into every process running
+// the binary (frame->mappers) and SYS_READ copies out of it. the cached
+// copy is kept in step with inode_write_at() and never written back, so
+// eviction just unmaps it everywhere.
+// lock order: fs_lock, page cache lock, frame table lock. the evictor
+// holding the frame table lock only try-acquires the page cache lock.
+// a page is read in under fs_lock, taken only after the entry is published
+// (loading) and a frame found for it. a write to the file skips entries
+// still loading: it holds fs_lock, so the loader reads the inode after it
+
+struct pc_page {
+    struct hash_elem hash_elem; // in pc_map unless dead
+    struct list_elem elem; // in pc_list unless dead
+    block_sector_t inumber; // inode of the file
+    off_t ofs; // page aligned offset in the file
+    struct frame *frame; // holds the page once loaded
+    size_t len; // bytes from the file, the rest of the page is zero
+    bool loading; // being read in, wait on pc_loaded
+    bool dead; // file removed while in use, freed on eviction
+};
+
+static struct hash pc_map; // all live entries
+static struct list pc_list; // same, to walk them on pagecache_drop()
+static struct lock pc_lock; // pc_map, pc_list, entry fields, stats
+static struct condition pc_loaded; // broadcast when an entry is loaded
+
+// statistics
+static size_t hit_cnt, miss_cnt, evict_cnt, drop_cnt;
+static unsigned long long read_bytes;
+
+static unsigned pc_hash(const struct hash_elem *e, void *aux UNUSED);
+static bool pc_less(const struct hash_elem *a, const struct hash_elem *b, void *aux UNUSED);
+static struct pc_page *pc_find(block_sector_t inumber, off_t ofs);
+static void pc_unlink(struct pc_page *pcp);
+
+void pagecache_init(void){
+    hash_init(&pc_map, pc_hash, pc_less, NULL);
+    list_init(&pc_list);
+    lock_init(&pc_lock);
+    cond_init(&pc_loaded);
+}
+
+static unsigned
+pc_hash(const struct hash_elem *e, void *aux UNUSED){
+    const struct pc_page *pcp = hash_entry(e, struct pc_page, hash_elem);
+    return hash_int(pcp->inumber) ^ hash_int(pcp->ofs / PGSIZE);
+}
+
+static bool
+pc_less(const struct hash_elem *a_, const struct hash_elem *b_, void *aux UNUSED){
+    const struct pc_page *a = hash_entry(a_, struct pc_page, hash_elem);
+    const struct pc_page *b = hash_entry(b_, struct pc_page, hash_elem);
+    return a->inumber != b->inumber ? a->inumber < b->inumber : a->ofs < b->ofs;
+}
+
+// entry for the page at ofs in inode inumber, NULL if not cached. pc lock held
+static struct pc_page *
+pc_find(block_sector_t inumber, off_t ofs){
+    struct pc_page key;
+    key.inumber = inumber;
+    key.ofs = ofs;
+    struct hash_elem *e = hash_find(&pc_map, &key.hash_elem);
+    return e != NULL ? hash_entry(e, struct pc_page, hash_elem) : NULL;
+}
+
+// take a live entry out of the cache, pc lock held
+static void
+pc_unlink(struct pc_page *pcp){
+    hash_delete(&pc_map, &pcp->hash_elem);
+    list_remove(&pcp->elem);
+}
+
+// frame holding the page of file at page aligned ofs, read in if it isn't
+// cached, pinned until ft_unpin(). *len gets the bytes the file has in
+// the page. NULL if out of memory. must not be called with fs_lock or an
+// spt lock held, getting a frame may evict
+struct frame *pagecache_get(struct file *file, off_t ofs, size_t *len){
+    ASSERT(ofs % PGSIZE == 0);
+    struct inode *inode = file_get_inode(file);
+    block_sector_t inumber = inode_get_inumber(inode);
+
+    lock_acquire(&pc_lock);
+    struct pc_page *pcp;
+    while ((pcp = pc_find(inumber, ofs)) != NULL && pcp->loading) {
+        cond_wait(&pc_loaded, &pc_lock);
+    }
+    // the evictor needs our lock to take the frame, pin it before letting go
+    if (pcp != NULL) {
+        struct frame *frame = pcp->frame;
+        ft_pin(frame);
+        *len = pcp->len;
+        hit_cnt++;
+        lock_release(&pc_lock);
+        return frame;
+    }
+
+    pcp = malloc_tagged(sizeof *pcp, MEM_FRAME);
+    if (pcp == NULL) {
+        lock_release(&pc_lock);
+        return NULL;
+    }
+    pcp->inumber = inumber;
+    pcp->ofs = ofs;
+    pcp->frame = NULL;
+    pcp->len = 0;
+    pcp->loading = true;
+    pcp->dead = false;
+    hash_insert(&pc_map, &pcp->hash_elem);
+    list_push_back(&pc_list, &pcp->elem);
+    miss_cnt++;
+    lock_release(&pc_lock);
+
+    struct frame *frame = ft_get_cache_frame(pcp);
+
+    page_fault_event(FAULT_EV_FILE);
+    lock_acquire(&fs_lock);
+    off_t n = inode_read_at(inode, frame->kaddr, PGSIZE, ofs);
+    memset((uint8_t *)frame->kaddr + n, 0, PGSIZE - n);
+
+    lock_acquire(&pc_lock);
+    pcp->frame = frame;
+    pcp->len = n;
+    pcp->loading = false;
+    cond_broadcast(&pc_loaded, &pc_lock);
+    lock_release(&pc_lock);
+    lock_release(&fs_lock);
+
+    ft_frame_ready(frame);
+    *len = n;
+    return frame;
+}
+
+// frame holding the page of file at page aligned ofs if it is cached and
+// loaded, pinned until ft_unpin(), else NULL. never reads or allocates, so
+// it may be called with an spt lock held
+struct frame *pagecache_lookup(struct file *file, off_t ofs, size_t *len){
+    ASSERT(ofs % PGSIZE == 0);
+    block_sector_t inumber = inode_get_inumber(file_get_inode(file));
+
+    lock_acquire(&pc_lock);
+    struct pc_page *pcp = pc_find(inumber, ofs);
+    struct frame *frame = NULL;
+    if (pcp != NULL && !pcp->loading) {
+        frame = pcp->frame;
+        ft_pin(frame);
+        *len = pcp->len;
+        hit_cnt++;
+    }
+    lock_release(&pc_lock);
+    return frame;
+}
+
+// read up to size bytes from file's position into user buffer ubuf of
+// page directory pd through the page cache, advancing the position.
+// returns the bytes read. the caller has the buffer's frames pinned, they
+// are written through their kernel addresses, one cached page and one user
+// page at a time, and marked dirty. same rules as pagecache_get()
+off_t pagecache_read(struct file *file, uint32_t *pd, void *ubuf, off_t size){
+    lock_acquire(&fs_lock);
+    off_t pos = file_tell(file);
+    off_t length = file_length(file);
+    lock_release(&fs_lock);
+
+    off_t done = 0;
+    while (done < size && pos < length) {
+        off_t page_ofs = pos - pos % PGSIZE;
+        size_t len;
+        struct frame *frame = pagecache_get(file, page_ofs, &len);
+        if (frame == NULL) {
+            break;
+        }
+
+        uint8_t *udst = (uint8_t *)ubuf + done;
+        off_t left = (off_t)len - (pos - page_ofs);
+        off_t room = PGSIZE - pg_ofs(udst);
+        off_t chunk = size - done < left ? size - done : left;
+        chunk = chunk < room ? chunk : room;
+        if (chunk > 0) {
+            uint8_t *kdst = pagedir_get_page(pd, udst);
+            ASSERT(kdst != NULL);
+            memcpy(kdst, (uint8_t *)frame->kaddr + (pos - page_ofs), chunk);
+            pagedir_set_dirty(pd, pg_round_down(udst), true);
+        }
+        ft_unpin(frame);
+        if (chunk <= 0) {
+            break;
+        }
+        done += chunk;
+        pos += chunk;
+    }
+
+    lock_acquire(&fs_lock);
+    file_seek(file, pos);
+    lock_release(&fs_lock);
+
+    lock_acquire(&pc_lock);
+    read_bytes += done;
+    lock_release(&pc_lock);
+    return done;
+}
+
+// size bytes from buf were written at ofs to inode inumber, update the
+// cached copies. called by inode_write_at() with fs_lock held
+void pagecache_write(block_sector_t inumber, off_t ofs, const void *buf, off_t size){
+    const uint8_t *src = buf;
+
+    lock_acquire(&pc_lock);
+    while (size > 0) {
+        off_t page_ofs = ofs - ofs % PGSIZE;
+        off_t chunk = PGSIZE - (ofs - page_ofs);
+        if (chunk > size) {
+            chunk = size;
+        }
+
+        // one still loading reads the inode after we're done, it's waiting
+        // for our fs_lock
+        struct pc_page *pcp = pc_find(inumber, page_ofs);
+        if (pcp != NULL && !pcp->loading) {
+            memcpy((uint8_t *)pcp->frame->kaddr + (ofs - page_ofs), src, chunk);
+            if ((size_t)(ofs - page_ofs + chunk) > pcp->len) {
+                pcp->len = ofs - page_ofs + chunk;
+            }
+        }
+        src += chunk;
+        ofs += chunk;
+        size -= chunk;
+    }
+    lock_release(&pc_lock);
+}
+
+// inode inumber was removed and closed, its sector may be reused: forget
+// its pages. frames still mapped or pinned are left to the evictor
+void pagecache_drop(block_sector_t inumber){
+    lock_acquire(&pc_lock);
+    struct list_elem *e = list_begin(&pc_list);
+    while (e != list_end(&pc_list)) {
+        struct pc_page *pcp = list_entry(e, struct pc_page, elem);
+        e = list_next(e);
+        if (pcp->inumber != inumber) {
+            continue;
+        }
+
+        pc_unlink(pcp);
+        drop_cnt++;
+        if (!pcp->loading && ft_free_cache_frame(pcp->frame)) {
+            free(pcp);
+        }
+        else {
+            pcp->dead = true;
+        }
+    }
+    lock_release(&pc_lock);
+}
+
+// the evictor's side of the lock order, see above
+bool pagecache_try_lock(void){
+    return lock_try_acquire(&pc_lock);
+}
+
+void pagecache_unlock(void){
+    lock_release(&pc_lock);
+}
+
+// the evictor took pcp's frame back, called with the page cache lock
+// (from pagecache_try_lock()) held and releases it
+void pagecache_evicted(struct pc_page *pcp){
+    ASSERT(lock_held_by_current_thread(&pc_lock));
+    ASSERT(!pcp->loading);
+
+    if (!pcp->dead) {
+        pc_unlink(pcp);
+    }
+    free(pcp);
+    evict_cnt++;
+    lock_release(&pc_lock);
+}
+
+// print page cache statistics
+void pagecache_print_stats(void){
+    lock_acquire(&pc_lock);
+    printf("Page cache: %zu hits, %zu misses, %zu evicted, %zu dropped, %llu bytes read, %zu pages cached\n",
+           hit_cnt, miss_cnt, evict_cnt, drop_cnt, read_bytes, hash_size(&pc_map));
+    lock_release(&pc_lock);
+}
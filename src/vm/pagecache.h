@@ -0,0 +1,27 @@
+#ifndef VM_PAGECACHE_H
+#define VM_PAGECACHE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "devices/block.h"
+#include "filesys/file.h"
+#include "filesys/off_t.h"
+
+struct frame;
+struct pc_page;
+
+void pagecache_init(void);
+struct frame *pagecache_get(struct file *file, off_t ofs, size_t *len);
+struct frame *pagecache_lookup(struct file *file, off_t ofs, size_t *len);
+off_t pagecache_read(struct file *file, uint32_t *pd, void *ubuf, off_t size);
+void pagecache_write(block_sector_t inumber, off_t ofs, const void *buf, off_t size);
+void pagecache_drop(block_sector_t inumber);
+void pagecache_print_stats(void);
+
+// for the frame table's evictor
+bool pagecache_try_lock(void);
+void pagecache_unlock(void);
+void pagecache_evicted(struct pc_page *pcp);
+
+#endif
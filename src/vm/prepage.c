@@ -0,0 +1,312 @@
+#include "vm/prepage.h"
+#include <debug.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "filesys/file.h"
+#include "filesys/filesys.h"
+#include "filesys/inode.h"
+#include "lib/kernel/x86.h"
+#include "threads/interrupt.h"
+#include "threads/malloc.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
+#include "userprog/syscall.h"
+#include "vm/frame.h"
+#include "vm/page.h"
+#include "vm/pagecache.h"
+
+// exec traces: the whole code pages the first PREPAGE_PAGES page cache
+// mappings of a process were for, by file offset, for the executables run
+// last. kept in memory and, with -prepage, one fixed size record per slot
+// in TRACE_FILE so they survive a reboot. the file is read on first use and
+// the changed slots written at shutdown, never by a process's exec or exit.
+// on exec a kernel thread reads the traced pages into the page cache while
+// the program starts up, its faults then map them without waiting on the
+// disk. TRACE_FILE is user writable: a slot that doesn't hold whole pages
+// of its executable is dropped on load, and a trace is only used for an
+// executable of the length it was made for, in case the inode's sector was
+// reused
+
+#define TRACE_FILE ".prepage"
+#define TRACE_SLOTS 16
+
+struct trace {
+    block_sector_t inumber; // executable's inode, 0 (the free map) if unused
+    off_t length; // and its length
+    uint32_t used; // exec_clock when last run, the lowest slot is reused
+    uint32_t cnt; // offsets in ofs, sorted
+    off_t ofs[PREPAGE_PAGES];
+};
+
+// pages of exe to read in, handed to a prefetch thread
+struct prefetch_job {
+    struct file *file; // own reference to the executable
+    size_t cnt;
+    off_t ofs[PREPAGE_PAGES];
+};
+
+static struct trace traces[TRACE_SLOTS];
+static bool traces_dirty[TRACE_SLOTS]; // changed since read from TRACE_FILE
+static bool traces_loaded; // read TRACE_FILE yet
+static bool save_traces; // keep TRACE_FILE, -prepage
+static uint32_t exec_clock;
+static struct lock prepage_lock; // everything above, taken before fs_lock
+
+// statistics
+static size_t exec_cnt, traced_exec_cnt, prefetch_cnt, save_cnt;
+static size_t output_cnt;
+static uint64_t output_cycles;
+
+static void load_traces(void);
+static bool trace_valid(const struct trace *trace);
+static struct trace *find_trace(block_sector_t inumber, off_t length);
+static void prefetch(void *job_);
+static int compare_ofs(const void *a, const void *b);
+
+void prepage_init(void){
+    lock_init(&prepage_lock);
+}
+
+// keep traces in TRACE_FILE across boots
+void prepage_set_save(bool save){
+    save_traces = save;
+}
+
+// start reading in the pages exe's last run used, and trace this run. the
+// spt is set up but the process hasn't run yet. no locks held
+void prepage_exec(struct file *exe, struct supp_pt *supp_pt){
+    supp_pt->trace_on = true;
+    supp_pt->trace_cnt = 0;
+
+    lock_acquire(&fs_lock);
+    block_sector_t inumber = inode_get_inumber(file_get_inode(exe));
+    off_t length = file_length(exe);
+    lock_release(&fs_lock);
+
+    struct prefetch_job *job = NULL;
+    lock_acquire(&prepage_lock);
+    load_traces();
+    exec_cnt++;
+    struct trace *trace = find_trace(inumber, length);
+    if(trace != NULL && trace->cnt > 0){
+        trace->used = ++exec_clock;
+        job = malloc_tagged(sizeof *job, MEM_BUFFER);
+        if(job != NULL){
+            job->cnt = trace->cnt;
+            memcpy(job->ofs, trace->ofs, trace->cnt * sizeof *trace->ofs);
+            traced_exec_cnt++;
+        }
+    }
+    lock_release(&prepage_lock);
+    if(job == NULL){
+        return;
+    }
+
+    lock_acquire(&fs_lock);
+    job->file = file_reopen(exe);
+    lock_release(&fs_lock);
+    if(job->file == NULL || thread_create("prepage", NICE_DEFAULT, prefetch, job) == TID_ERROR){
+        if(job->file != NULL){
+            lock_acquire(&fs_lock);
+            file_close(job->file);
+            lock_release(&fs_lock);
+        }
+        free(job);
+    }
+}
+
+// a whole code page at ofs was mapped through the page cache, spt lock held
+void prepage_note(struct supp_pt *supp_pt, off_t ofs){
+    if(!supp_pt->trace_on || supp_pt->trace_cnt == PREPAGE_PAGES){
+        return;
+    }
+    for(size_t i = 0; i < supp_pt->trace_cnt; i++){
+        if(supp_pt->trace[i] == ofs){
+            return;
+        }
+    }
+    supp_pt->trace[supp_pt->trace_cnt++] = ofs;
+}
+
+// keep this run's trace for exe's next exec, to be saved at shutdown if it
+// changed. called on exit before the spt goes, no locks held
+void prepage_exit(struct file *exe, struct supp_pt *supp_pt){
+    if(!supp_pt->trace_on || supp_pt->trace_cnt == 0){
+        return;
+    }
+
+    lock_acquire(&fs_lock);
+    block_sector_t inumber = inode_get_inumber(file_get_inode(exe));
+    off_t length = file_length(exe);
+    lock_release(&fs_lock);
+
+    // in file order, the same pages faulted in another order are no change
+    qsort(supp_pt->trace, supp_pt->trace_cnt, sizeof *supp_pt->trace, compare_ofs);
+
+    lock_acquire(&prepage_lock);
+    load_traces();
+    struct trace *trace = find_trace(inumber, length);
+    if(trace == NULL){
+        trace = &traces[0];
+        for(size_t i = 1; i < TRACE_SLOTS; i++){
+            if(traces[i].used < trace->used){
+                trace = &traces[i];
+            }
+        }
+        trace->inumber = inumber;
+        trace->length = length;
+        trace->used = ++exec_clock;
+        trace->cnt = 0;
+    }
+    size_t size = supp_pt->trace_cnt * sizeof *supp_pt->trace;
+    if(trace->cnt != supp_pt->trace_cnt || memcmp(trace->ofs, supp_pt->trace, size)){
+        trace->cnt = supp_pt->trace_cnt;
+        memcpy(trace->ofs, supp_pt->trace, size);
+        traces_dirty[trace - traces] = true;
+    }
+    lock_release(&prepage_lock);
+}
+
+// write the traces that changed to TRACE_FILE, with -prepage. called on
+// shutdown before the file system goes, skipped if it would have to wait
+void prepage_save(void){
+    if(!save_traces || intr_context() || !lock_try_acquire(&prepage_lock)){
+        return;
+    }
+    if(!lock_try_acquire(&fs_lock)){
+        lock_release(&prepage_lock);
+        return;
+    }
+    struct file *file = filesys_open(TRACE_FILE);
+    if(file == NULL && filesys_create(TRACE_FILE, sizeof traces)){
+        file = filesys_open(TRACE_FILE);
+    }
+    for(size_t i = 0; file != NULL && i < TRACE_SLOTS; i++){
+        if(traces_dirty[i]
+           && file_write_at(file, &traces[i], sizeof traces[i], i * sizeof traces[i]) == sizeof traces[i]){
+            traces_dirty[i] = false;
+            save_cnt++;
+        }
+    }
+    file_close(file);
+    lock_release(&fs_lock);
+    lock_release(&prepage_lock);
+}
+
+// the current process writes to the console, count the time from its exec
+// if it's the first time
+void prepage_first_output(void){
+    struct process *ps = thread_current()->ps;
+    if(ps == NULL || ps->exec_tsc == 0){
+        return;
+    }
+    uint64_t cycles = rdtsc() - ps->exec_tsc;
+    ps->exec_tsc = 0;
+
+    lock_acquire(&prepage_lock);
+    output_cnt++;
+    output_cycles += cycles;
+    lock_release(&prepage_lock);
+}
+
+void prepage_print_stats(void){
+    printf("Prepage: %zu of %zu execs traced, %zu pages prefetched, %zu traces saved\n",
+           traced_exec_cnt, exec_cnt, prefetch_cnt, save_cnt);
+    if(output_cnt > 0){
+        printf("Prepage: %zu processes, %llu cycles from exec to first output average\n",
+               output_cnt, (unsigned long long)(output_cycles / output_cnt));
+    }
+}
+
+// read TRACE_FILE the first time it's needed, the file system isn't up
+// when prepage_init() runs. prepage lock held
+static void load_traces(void){
+    if(traces_loaded){
+        return;
+    }
+    traces_loaded = true;
+    if(!save_traces){
+        return;
+    }
+
+    lock_acquire(&fs_lock);
+    struct file *file = filesys_open(TRACE_FILE);
+    if(file != NULL){
+        file_read_at(file, traces, sizeof traces, 0);
+        file_close(file);
+    }
+    lock_release(&fs_lock);
+
+    for(size_t i = 0; i < TRACE_SLOTS; i++){
+        if(!trace_valid(&traces[i])){
+            memset(&traces[i], 0, sizeof traces[i]);
+        }
+        if(traces[i].used > exec_clock){
+            exec_clock = traces[i].used;
+        }
+    }
+}
+
+// true if trace is unused or only names whole pages within its
+// executable's length, as pagecache_get() requires
+static bool trace_valid(const struct trace *trace){
+    if(trace->inumber == 0){
+        return trace->cnt == 0;
+    }
+    if(trace->length <= 0 || trace->cnt > PREPAGE_PAGES){
+        return false;
+    }
+    for(size_t i = 0; i < trace->cnt; i++){
+        off_t ofs = trace->ofs[i];
+        if(ofs < 0 || ofs % PGSIZE != 0 || ofs >= trace->length){
+            return false;
+        }
+    }
+    return true;
+}
+
+// slot holding the trace of inumber with that length, NULL if none.
+// prepage lock held
+static struct trace *find_trace(block_sector_t inumber, off_t length){
+    for(size_t i = 0; i < TRACE_SLOTS; i++){
+        if(traces[i].inumber == inumber && inumber != 0 && traces[i].length == length){
+            return &traces[i];
+        }
+    }
+    return NULL;
+}
+
+// prefetch thread: read a job's pages into the page cache in file order, so
+// the disk sees one pass over the executable. stops early rather than
+// evict for pages that may not be used
+static void prefetch(void *job_){
+    struct prefetch_job *job = job_;
+    qsort(job->ofs, job->cnt, sizeof *job->ofs, compare_ofs);
+
+    size_t done = 0;
+    for(size_t i = 0; i < job->cnt && ft_has_spare_frames(); i++){
+        size_t len;
+        struct frame *frame = pagecache_get(job->file, job->ofs[i], &len);
+        if(frame == NULL){
+            break;
+        }
+        ft_unpin(frame);
+        done++;
+    }
+
+    lock_acquire(&fs_lock);
+    file_close(job->file);
+    lock_release(&fs_lock);
+    free(job);
+
+    lock_acquire(&prepage_lock);
+    prefetch_cnt += done;
+    lock_release(&prepage_lock);
+}
+
+static int compare_ofs(const void *a_, const void *b_){
+    off_t a = *(const off_t *)a_, b = *(const off_t *)b_;
+    return a < b ? -1 : a > b;
+}
@@ -0,0 +1,22 @@
+#ifndef VM_PREPAGE_H
+#define VM_PREPAGE_H
+
+#include <stdbool.h>
+#include "filesys/off_t.h"
+
+// code pages remembered per executable, by file offset
+#define PREPAGE_PAGES 32
+
+struct file;
+struct supp_pt;
+
+void prepage_init(void);
+void prepage_set_save(bool save);
+void prepage_exec(struct file *exe, struct supp_pt *supp_pt);
+void prepage_note(struct supp_pt *supp_pt, off_t ofs);
+void prepage_exit(struct file *exe, struct supp_pt *supp_pt);
+void prepage_save(void);
+void prepage_first_output(void);
+void prepage_print_stats(void);
+
+#endif
@@ -0,0 +1,216 @@
+#include "vm/replace.h"
+#include <string.h>
+#include "lib/kernel/list.h"
+#include "threads/vaddr.h"
+#include "vm/frame.h"
+#include "vm/page.h"
+
+// clock: one circular list, a frame survives as long as its accessed bit
+// gets set again before the hand comes back around
+
+static struct list clock_list; // used frames
+static struct list_elem *clock_hand; // next frame to look at, NULL if none yet
+
+static void
+clock_init(void) {
+    list_init(&clock_list);
+    clock_hand = NULL;
+}
+
+static void
+clock_add(struct frame *frame) {
+    list_push_front(&clock_list, &frame->elem);
+}
+
+// Get the next frame in the clock hand order
+static struct list_elem *
+clock_advance(struct list_elem *e) {
+    e = list_next(e);
+    if (e == list_end(&clock_list)) {
+        e = list_begin(&clock_list); // wrap around to the beginning of the list
+    }
+    return e;
+}
+
+// take a frame off the list without leaving the clock hand dangling
+static void
+clock_remove(struct frame *frame, bool evicted UNUSED) {
+    if (clock_hand == &frame->elem) {
+        clock_hand = list_size(&clock_list) > 1 ? clock_advance(clock_hand) : NULL;
+    }
+    list_remove(&frame->elem);
+}
+
+static struct frame *
+clock_next(void) {
+    if (list_empty(&clock_list)) {
+        return NULL;
+    }
+    // first time we evict
+    if (clock_hand == NULL) {
+        clock_hand = list_begin(&clock_list);
+    }
+    struct frame *frame = list_entry(clock_hand, struct frame, elem);
+    clock_hand = clock_advance(clock_hand);
+    return frame;
+}
+
+static void
+clock_referenced(struct frame *frame UNUSED) {
+    // accessed bit was raked, the hand has already moved on
+}
+
+const struct replacement_policy clock_policy = {
+    .name = "clock",
+    .init = clock_init,
+    .add = clock_add,
+    .remove = clock_remove,
+    .next = clock_next,
+    .referenced = clock_referenced,
+};
+
+// 2Q: new frames start on the inactive list and are only promoted to the
+// active list when seen accessed on two scans in a row, so a page touched
+// once by a sequential scan is evicted from the inactive list without
+// disturbing the active working set. the active list is demoted back
+// (second chance on the accessed bit) to keep it no bigger than the
+// inactive one.
+// reuse distance: an evicted page remembers the eviction count; if it
+// faults back in within fewer evictions than the active list holds, a
+// bigger inactive list would have kept it, so it goes straight to active.
+
+static struct list active_list, inactive_list; // head is most recent
+static size_t active_cnt, inactive_cnt;
+static unsigned evict_seq; // evictions so far, page->evicted_at stamps
+
+static void
+twoq_init(void) {
+    list_init(&active_list);
+    list_init(&inactive_list);
+    active_cnt = inactive_cnt = 0;
+    evict_seq = 0;
+}
+
+static void
+activate(struct frame *frame) {
+    frame->active = true;
+    frame->referenced = false;
+    list_push_front(&active_list, &frame->elem);
+    active_cnt++;
+}
+
+static void
+deactivate(struct frame *frame) {
+    frame->active = false;
+    frame->referenced = false;
+    list_push_front(&inactive_list, &frame->elem);
+    inactive_cnt++;
+}
+
+static void
+twoq_add(struct frame *frame) {
+    struct page *page = frame->page; // NULL for page cache frames
+
+    if (page != NULL && page->evicted_at != 0 && evict_seq - page->evicted_at <= active_cnt) {
+        activate(frame);
+    }
+    else {
+        deactivate(frame);
+    }
+    if (page != NULL) {
+        page->evicted_at = 0;
+    }
+}
+
+static void
+twoq_remove(struct frame *frame, bool evicted) {
+    list_remove(&frame->elem);
+    if (frame->active) {
+        active_cnt--;
+    }
+    else {
+        inactive_cnt--;
+    }
+
+    if (evicted) {
+        if (++evict_seq == 0) {
+            evict_seq++; // 0 means not evicted
+        }
+        if (frame->page != NULL) {
+            frame->page->evicted_at = evict_seq;
+        }
+    }
+}
+
+// age the active list until it is no bigger than the inactive one
+static void
+twoq_balance(void) {
+    size_t budget = active_cnt;
+    while (active_cnt > inactive_cnt && budget-- > 0) {
+        struct frame *frame = list_entry(list_pop_back(&active_list), struct frame, elem);
+        active_cnt--;
+
+        if (!frame->busy && ft_test_accessed(frame)) {
+            activate(frame);
+        }
+        else {
+            deactivate(frame);
+        }
+    }
+}
+
+static struct frame *
+twoq_next(void) {
+    twoq_balance();
+
+    if (list_empty(&inactive_list)) {
+        if (list_empty(&active_list)) {
+            return NULL;
+        }
+        // the whole active list was referenced, demote the oldest anyway
+        active_cnt--;
+        deactivate(list_entry(list_pop_back(&active_list), struct frame, elem));
+    }
+
+    // rotate the tail to the head, so skipped candidates aren't seen again
+    // until the rest of the inactive list has been looked at
+    struct frame *frame = list_entry(list_pop_back(&inactive_list), struct frame, elem);
+    list_push_front(&inactive_list, &frame->elem);
+    return frame;
+}
+
+static void
+twoq_referenced(struct frame *frame) {
+    if (frame->active) {
+        return;
+    }
+    // first reference is the fault that brought the page in
+    if (!frame->referenced) {
+        frame->referenced = true;
+        return;
+    }
+    list_remove(&frame->elem);
+    inactive_cnt--;
+    activate(frame);
+}
+
+const struct replacement_policy twoq_policy = {
+    .name = "2q",
+    .init = twoq_init,
+    .add = twoq_add,
+    .remove = twoq_remove,
+    .next = twoq_next,
+    .referenced = twoq_referenced,
+};
+
+// policy by name, NULL if unknown
+const struct replacement_policy *
+replacement_policy_find(const char *name) {
+    static const struct replacement_policy *policies[] = { &clock_policy, &twoq_policy };
+    for (size_t i = 0; i < sizeof policies / sizeof *policies; i++) {
+        if (!strcmp(policies[i]->name, name)) {
+            return policies[i];
+        }
+    }
+    return NULL;
+}
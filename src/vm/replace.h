@@ -0,0 +1,25 @@
+#ifndef VM_REPLACE_H
+#define VM_REPLACE_H
+
+#include <stdbool.h>
+
+struct frame;
+
+// page replacement policy, decides in which order used frames are offered
+// to the evictor. the frame table does the pinning, locking and I/O.
+// every hook is called with the frame table lock held
+struct replacement_policy {
+    const char *name;
+    void (*init)(void);
+    void (*add)(struct frame *); // frame went into use, page set
+    void (*remove)(struct frame *, bool evicted); // frame leaves use, page still set
+    struct frame *(*next)(void); // next eviction candidate, NULL if no frame in use
+    void (*referenced)(struct frame *); // candidate was accessed, bit already cleared
+};
+
+extern const struct replacement_policy clock_policy;
+extern const struct replacement_policy twoq_policy;
+
+const struct replacement_policy *replacement_policy_find(const char *name);
+
+#endif
@@ -5,68 +5,428 @@
 #include "lib/round.h"
 #include "lib/debug.h"
 #include "threads/malloc.h"
+#include <limits.h>
 #include <stdio.h>
+#include <string.h>
 #include "userprog/syscall.h"
 #include "threads/thread.h"
+#include "threads/palloc.h"
+#include "vm/page.h"
+#include "vm/zswap.h"
 #include "swap.h"
 
+// 4096 / 512 = 8 sectors in a page
+#define SECTORS_PER_SLOT (PGSIZE / BLOCK_SECTOR_SIZE)
+
+// most swap devices used at once
+#define MAX_SWAP_AREAS 8
+
+// a swap device. its slots are a range of the global slot numbers, a
+// whole number of clusters, so a cluster never spans two devices
+struct swap_area {
+    struct block * block;
+    int priority; // higher is used first, see slot_alloc
+    size_t first_slot;
+    size_t slot_cnt;
+    size_t cluster_hint; // where to start looking for a free cluster
+
+    // statistics
+    size_t used_cnt; // slots in use
+    size_t read_cnt, write_cnt; // pages
+};
+
 // tracks usage of swap slots.
+// slots are handed out in clusters of SWAP_CLUSTER: a process keeps
+// filling the cluster it started before taking a new all-free one, so
+// pages it evicts together sit next to each other on disk and can be
+// read back together.
+// a swapped out page that compresses well is kept in the zswap cache
+// instead of being written to its slot, until the cache runs over its
+// limit and its oldest entries are written back.
+// with several swap devices, new clusters come from the highest priority
+// devices that have a free one, round-robin between devices of equal
+// priority, so their I/O runs in parallel
 struct swap_table {
-    struct block * swap_block;
-    struct bitmap * bitmap; // block_size(swap_block) * BLOCK_SECTOR_SIZE / PAGE_SIZE
+    struct swap_area areas[MAX_SWAP_AREAS];
+    size_t area_cnt;
+    size_t next_area; // round-robin position
+    struct bitmap * bitmap; // one bit per slot, of all areas
+    size_t slot_cnt;
+    size_t used_cnt; // slots marked in bitmap
+    struct swap_slot * slots; // owner of each used slot
+    struct list zswap_lru; // cached entries not being written back, newest first
+    struct lock lock; // protects everything but the device, not held during block I/O
+
+    // statistics
+    size_t zswap_hit_cnt, disk_read_cnt, writeback_cnt;
+    size_t clean_drop_cnt; // evictions that found the page still in its slot
+    size_t peak_used_cnt; // most slots ever in use at once
+};
+
+// who a used slot belongs to, for readahead, and its cached copy.
+// a slot is shared by the pages of forked processes that had the page
+// swapped out (or copy-on-write) at the time, it is freed with the last
+// of them and has no owner for readahead once one of them let go
+struct swap_slot {
+    struct supp_pt * owner;
+    struct page * page;
+    struct zswap_entry * zentry; // NULL if the page is (only) on disk
+    unsigned ref_cnt; // pages with this slot as their swap_index
 };
 
 // global swap table
 static struct swap_table* st;
 
+// -swappri=BDEV:PRIO settings, looked up when the areas are set up
+static struct {
+    char name[16];
+    int priority;
+} swap_priorities[MAX_SWAP_AREAS];
+static size_t swap_priority_cnt;
+
+// give swap device name priority prio (default 0), only before init_st()
+bool st_set_priority(const char *name, int prio){
+    if(swap_priority_cnt == MAX_SWAP_AREAS){
+        return false;
+    }
+    strlcpy(swap_priorities[swap_priority_cnt].name, name, sizeof swap_priorities[0].name);
+    swap_priorities[swap_priority_cnt].priority = prio;
+    swap_priority_cnt++;
+    return true;
+}
+
+// add block as a swap area
+static void
+add_area(struct block *block){
+    size_t slot_cnt = block_size(block) / SECTORS_PER_SLOT / SWAP_CLUSTER * SWAP_CLUSTER;
+    if(st->area_cnt == MAX_SWAP_AREAS || slot_cnt == 0){
+        printf("swap: not using %s\n", block_name(block));
+        return;
+    }
+
+    struct swap_area *area = &st->areas[st->area_cnt++];
+    area->block = block;
+    area->priority = 0;
+    for(size_t i = 0; i < swap_priority_cnt; i++){
+        if(!strcmp(swap_priorities[i].name, block_name(block))){
+            area->priority = swap_priorities[i].priority;
+        }
+    }
+    area->first_slot = st->slot_cnt;
+    area->slot_cnt = slot_cnt;
+    area->cluster_hint = 0;
+    area->used_cnt = area->read_cnt = area->write_cnt = 0;
+    st->slot_cnt += slot_cnt;
+}
+
 // init swap table
 void init_st(){
-    st = malloc(sizeof(struct swap_table));
-    st->swap_block = block_get_role(BLOCK_SWAP); // block device for swap
+    st = calloc_tagged(1, sizeof(struct swap_table), MEM_SWAP);
+    if(st == NULL){
+        PANIC("no memory for swap table");
+    }
+    lock_init(&st->lock);
+    list_init(&st->zswap_lru);
+    zswap_init();
 
-    if(st->swap_block == NULL){
+    // the swap role device first, then every other swap partition
+    struct block *role = block_get_role(BLOCK_SWAP); // block device for swap
+    if(role == NULL){
         ASSERT(1 == 2);
         return;
     }
+    add_area(role);
+    for(struct block *block = block_first(); block != NULL; block = block_next(block)){
+        if(block != role && block_type(block) == BLOCK_SWAP){
+            add_area(block);
+        }
+    }
+
+    // 8192 * 512 / 4096 = 1024 slots per 4 MB
+    st->bitmap = bitmap_create(st->slot_cnt);
+    st->slots = calloc_tagged(st->slot_cnt, sizeof(struct swap_slot), MEM_SWAP);
+    if(st->bitmap == NULL || st->slots == NULL){
+        PANIC("no memory for swap table");
+    }
+
+    ASSERT(bitmap_all(st->bitmap, 0, st->slot_cnt) == false);
+}
+
+// area holding slot
+static struct swap_area *
+area_of(size_t slot){
+    for(size_t i = 0; i < st->area_cnt; i++){
+        struct swap_area *area = &st->areas[i];
+        if(slot - area->first_slot < area->slot_cnt){
+            return area;
+        }
+    }
+    NOT_REACHED();
+}
+
+// read or write the page in slot, no lock held
+static void
+slot_read(size_t slot, void *kaddr){
+    struct swap_area *area = area_of(slot);
+    // slot * sectors per slot is the starting sector, the whole page in one go
+    block_read_multiple(area->block, (slot - area->first_slot) * SECTORS_PER_SLOT, kaddr, SECTORS_PER_SLOT);
+}
+
+static void
+slot_write(size_t slot, const void *kaddr){
+    struct swap_area *area = area_of(slot);
+    block_write_multiple(area->block, (slot - area->first_slot) * SECTORS_PER_SLOT, kaddr, SECTORS_PER_SLOT);
+}
+
+// take slot for a page, st lock held
+static void
+slot_take(size_t slot){
+    bitmap_mark(st->bitmap, slot);
+    st->used_cnt++;
+    if(st->used_cnt > st->peak_used_cnt){
+        st->peak_used_cnt = st->used_cnt;
+    }
+    area_of(slot)->used_cnt++;
+}
 
-    // 8192 * 512 / 4096
-    st->bitmap = bitmap_create(block_size(st->swap_block) * BLOCK_SECTOR_SIZE/PGSIZE); //1024 slots
+// give slot back, st lock held
+static void
+slot_release(size_t slot){
+    bitmap_reset(st->bitmap, slot);
+    st->used_cnt--;
+    area_of(slot)->used_cnt--;
+}
 
-    ASSERT(bitmap_all(st->bitmap, 0, block_size(st->swap_block) * BLOCK_SECTOR_SIZE/PGSIZE) == false);
+// first slot of a free cluster in area, BITMAP_ERROR if none.
+// next fit from the last one handed out
+static size_t
+area_cluster_alloc(struct swap_area *area){
+    size_t cluster_cnt = area->slot_cnt / SWAP_CLUSTER;
+    for(size_t i = 0; i < cluster_cnt; i++){
+        size_t cluster = (area->cluster_hint + i) % cluster_cnt;
+        size_t slot = area->first_slot + cluster * SWAP_CLUSTER;
+        if(bitmap_none(st->bitmap, slot, SWAP_CLUSTER)){
+            area->cluster_hint = cluster + 1;
+            return slot;
+        }
+    }
+    return BITMAP_ERROR;
 }
 
-// page out
-size_t st_write_at(void* uaddr){
-    size_t map_id = bitmap_scan_and_flip(st->bitmap, 0, 1, false);
+// find a slot for one of owner's pages, st lock held
+static size_t
+slot_alloc(struct supp_pt *owner){
+    // next slot of the cluster the owner is filling, if nobody took it
+    size_t slot = owner->swap_cursor;
+    if(slot % SWAP_CLUSTER != 0 && slot < st->slot_cnt && !bitmap_test(st->bitmap, slot)){
+        slot_take(slot);
+        owner->swap_cursor = slot + 1;
+        return slot;
+    }
+
+    // start a new cluster: try the areas by falling priority, each
+    // priority level round-robin starting after the last area used
+    bool tried[MAX_SWAP_AREAS] = { false };
+    for(size_t left = st->area_cnt; left > 0; ){
+        int prio = INT_MIN;
+        for(size_t i = 0; i < st->area_cnt; i++){
+            if(!tried[i] && st->areas[i].priority > prio){
+                prio = st->areas[i].priority;
+            }
+        }
+        for(size_t n = 0; n < st->area_cnt; n++){
+            size_t i = (st->next_area + n) % st->area_cnt;
+            if(tried[i] || st->areas[i].priority != prio){
+                continue;
+            }
+            tried[i] = true;
+            left--;
+            slot = area_cluster_alloc(&st->areas[i]);
+            if(slot != BITMAP_ERROR){
+                st->next_area = i + 1;
+                slot_take(slot);
+                owner->swap_cursor = slot + 1;
+                return slot;
+            }
+        }
+    }
+
+    // swap is fragmented, any slot will do
+    slot = bitmap_scan(st->bitmap, 0, 1, false);
+    if(slot != BITMAP_ERROR){
+        slot_take(slot);
+    }
+    owner->swap_cursor = 0;
+    return slot;
+}
+
+// write the oldest cached page to its slot, st lock held but dropped for
+// the I/O. the entry stays attached meanwhile so readers can still use it
+static bool
+zswap_writeback(void){
+    if(list_empty(&st->zswap_lru)){
+        return false;
+    }
+    void *bounce = palloc_get_page(PAL_TAG(MEM_SWAP));
+    if(bounce == NULL){
+        return false;
+    }
+
+    struct zswap_entry *entry = list_entry(list_pop_back(&st->zswap_lru), struct zswap_entry, elem);
+    size_t slot = entry->slot;
+    entry->writeback = true;
+    zswap_decompress(entry, bounce);
+    lock_release(&st->lock);
+
+    slot_write(slot, bounce);
+
+    lock_acquire(&st->lock);
+    st->writeback_cnt++;
+    area_of(slot)->write_cnt++;
+    if(entry->slot_freed){
+        slot_release(slot); // held back until our write was done
+    }
+    else {
+        st->slots[slot].zentry = NULL; // on disk from now on
+    }
+    zswap_free(entry);
+    palloc_free_page(bounce);
+    return true;
+}
+
+// page out page (of owner) from kaddr, returns the slot
+size_t st_write_at(void* kaddr, struct supp_pt *owner, struct page *page){
+    // compress before taking the lock, NULL means it goes to disk
+    struct zswap_entry *entry = zswap_compress(kaddr);
+
+    lock_acquire(&st->lock);
+    size_t map_id = slot_alloc(owner);
     ASSERT(map_id != BITMAP_ERROR);
+    st->slots[map_id].owner = owner;
+    st->slots[map_id].page = page;
+    st->slots[map_id].ref_cnt = 1;
 
-    ASSERT(bitmap_test(st->bitmap, map_id) == true);
-    size_t sector_in_page = PGSIZE / BLOCK_SECTOR_SIZE;
-    // 4096 / 512 = 8 sectors in a page
+    if(entry != NULL){
+        // make room by writing back the coldest entries
+        while(zswap_over_limit() && zswap_writeback())
+            continue;
 
-    for(size_t i = 0; i < sector_in_page; i++){
-        // id * sector_in_page is starting point, i++ to get from 0-7th sector of that page
-        // uaddr + (i * 512) to offset to the mem addr being written for that corresponding sector
-        block_write(st->swap_block, (map_id * sector_in_page)+i, uaddr + (i * BLOCK_SECTOR_SIZE));
+        entry->slot = map_id;
+        st->slots[map_id].zentry = entry;
+        list_push_front(&st->zswap_lru, &entry->elem);
+        lock_release(&st->lock);
+        return map_id;
     }
+    area_of(map_id)->write_cnt++;
+    lock_release(&st->lock);
 
+    slot_write(map_id, kaddr);
     return map_id;
 }
 
-// free slot
+// one more page has its contents in slot id
+void st_dup_page(size_t id){
+    lock_acquire(&st->lock);
+    ASSERT(bitmap_test(st->bitmap, id) && st->slots[id].ref_cnt > 0);
+    st->slots[id].ref_cnt++;
+    lock_release(&st->lock);
+}
+
+// free slot, once every page sharing it did
 void st_free_page(size_t id){
-    bitmap_reset(st->bitmap,id);
+    lock_acquire(&st->lock);
+    ASSERT(st->slots[id].ref_cnt > 0);
+    if(--st->slots[id].ref_cnt > 0){
+        st->slots[id].owner = NULL;
+        st->slots[id].page = NULL;
+        lock_release(&st->lock);
+        return;
+    }
+    struct zswap_entry *entry = st->slots[id].zentry;
+    st->slots[id].zentry = NULL;
+    if(entry != NULL && entry->writeback){
+        // still being written to the slot, the writer releases both
+        entry->slot_freed = true;
+    }
+    else {
+        if(entry != NULL){
+            list_remove(&entry->elem);
+            zswap_free(entry);
+        }
+        slot_release(id);
+    }
+    st->slots[id].owner = NULL;
+    st->slots[id].page = NULL;
+    lock_release(&st->lock);
 }
 
-// page in
-void st_read_at(void* uaddr, size_t id){
+// page in. with keep, a slot holding the page on disk stays allocated as
+// its copy while swap is less than half full, so the page can be dropped
+// again without I/O as long as it isn't written. returns true if kept
+bool st_read_at(void* kaddr, size_t id, bool keep){
+    lock_acquire(&st->lock);
     ASSERT(bitmap_test(st->bitmap,id) == true);
-    
-    size_t sector_in_page = PGSIZE / BLOCK_SECTOR_SIZE;
+    if(st->slots[id].zentry != NULL){
+        // the compressed copy is dropped, nothing on disk to keep
+        zswap_decompress(st->slots[id].zentry, kaddr);
+        st->zswap_hit_cnt++;
+        keep = false;
+        lock_release(&st->lock);
+    }
+    else {
+        st->disk_read_cnt++;
+        area_of(id)->read_cnt++;
+        keep = keep && st->used_cnt < st->slot_cnt / 2;
+        lock_release(&st->lock);
+        slot_read(id, kaddr);
+    }
 
-    for(size_t i = 0; i < sector_in_page; i++){
-        block_read(st->swap_block, (id * sector_in_page) + i, uaddr+ (i *BLOCK_SECTOR_SIZE));
+    if(!keep){
+        st_free_page(id);
     }
+    return keep;
+}
 
-    st_free_page(id);  
+// a page swapped in with st_read_at(keep) is evicted unmodified, its slot
+// still holds it
+void st_page_dropped(void){
+    lock_acquire(&st->lock);
+    st->clean_drop_cnt++;
+    lock_release(&st->lock);
+}
+
+// pages of owner swapped out in the slots following id within its cluster,
+// up to max of them into pages. caller holds owner's spt lock, so they
+// stay put, but may have been paged back in since (check page_location)
+size_t st_cluster_pages(struct supp_pt *owner, size_t id, struct page **pages, size_t max){
+    size_t cnt = 0;
+    size_t end = id - id % SWAP_CLUSTER + SWAP_CLUSTER;
+
+    lock_acquire(&st->lock);
+    for(size_t slot = id + 1; slot < end && slot < st->slot_cnt && cnt < max; slot++){
+        if(st->slots[slot].owner == owner){
+            pages[cnt++] = st->slots[slot].page;
+        }
+    }
+    lock_release(&st->lock);
+    return cnt;
+}
+
+// print swap statistics
+void st_print_stats(void){
+    if(st == NULL || st->area_cnt == 0){
+        return;
+    }
+    lock_acquire(&st->lock);
+    for(size_t i = 0; i < st->area_cnt; i++){
+        struct swap_area *area = &st->areas[i];
+        printf("Swap %s: priority %d, %zu of %zu slots in use, %zu pages read, %zu written\n",
+               block_name(area->block), area->priority, area->used_cnt, area->slot_cnt,
+               area->read_cnt, area->write_cnt);
+    }
+    printf("Swap: %zu of %zu slots in use (peak %zu), %zu pages read from zswap, %zu from disk, %zu written back, %zu clean drops\n",
+           st->used_cnt, st->slot_cnt, st->peak_used_cnt,
+           st->zswap_hit_cnt, st->disk_read_cnt, st->writeback_cnt, st->clean_drop_cnt);
+    lock_release(&st->lock);
+    zswap_print_stats();
 }
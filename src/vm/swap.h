@@ -1,7 +1,19 @@
 #include <stdio.h>
 #include <inttypes.h>
+#include <stdbool.h>
 
+struct supp_pt;
+struct page;
+
+// swap slots handed out to a process at a time, see vm/swap.c
+#define SWAP_CLUSTER 8
+
+bool st_set_priority(const char *name, int prio);
 void init_st(void);
-size_t st_write_at(void* uaddr);
+size_t st_write_at(void* kaddr, struct supp_pt *owner, struct page *page);
+void st_dup_page(size_t);
 void st_free_page(size_t);
-void st_read_at(void* uaddr, size_t id);
+bool st_read_at(void* kaddr, size_t id, bool keep);
+void st_page_dropped(void);
+void st_print_stats(void);
+size_t st_cluster_pages(struct supp_pt *owner, size_t id, struct page **pages, size_t max);
@@ -0,0 +1,196 @@
+#include "vm/wset.h"
+#include <debug.h>
+#include <list.h>
+#include <stdio.h>
+#include "devices/timer.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "vm/frame.h"
+#include "vm/page.h"
+
+// working sets and load control
+// each process's resident set limit follows its page fault frequency: a
+// fault within PFF_INTERVAL of the previous one means the process is short
+// of frames and raises the limit above what it holds, a later one means it
+// holds more than it uses and lowers the limit by an eighth. the frame
+// table enforces limits only while free frames run short, by having a
+// process over its limit evict one of its own pages instead of anybody's
+// when thrashing goes on anyway (the fault rate stays above LC_FAULT_RATE
+// with no spare frames for LC_WINDOWS periods) the load controller
+// deactivates the lowest priority process: it waits at its next page fault
+// and its frames are the first to go. one comes back whenever the fault
+// rate drops, frames are spare again or a process exits
+
+#define PFF_INTERVAL (TIMER_FREQ / 20) // ticks, faster faults grow the limit
+#define PFF_GROW 16 // pages above the resident set a short process may take
+#define LC_PERIOD (TIMER_FREQ / 4) // ticks between load controller looks
+#define LC_FAULT_RATE 400 // faults per second that count as thrashing
+#define LC_WINDOWS 2 // periods thrashing before deactivating
+
+// lock protects everything here and the wset fields of every supp_pt
+static struct lock wset_lock;
+static struct condition resume; // signaled when a process is reactivated
+static struct list procs; // supp_pts of processes that have faulted
+static size_t window_faults; // page faults in the current period
+
+// statistics
+static size_t deactivate_cnt, reactivate_cnt, wait_cnt;
+static size_t peak_rate;
+
+static void load_control(void *aux);
+static bool reactivate_one(void);
+static size_t max_size(size_t a, size_t b);
+
+// start the load controller
+void wset_start(void)
+{
+    lock_init(&wset_lock);
+    cond_init(&resume);
+    list_init(&procs);
+    if (thread_create("loadctl", NICE_DEFAULT, load_control, NULL) == TID_ERROR)
+    {
+        PANIC("can't start load controller");
+    }
+}
+
+// t takes a page fault from user mode: update its resident set limit,
+// waiting first if the load controller deactivated it. called without the
+// spt lock, so its frames can be evicted meanwhile
+void wset_fault(struct thread *t)
+{
+    struct supp_pt *supp_pt = t->supp_pt;
+
+    lock_acquire(&wset_lock);
+    if (supp_pt->owner == NULL)
+    {
+        supp_pt->owner = t;
+        supp_pt->last_fault = timer_ticks();
+        list_push_back(&procs, &supp_pt->wset_elem);
+    }
+    window_faults++;
+    if (supp_pt->inactive)
+    {
+        wait_cnt++;
+        while (supp_pt->inactive)
+        {
+            cond_wait(&resume, &wset_lock);
+        }
+    }
+
+    // racy read of rss, it only steers the limit
+    int64_t now = timer_ticks();
+    size_t rss = supp_pt->rss;
+    if (now - supp_pt->last_fault < PFF_INTERVAL)
+    {
+        if (supp_pt->rss_limit != WSET_NO_LIMIT)
+        {
+            supp_pt->rss_limit = max_size(supp_pt->rss_limit, rss + PFF_GROW);
+        }
+    }
+    else
+    {
+        supp_pt->rss_limit = max_size(WSET_MIN_PAGES, rss - rss / 8);
+    }
+    supp_pt->last_fault = now;
+    lock_release(&wset_lock);
+}
+
+// supp_pt's process is exiting, its frames are about to be freed
+void wset_exit(struct supp_pt *supp_pt)
+{
+    lock_acquire(&wset_lock);
+    if (supp_pt->owner != NULL)
+    {
+        // deactivated while it ran on without faulting
+        supp_pt->inactive = false;
+        list_remove(&supp_pt->wset_elem);
+        supp_pt->owner = NULL;
+        reactivate_one();
+    }
+    lock_release(&wset_lock);
+}
+
+void wset_print_stats(void)
+{
+    printf("Wset: %zu deactivations, %zu reactivations, %zu faults waited, peak %zu faults/s\n",
+           deactivate_cnt, reactivate_cnt, wait_cnt, peak_rate);
+}
+
+// load controller thread, see the top of the file
+static void load_control(void *aux UNUSED)
+{
+    int hot = 0;
+
+    for (;;)
+    {
+        timer_sleep(LC_PERIOD);
+        bool spare = ft_has_spare_frames();
+
+        lock_acquire(&wset_lock);
+        size_t rate = window_faults * (TIMER_FREQ / LC_PERIOD);
+        window_faults = 0;
+        peak_rate = rate > peak_rate ? rate : peak_rate;
+
+        if (rate < LC_FAULT_RATE || spare)
+        {
+            hot = 0;
+            reactivate_one();
+        }
+        else if (++hot >= LC_WINDOWS)
+        {
+            // lowest priority is the highest nice, then the biggest
+            struct supp_pt *victim = NULL;
+            size_t active = 0;
+            struct list_elem *e;
+            for (e = list_begin(&procs); e != list_end(&procs); e = list_next(e))
+            {
+                struct supp_pt *p = list_entry(e, struct supp_pt, wset_elem);
+                if (p->inactive)
+                {
+                    continue;
+                }
+                active++;
+                if (victim == NULL || p->owner->nice > victim->owner->nice
+                    || (p->owner->nice == victim->owner->nice && p->rss > victim->rss))
+                {
+                    victim = p;
+                }
+            }
+            // somebody has to keep running. to the back, so the inactive
+            // ones stay in the order they were deactivated
+            if (active > 1)
+            {
+                victim->inactive = true;
+                list_remove(&victim->wset_elem);
+                list_push_back(&procs, &victim->wset_elem);
+                deactivate_cnt++;
+            }
+            hot = 0;
+        }
+        lock_release(&wset_lock);
+    }
+}
+
+// let the process deactivated longest ago run again, true if there was
+// one. wset lock held
+static bool reactivate_one(void)
+{
+    struct list_elem *e;
+    for (e = list_begin(&procs); e != list_end(&procs); e = list_next(e))
+    {
+        struct supp_pt *p = list_entry(e, struct supp_pt, wset_elem);
+        if (p->inactive)
+        {
+            p->inactive = false;
+            reactivate_cnt++;
+            cond_broadcast(&resume, &wset_lock);
+            return true;
+        }
+    }
+    return false;
+}
+
+static size_t max_size(size_t a, size_t b)
+{
+    return a > b ? a : b;
+}
@@ -0,0 +1,18 @@
+#ifndef VM_WSET_H
+#define VM_WSET_H
+
+#include <stddef.h>
+
+// resident set limits start here and never go below WSET_MIN_PAGES
+#define WSET_NO_LIMIT ((size_t) -1)
+#define WSET_MIN_PAGES 16
+
+struct supp_pt;
+struct thread;
+
+void wset_start(void);
+void wset_fault(struct thread *t);
+void wset_exit(struct supp_pt *supp_pt);
+void wset_print_stats(void);
+
+#endif
@@ -0,0 +1,237 @@
+#include "vm/zswap.h"
+#include <debug.h>
+#include <stdio.h>
+#include <string.h>
+#include "threads/malloc.h"
+#include "threads/synch.h"
+#include "threads/vaddr.h"
+
+// compressed swap cache pool. entries are malloc'd from the kernel pool,
+// the pool is bounded by the bytes they take up. pages that don't shrink
+// to at most ZSWAP_MAX_LEN aren't worth keeping and go straight to disk
+
+#define ZSWAP_MAX_LEN (PGSIZE * 3 / 4)
+
+// lzf parameters
+#define HLOG 10
+#define HSIZE (1 << HLOG)
+#define MAX_LIT (1 << 5) // literal run length
+#define MAX_OFF (1 << 13) // back reference distance
+#define MAX_REF ((1 << 8) + (1 << 3)) // back reference length
+
+static size_t pool_limit = 64 * PGSIZE; // -zswap=PAGES, 0 turns the cache off
+static size_t pool_bytes; // charged to entries in the pool
+
+// compression scratch, too big for a kernel stack
+static uint16_t htab[HSIZE];
+static uint8_t scratch[ZSWAP_MAX_LEN];
+static struct lock zswap_lock; // scratch, pool_bytes, stats
+
+// statistics
+static size_t store_cnt, reject_cnt;
+static unsigned long long raw_bytes, compressed_bytes;
+
+static size_t lzf_compress(const uint8_t *in, size_t in_len, uint8_t *out, size_t out_len);
+static void lzf_decompress(const uint8_t *in, size_t in_len, uint8_t *out, size_t out_len);
+
+void zswap_init(void){
+    lock_init(&zswap_lock);
+}
+
+// size the pool, only before the first page is swapped out
+void zswap_set_pool_pages(size_t pages){
+    pool_limit = pages * PGSIZE;
+}
+
+// compressed copy of page, NULL if it doesn't compress well enough, the
+// cache is off or there's no memory. the entry is charged to the pool
+struct zswap_entry *zswap_compress(const void *page){
+    if(pool_limit == 0){
+        return NULL;
+    }
+
+    lock_acquire(&zswap_lock);
+    size_t len = lzf_compress(page, PGSIZE, scratch, sizeof scratch);
+    struct zswap_entry *entry = NULL;
+    if(len != 0){
+        entry = malloc_tagged(sizeof *entry + len, MEM_SWAP);
+    }
+    if(entry == NULL){
+        reject_cnt++;
+        lock_release(&zswap_lock);
+        return NULL;
+    }
+
+    memcpy(entry->data, scratch, len);
+    entry->len = len;
+    entry->writeback = false;
+    entry->slot_freed = false;
+
+    pool_bytes += sizeof *entry + len;
+    store_cnt++;
+    raw_bytes += PGSIZE;
+    compressed_bytes += len;
+    lock_release(&zswap_lock);
+    return entry;
+}
+
+// uncompress entry into page
+void zswap_decompress(const struct zswap_entry *entry, void *page){
+    lzf_decompress(entry->data, entry->len, page, PGSIZE);
+}
+
+// drop entry and uncharge it from the pool
+void zswap_free(struct zswap_entry *entry){
+    lock_acquire(&zswap_lock);
+    pool_bytes -= sizeof *entry + entry->len;
+    lock_release(&zswap_lock);
+    free(entry);
+}
+
+// true if cold entries should be written back to make room
+bool zswap_over_limit(void){
+    return pool_bytes > pool_limit;
+}
+
+// print compression statistics
+void zswap_print_stats(void){
+    lock_acquire(&zswap_lock);
+    printf("Zswap: %zu pages stored, %zu rejected, %llu%% compressed size, %zu bytes in pool\n",
+           store_cnt, reject_cnt,
+           raw_bytes != 0 ? compressed_bytes * 100 / raw_bytes : 0, pool_bytes);
+    lock_release(&zswap_lock);
+}
+
+static inline unsigned
+lzf_hash(const uint8_t *p){
+    uint32_t v = (p[0] << 16) | (p[1] << 8) | p[2];
+    return (v * 2654435761u) >> (32 - HLOG);
+}
+
+// lzf (Marc Lehmann's format): a control byte below 32 starts a run of
+// that many + 1 literals, otherwise its top 3 bits are the back reference
+// length - 2 (7: add the next byte) and the low 5 bits with the byte after
+// the distance - 1. returns the compressed length, 0 if out_len is too
+// small. zswap_lock held for htab
+static size_t
+lzf_compress(const uint8_t *in, size_t in_len, uint8_t *out, size_t out_len){
+    const uint8_t *ip = in;
+    const uint8_t *in_end = in + in_len;
+    uint8_t *op = out;
+    uint8_t *out_end = out + out_len;
+    size_t lit = 0;
+
+    if(out_len < 2){
+        return 0;
+    }
+    memset(htab, 0, sizeof htab);
+    op++; // control byte of the first literal run
+
+    while(ip + 2 < in_end){
+        unsigned h = lzf_hash(ip);
+        const uint8_t *ref = in + htab[h];
+        htab[h] = ip - in;
+
+        size_t off = ip - ref - 1;
+        if(ref < ip && off < MAX_OFF
+           && ref[0] == ip[0] && ref[1] == ip[1] && ref[2] == ip[2]){
+            size_t len = 2;
+            size_t maxlen = in_end - ip - len;
+            maxlen = maxlen > MAX_REF ? MAX_REF : maxlen;
+
+            // back reference (up to 3 bytes) and the next control byte
+            if(op - !lit + 3 + 1 >= out_end){
+                return 0;
+            }
+
+            op[-lit - 1] = lit - 1; // close the literal run
+            op -= !lit; // or drop it if empty
+
+            do {
+                len++;
+            } while(len < maxlen && ref[len] == ip[len]);
+
+            len -= 2;
+            ip++;
+            if(len < 7){
+                *op++ = (off >> 8) + (len << 5);
+            }
+            else {
+                *op++ = (off >> 8) + (7 << 5);
+                *op++ = len - 7;
+            }
+            *op++ = off;
+
+            lit = 0;
+            op++; // control byte of the next literal run
+            ip += len + 1;
+            continue;
+        }
+
+        // literal, leave room for the next control byte
+        if(op + 1 >= out_end){
+            return 0;
+        }
+        lit++;
+        *op++ = *ip++;
+        if(lit == MAX_LIT){
+            op[-lit - 1] = lit - 1;
+            lit = 0;
+            op++;
+        }
+    }
+
+    while(ip < in_end){
+        if(op + 1 >= out_end){
+            return 0;
+        }
+        lit++;
+        *op++ = *ip++;
+        if(lit == MAX_LIT){
+            op[-lit - 1] = lit - 1;
+            lit = 0;
+            op++;
+        }
+    }
+
+    op[-lit - 1] = lit - 1;
+    op -= !lit;
+    return op - out;
+}
+
+// inverse of lzf_compress, the data is our own so only assert on it
+static void
+lzf_decompress(const uint8_t *in, size_t in_len, uint8_t *out, size_t out_len){
+    const uint8_t *ip = in;
+    const uint8_t *in_end = in + in_len;
+    uint8_t *op = out;
+    uint8_t *out_end = out + out_len;
+
+    while(ip < in_end){
+        unsigned ctrl = *ip++;
+
+        if(ctrl < MAX_LIT){
+            size_t lit = ctrl + 1;
+            ASSERT(op + lit <= out_end && ip + lit <= in_end);
+            memcpy(op, ip, lit);
+            op += lit;
+            ip += lit;
+            continue;
+        }
+
+        size_t len = ctrl >> 5;
+        const uint8_t *ref = op - ((ctrl & 0x1f) << 8) - 1;
+        if(len == 7){
+            len += *ip++;
+        }
+        ref -= *ip++;
+        len += 2;
+        ASSERT(ref >= out && op + len <= out_end);
+
+        // may overlap, copy bytewise
+        while(len-- > 0){
+            *op++ = *ref++;
+        }
+    }
+    ASSERT(op == out_end);
+}
@@ -0,0 +1,28 @@
+#ifndef VM_ZSWAP_H
+#define VM_ZSWAP_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "lib/kernel/list.h"
+
+// compressed copy of a swapped out page, kept in kernel memory in front of
+// its swap slot. all fields but data belong to vm/swap.c (swap lock)
+struct zswap_entry {
+    struct list_elem elem; // lru, most recently stored first
+    size_t slot; // swap slot the page belongs to
+    bool writeback; // being written to the slot, swap.c frees it after
+    bool slot_freed; // slot was freed during writeback, release it after
+    size_t len; // bytes of compressed data
+    uint8_t data[]; // lzf compressed page
+};
+
+void zswap_init(void);
+void zswap_set_pool_pages(size_t pages);
+struct zswap_entry *zswap_compress(const void *page);
+void zswap_decompress(const struct zswap_entry *entry, void *page);
+void zswap_free(struct zswap_entry *entry);
+bool zswap_over_limit(void);
+void zswap_print_stats(void);
+
+#endif